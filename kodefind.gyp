@@ -30,6 +30,12 @@
 	  'msvs_debug_link_nonincremental%': '1',
     },  
     'default_configuration': 'Debug',
+    'conditions': [
+      ['OS!="win"', {
+        'cflags_cc': ['-std=c++11', '-pthread'],
+        'ldflags': ['-pthread'],
+      }],
+    ],
     'configurations': {
       # Abstract base configurations to cover common attributes.
       #
@@ -139,32 +145,172 @@
       'target_name': 'engine',
       'type': 'static_library',
       'sources': [
-	    'src/target_version_win.h',
-        'src/engine_v1_win.cc',
-        'src/engine_v1_win.h',
+        'src/bounded_queue.h',
+        'src/code_search.h',
+        'src/content_index.cc',
+        'src/content_index.h',
+        'src/content_trigrams.cc',
+        'src/content_trigrams.h',
+        'src/dir_lookup.cc',
+        'src/dir_lookup.h',
+        'src/dir_table.cc',
+        'src/dir_table.h',
+        'src/engine_v1.cc',
+        'src/engine_v1.h',
+        'src/file_stream.h',
+        'src/file_table.cc',
+        'src/file_table.h',
+        'src/fuzzy_match.cc',
+        'src/fuzzy_match.h',
+        'src/index_snapshot.cc',
+        'src/index_snapshot.h',
+        'src/mapped_file.h',
+        'src/metrics.cc',
+        'src/metrics.h',
+        'src/pod_array.h',
+        'src/prefix_index.cc',
+        'src/prefix_index.h',
+        'src/regex_match.cc',
+        'src/regex_match.h',
+        'src/scoped_ptr.h',
+        'src/simd_support.h',
+        'src/substring_match.cc',
+        'src/substring_match.h',
+        'src/thread_pool.cc',
+        'src/thread_pool.h',
+        'src/tokenizer.cc',
+        'src/tokenizer.h',
+        'src/trigram_index.cc',
+        'src/trigram_index.h',
+        'src/utf8.cc',
+        'src/utf8.h',
       ],
       'dependencies': [
       ],
+      'conditions': [
+        ['OS=="win"', {
+          'sources': [
+            'src/target_version_win.h',
+            'src/engine_v1_win.cc',
+            'src/file_stream_win.cc',
+            'src/mapped_file_win.cc',
+          ],
+        }, {  # OS!="win"
+          'sources': [
+            'src/dir_crawler_posix.cc',
+            'src/dir_crawler_posix.h',
+            'src/dir_watcher_posix.cc',
+            'src/dir_watcher_posix.h',
+            'src/engine_v1_posix.cc',
+            'src/file_reader_posix.cc',
+            'src/file_reader_posix.h',
+            'src/file_stream_posix.cc',
+            'src/mapped_file_posix.cc',
+            'src/query_protocol.h',
+            'src/query_protocol_posix.cc',
+          ],
+        }],
+      ],
     },
     {
-      'target_name': 'kodefind',
+      'target_name': 'search_bench',
       'type': 'executable',
       'sources': [
-	    'src/target_version_win.h',
-        'src/gui_win.cc',
-        'src/gui_win.h',
+        'src/search_bench.cc',
+      ],
+      'dependencies': [
+        'engine',
+      ],
+      'conditions': [
+        ['OS=="win"', {
+          'msvs_settings': {
+            'VCLinkerTool': {
+              'AdditionalDependencies': [
+                'psapi.lib',
+              ],
+            },
+          },
+        }],
+      ],
+    },
+    {
+      'target_name': 'substring_bench',
+      'type': 'executable',
+      'sources': [
+        'src/substring_bench.cc',
+      ],
+      'dependencies': [
+        'engine',
+      ],
+    },
+    {
+      'target_name': 'tokenizer_bench',
+      'type': 'executable',
+      'sources': [
+        'src/tokenizer_bench.cc',
+      ],
+      'dependencies': [
+        'engine',
+      ],
+    },
+    {
+      'target_name': 'thread_pool_test',
+      'type': 'executable',
+      'sources': [
+        'src/thread_pool_test.cc',
       ],
       'dependencies': [
         'engine',
       ],
-      'msvs_settings': {
-        'VCLinkerTool': {
-          'SubSystem': 2,
-        },
-        # 'VCManifestTool': {
-        #  'AdditionalManifestFiles': '$(ProjectDir)\\sawbuck.exe.manifest',
-        # },
-      },
     },
   ],
+  'conditions': [
+    ['OS=="win"', {
+      'targets': [
+        {
+          'target_name': 'kodefind',
+          'type': 'executable',
+          'sources': [
+            'src/target_version_win.h',
+            'src/gui_win.cc',
+            'src/gui_win.h',
+          ],
+          'dependencies': [
+            'engine',
+          ],
+          'msvs_settings': {
+            'VCLinkerTool': {
+              'SubSystem': 2,
+            },
+            # 'VCManifestTool': {
+            #  'AdditionalManifestFiles': '$(ProjectDir)\\sawbuck.exe.manifest',
+            # },
+          },
+        },
+      ],
+    }, {  # OS!="win"
+      'targets': [
+        {
+          'target_name': 'kodefind_client',
+          'type': 'executable',
+          'sources': [
+            'src/query_client_posix.cc',
+          ],
+          'dependencies': [
+            'engine',
+          ],
+        },
+        {
+          'target_name': 'kodefind_server',
+          'type': 'executable',
+          'sources': [
+            'src/query_server_posix.cc',
+          ],
+          'dependencies': [
+            'engine',
+          ],
+        },
+      ],
+    }],
+  ],
 }
@@ -0,0 +1,100 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stddef.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// A queue between the stages of a pipeline. Each item has a cost, one by
+// default, and Push() blocks while the queued items cost more than the
+// capacity, so a fast stage waits for a slow one instead of piling up work.
+// An item costlier than the whole capacity still goes in once the queue is
+// empty.
+//
+// Close() says that nothing more is coming: Push() fails from then on and
+// Pop() fails once the queue is empty. Any thread can call any of them.
+template <typename T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity) : capacity_(capacity), cost_(0), closed_(false) {}
+
+  // Returns false if the queue was closed.
+  bool Push(T&& item, size_t cost = 1) {
+    std::unique_lock<std::mutex> lock(lock_);
+    while (!closed_ && cost_ && (cost_ + cost > capacity_)) {
+      not_full_.wait(lock);
+    }
+    if (closed_)
+      return false;
+    items_.push_back(Entry(std::move(item), cost));
+    cost_ += cost;
+    not_empty_.notify_one();
+    return true;
+  }
+
+  // Returns false if the queue is closed and empty.
+  bool Pop(T* item) {
+    std::unique_lock<std::mutex> lock(lock_);
+    while (items_.empty() && !closed_) {
+      not_empty_.wait(lock);
+    }
+    if (items_.empty())
+      return false;
+    *item = std::move(items_.front().item);
+    cost_ -= items_.front().cost;
+    items_.pop_front();
+    not_full_.notify_all();
+    return true;
+  }
+
+  // Pops up to |max| items, as many as are there once there is one, into
+  // |items|. Returns false if the queue is closed and empty.
+  bool PopSome(std::vector<T>* items, size_t max) {
+    items->clear();
+    std::unique_lock<std::mutex> lock(lock_);
+    while (items_.empty() && !closed_) {
+      not_empty_.wait(lock);
+    }
+    while (!items_.empty() && (items->size() != max)) {
+      items->push_back(std::move(items_.front().item));
+      cost_ -= items_.front().cost;
+      items_.pop_front();
+    }
+    not_full_.notify_all();
+    return !items->empty();
+  }
+
+  void Close() {
+    std::lock_guard<std::mutex> lock(lock_);
+    closed_ = true;
+    not_full_.notify_all();
+    not_empty_.notify_all();
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(lock_);
+    return items_.size();
+  }
+
+private:
+  struct Entry {
+    T item;
+    size_t cost;
+    Entry(T&& i_item, size_t i_cost) : item(std::move(i_item)), cost(i_cost) {}
+  };
+
+  mutable std::mutex lock_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+  std::deque<Entry> items_;
+  const size_t capacity_;
+  size_t cost_;
+  bool closed_;
+
+  BoundedQueue(const BoundedQueue&);
+  void operator=(const BoundedQueue&);
+};
@@ -0,0 +1,231 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stdint.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+class CodeSearch {
+public:
+  enum Options {
+    None,
+    // Both match the name. A query with separators, like net/ht, also says
+    // which directories the file is in: the last ones of its path, or the
+    // first ones with a leading separator.
+    Substring,
+    BeginsWith,
+    // In-order subsequence of the relative path, best matches first.
+    Fuzzy
+  };
+
+  // How a bounded Search() or Continue() call ended.
+  enum Status {
+    Done,       // There are no more results.
+    More,       // A full batch, Continue() returns the next one.
+    Deadline,   // The time budget ran out. The batch can be short or even empty,
+                // Continue() resumes where this call stopped.
+    Cancelled   // The query was superseded. Its results are of no use.
+  };
+
+  // Bounds a Search() or Continue() call. The engine stops at its next check,
+  // at most one batch later, once |*generation| is no longer |expected|, and it
+  // returns what it has after |budget_ms| milliseconds. Zero means no budget.
+  struct Control {
+    const volatile long* generation;
+    long expected;
+    unsigned int budget_ms;
+  };
+
+  // Where the content index build is. The files go through a pipeline: a
+  // crawl lists the source files, reader threads load them and indexer
+  // threads tokenize and add them. The queues between the stages are
+  // bounded; a queue that stays full points at the stage after it as the
+  // bottleneck, one that stays empty at the stage before it.
+  struct ContentProgress {
+    size_t done;
+    size_t total;
+    // Files listed and not read yet.
+    size_t read_queue;
+    // Files read and not indexed yet.
+    size_t index_queue;
+    // Only on the last call, once the index is complete and queries see all
+    // of it. |done| can get to |total| a few calls before that.
+    bool finished;
+  };
+
+  // How SearchText() reads its pattern, or-ed together.
+  enum TextFlags {
+    TextRegex = 0,
+    // The pattern is a plain string.
+    TextLiteral = 1,
+    // ASCII letters match either case.
+    TextIgnoreCase = 2
+  };
+
+  // A line of a file that SearchText() found.
+  struct TextHit {
+    std::wstring path;
+    // From 1.
+    size_t line;
+    std::wstring text;
+  };
+
+  // How long a kind of call took, from the moment the engine was made.
+  struct Latency {
+    uint64_t count;
+    double p50_ms;
+    double p90_ms;
+    double p99_ms;
+    double p999_ms;
+    double max_ms;
+    // The log-linear buckets that have calls: the longest call in the
+    // bucket, in milliseconds, and how many calls. Each bucket spans a 16th
+    // of the power of two it is in.
+    std::vector<std::pair<double, uint64_t> > buckets;
+  };
+
+  // What the engine has been doing, for tuning. The engine keeps these all
+  // the time, each thread adding to counters of its own; reading sums them.
+  // The times of the content build phases add up all the threads in the
+  // phase, so they can be longer than the build itself.
+  struct Metrics {
+    // The last Index().
+    double index_ms;
+    uint64_t dirs;
+    uint64_t files;
+    uint64_t dirs_discarded;
+    uint64_t files_discarded;
+    uint64_t hidden_discarded;
+    // Opening, listing, stat-ing and closing directories.
+    uint64_t crawl_syscalls;
+
+    // The content build, so far if it is still going.
+    double content_ms;
+    double read_ms;
+    double tokenize_ms;
+    // Adding the tokens and trigrams to the content indexes.
+    double add_ms;
+    double finish_ms;
+    uint64_t files_read;
+    // The files too big to read whole, see IndexContent().
+    uint64_t files_streamed;
+    uint64_t bytes_read;
+    // Batched system calls count once.
+    uint64_t read_syscalls;
+    // See ContentProgress. Sampled as the build goes, the last sample and
+    // the largest.
+    uint64_t read_queue;
+    uint64_t read_queue_max;
+    uint64_t index_queue;
+    uint64_t index_queue_max;
+
+    // Bytes, mapped from a snapshot or on the heap. The content structures
+    // are estimates while they are being built.
+    uint64_t dir_table_bytes;
+    uint64_t file_table_bytes;
+    // The name trigrams, the sorted names and the fuzzy masks.
+    uint64_t name_index_bytes;
+    uint64_t content_index_bytes;
+    uint64_t content_trigram_bytes;
+
+    Latency search;
+    Latency more;   // Continue().
+  };
+
+  class Client {
+  public:
+    virtual bool OnIndexProgress(CodeSearch* engine, size_t files, size_t dirs) = 0;
+    // From the content index build thread. The last call has |finished|
+    // set.
+    virtual bool OnContentProgress(CodeSearch* engine, const ContentProgress& progress) = 0;
+    virtual bool OnError(int error_code) = 0;
+  };
+
+  virtual ~CodeSearch() {}
+
+  virtual int Index(const wchar_t* root_dir, Client* client) = 0;
+
+  // Writes what Index() built to |path|, in a form Load() maps back without
+  // parsing. Queries and Watch() go on while the file is written, Index()
+  // and Load() must not. Returns 0 on success.
+  virtual int Save(const wchar_t* path) = 0;
+  // Instead of Index(), maps the snapshot at |path| into a new engine. Fails if
+  // it is missing, comes from a different build or was taken of a root other
+  // than |root_dir|; the engine is of no further use then. The snapshot can be
+  // stale: index into another engine in the background and switch to it once
+  // it is done.
+  virtual int Load(const wchar_t* path, const wchar_t* root_dir) = 0;
+  // After Index() or Load(), keeps the index in step with the files added,
+  // removed and renamed in the tree until the engine is deleted. Queries run
+  // as usual meanwhile. Returns 0 if the engine can watch the tree.
+  virtual int Watch() = 0;
+
+  // After Index() or Load(), starts indexing the contents of the source files
+  // in the background and returns. |client|, if any, gets the progress and
+  // has to outlive the build. Calls after the first do nothing.
+  virtual int IndexContent(Client* client) = 0;
+  // Returns the files whose contents have the identifier |token|, matched
+  // whole and case sensitive. While the build is going the answer covers the
+  // files done so far and |*partial| is set. Files added by Watch() are not
+  // in the content index.
+  virtual std::vector<std::wstring> SearchContent(const wchar_t* token, bool* partial) = 0;
+  // Sets |hits| to the lines of the source files that match |pattern|, a
+  // regular expression unless |flags| has TextLiteral, at most |max_hits| of
+  // them in index order. Only the files whose contents have the trigrams the
+  // pattern needs are read. The same as SearchContent() about |*partial|.
+  // Returns -1, with the reason in |error| if given, if the pattern is not
+  // valid.
+  virtual int SearchText(const wchar_t* pattern, unsigned int flags, size_t max_hits,
+                         std::vector<TextHit>* hits, bool* partial, std::string* error) = 0;
+
+  // Fills |metrics|. Can be called at any time from any thread. Returns 0
+  // on success.
+  virtual int GetMetrics(Metrics* metrics) = 0;
+
+  virtual std::vector<std::wstring> Search(const wchar_t* txt, Options options) = 0;
+  virtual std::vector<std::wstring> Continue() = 0;
+
+  virtual std::vector<std::wstring> Search(const wchar_t* txt, Options options,
+                                           const Control& control, Status* status) = 0;
+  virtual std::vector<std::wstring> Continue(const Control& control, Status* status) = 0;
+
+  // Search() and Continue() above keep where the query is in the engine, for
+  // one caller. Callers that share an engine, from any threads, each keep
+  // theirs in a session instead. The caller deletes it before the engine.
+  class Session {
+  public:
+    virtual ~Session() {}
+  };
+  virtual Session* NewSession() = 0;
+  virtual std::vector<std::wstring> Search(Session* session, const wchar_t* txt, Options options,
+                                           const Control& control, Status* status) = 0;
+  virtual std::vector<std::wstring> Continue(Session* session, const Control& control,
+                                             Status* status) = 0;
+
+  // Names a file for as long as the engine lives. Files that Watch() sees
+  // go away keep their id, it is not handed out again.
+  typedef uint32_t FileId;
+
+  // The bounded Search() and Continue() of |session|, or of the engine if
+  // NULL, that set |ids| to the matches instead of making their paths. The
+  // caller makes the paths of the matches it shows with GetPath().
+  virtual Status SearchIds(Session* session, const wchar_t* txt, Options options,
+                           const Control& control, std::vector<FileId>* ids) = 0;
+  virtual Status ContinueIds(Session* session, const Control& control,
+                             std::vector<FileId>* ids) = 0;
+  // Writes the path of |id| to |buf|, as much of it as fits in |size|
+  // characters with the terminating zero. Returns the length of the whole
+  // path, zero if |id| is not a file of the engine. Can be called from any
+  // thread.
+  virtual size_t GetPath(FileId id, wchar_t* buf, size_t size) = 0;
+  // The same in UTF-8, with |size| and the length in bytes. It is how the
+  // engine keeps its names, so nothing is converted.
+  virtual size_t GetPathUtf8(FileId id, char* buf, size_t size) = 0;
+};
+
+// The default is |name| = NULL, which picks the native engine of the platform.
+// On POSIX systems "posix" also returns the getdents64 based engine.
+CodeSearch* CodeSearchFactory(const char* name);
@@ -0,0 +1,223 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "content_index.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "thread_pool.h"
+
+namespace {
+  typedef std::pair<const std::string, std::vector<uint32_t> > Posting;
+
+  bool KeyLess(const Posting* lhs, const Posting* rhs) {
+    return lhs->first < rhs->first;
+  }
+}
+
+ContentIndex::ContentIndex() : finished_(false), bytes_(0) {
+}
+
+size_t ContentIndex::ShardOf(const char* token, size_t len) {
+  unsigned int hash = 2166136261u;
+  for (size_t ix = 0; ix != len; ++ix) {
+    hash = (hash ^ static_cast<unsigned char>(token[ix])) * 16777619u;
+  }
+  return hash % kShards;
+}
+
+void ContentIndex::LockAll() const {
+  for (size_t sx = 0; sx != kShards; ++sx) {
+    shards_[sx].lock.lock();
+  }
+}
+
+void ContentIndex::UnlockAll() const {
+  for (size_t sx = 0; sx != kShards; ++sx) {
+    shards_[sx].lock.unlock();
+  }
+}
+
+void ContentIndex::Start() {
+  LockAll();
+  finished_ = false;
+  // The bucket arrays keep their room.
+  size_t bytes = 0;
+  for (size_t sx = 0; sx != kShards; ++sx) {
+    shards_[sx].building.clear();
+    bytes += shards_[sx].building.bucket_count() * sizeof(void*);
+  }
+  keys_.clear();
+  key_starts_.clear();
+  starts_.clear();
+  postings_.clear();
+  bytes_ = bytes;
+  UnlockAll();
+}
+
+void ContentIndex::Add(uint32_t file, const TokenList& tokens) {
+  // Group the tokens by shard so that each shard is locked once.
+  size_t counts[kShards + 1] = {0};
+  std::vector<uint8_t> shard_of(tokens.size());
+  for (size_t ix = 0; ix != tokens.size(); ++ix) {
+    shard_of[ix] = static_cast<uint8_t>(ShardOf(tokens.token(ix), tokens.token_len(ix)));
+    ++counts[shard_of[ix] + 1];
+  }
+  for (size_t sx = 0; sx != kShards; ++sx) {
+    counts[sx + 1] += counts[sx];
+  }
+  std::vector<uint32_t> order(tokens.size());
+  size_t next[kShards];
+  std::copy(counts, counts + kShards, next);
+  for (size_t ix = 0; ix != tokens.size(); ++ix) {
+    order[next[shard_of[ix]]++] = static_cast<uint32_t>(ix);
+  }
+
+  // What the dictionaries grow by: a node per new entry next to the bucket
+  // array, what the key and the list hold outside of it.
+  size_t grown = 0;
+  std::string key;
+  for (size_t sx = 0; sx != kShards; ++sx) {
+    if (counts[sx] == counts[sx + 1])
+      continue;
+    Shard& shard = shards_[sx];
+    std::lock_guard<std::mutex> lock(shard.lock);
+    const size_t buckets = shard.building.bucket_count();
+    // The tokens of a file mostly go in together, a list that already ends
+    // with this file has seen the token before. Files added in parts can
+    // still repeat, the sorts drop those.
+    for (size_t ox = counts[sx]; ox != counts[sx + 1]; ++ox) {
+      key.assign(tokens.token(order[ox]), tokens.token_len(order[ox]));
+      PostingMap::iterator it = shard.building.find(key);
+      if (it == shard.building.end()) {
+        it = shard.building.insert(std::make_pair(key, std::vector<uint32_t>())).first;
+        grown += sizeof(void*) + sizeof(*it) + it->first.capacity();
+      }
+      std::vector<uint32_t>& files = it->second;
+      if (files.empty() || (files.back() != file)) {
+        const size_t capacity = files.capacity();
+        files.push_back(file);
+        grown += (files.capacity() - capacity) * sizeof(uint32_t);
+      }
+    }
+    grown += (shard.building.bucket_count() - buckets) * sizeof(void*);
+  }
+  bytes_.fetch_add(grown, std::memory_order_relaxed);
+}
+
+void ContentIndex::SortShard(size_t sx) {
+  PostingMap& building = shards_[sx].building;
+  for (PostingMap::iterator it = building.begin(); it != building.end(); ++it) {
+    // The workers finish files out of order.
+    std::vector<uint32_t>& files = it->second;
+    std::sort(files.begin(), files.end());
+    files.erase(std::unique(files.begin(), files.end()), files.end());
+  }
+}
+
+// Nothing is added any more, so the dictionaries only change in the sorts,
+// each under the lock of its shard. The packing only reads them and holds no
+// lock, lookups go on against the dictionaries meanwhile and only wait for
+// the packed table to be published.
+void ContentIndex::Finish(ThreadPool* pool) {
+  TaskGroup sorts;
+  for (size_t sx = 0; sx != kShards; ++sx) {
+    pool->Post(&sorts, [this, sx]() {
+      std::lock_guard<std::mutex> lock(shards_[sx].lock);
+      SortShard(sx);
+    });
+  }
+  sorts.Wait();
+
+  std::vector<const Posting*> order;
+  size_t key_chars = 0;
+  size_t total = 0;
+  for (size_t sx = 0; sx != kShards; ++sx) {
+    const PostingMap& building = shards_[sx].building;
+    for (PostingMap::const_iterator it = building.begin(); it != building.end(); ++it) {
+      order.push_back(&*it);
+      key_chars += it->first.size();
+      total += it->second.size();
+    }
+  }
+  std::sort(order.begin(), order.end(), KeyLess);
+
+  // Nobody reads the packed arrays before |finished_| is set.
+  keys_.reserve(key_chars);
+  key_starts_.resize(order.size() + 1);
+  starts_.resize(order.size() + 1);
+  postings_.resize(total);
+  uint32_t* key_starts = key_starts_.mutable_data();
+  uint32_t* starts = starts_.mutable_data();
+  uint32_t* postings = postings_.mutable_data();
+
+  uint32_t sum = 0;
+  for (size_t kx = 0; kx != order.size(); ++kx) {
+    const std::string& key = order[kx]->first;
+    const std::vector<uint32_t>& files = order[kx]->second;
+    key_starts[kx] = static_cast<uint32_t>(keys_.size());
+    keys_.append(key.data(), key.size());
+    starts[kx] = sum;
+    std::copy(files.begin(), files.end(), postings + sum);
+    sum += static_cast<uint32_t>(files.size());
+  }
+  key_starts[order.size()] = static_cast<uint32_t>(keys_.size());
+  starts[order.size()] = sum;
+
+  // The dictionaries are swapped out to be freed after the locks are gone.
+  PostingMap retired[kShards];
+  LockAll();
+  for (size_t sx = 0; sx != kShards; ++sx) {
+    retired[sx].swap(shards_[sx].building);
+  }
+  bytes_ = keys_.memory_size() + key_starts_.memory_size() + starts_.memory_size() +
+           postings_.memory_size();
+  finished_ = true;
+  UnlockAll();
+}
+
+size_t ContentIndex::Find(const std::string& token) const {
+  size_t lo = 0;
+  size_t hi = key_starts_.empty() ? 0 : key_starts_.size() - 1;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    size_t len = key_starts_[mid + 1] - key_starts_[mid];
+    int cmp = memcmp(keys_.data() + key_starts_[mid], token.data(), std::min(len, token.size()));
+    if ((cmp < 0) || ((cmp == 0) && (len < token.size())))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if ((lo == hi) && (lo + 1 < key_starts_.size()) &&
+      (key_starts_[lo + 1] - key_starts_[lo] == token.size()) &&
+      (0 == memcmp(keys_.data() + key_starts_[lo], token.data(), token.size())))
+    return lo;
+  return static_cast<size_t>(-1);
+}
+
+bool ContentIndex::Lookup(const std::string& token, std::vector<uint32_t>* files) const {
+  files->clear();
+  Shard& shard = shards_[ShardOf(token.data(), token.size())];
+  std::lock_guard<std::mutex> lock(shard.lock);
+  if (finished_) {
+    size_t pos = Find(token);
+    if (pos != static_cast<size_t>(-1))
+      files->assign(postings_.begin() + starts_[pos], postings_.begin() + starts_[pos + 1]);
+    return true;
+  }
+
+  PostingMap::const_iterator it = shard.building.find(token);
+  if (it != shard.building.end()) {
+    files->assign(it->second.begin(), it->second.end());
+    std::sort(files->begin(), files->end());
+    files->erase(std::unique(files->begin(), files->end()), files->end());
+  }
+  return false;
+}
+
+bool ContentIndex::finished() const {
+  std::lock_guard<std::mutex> lock(shards_[0].lock);
+  return finished_;
+}
@@ -0,0 +1,89 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "pod_array.h"
+#include "tokenizer.h"
+
+class ThreadPool;
+
+// Maps every token found in the contents of the files to the files that have
+// it. It is built in the background, any number of threads add files in any
+// order, and lookups can run all along: they see the files added so far.
+// Finish() then packs the postings like the TrigramIndex does, the tokens
+// sorted in one arena and the lists of files back to back.
+//
+// While building, the tokens are spread by hash over shards that each have
+// their own lock and dictionary, so threads adding files at the same time
+// rarely wait on each other.
+class ContentIndex {
+public:
+  ContentIndex();
+
+  // Forgets everything.
+  void Start();
+
+  // Adds the tokens of |file|, repeats are fine. A file can go in several
+  // parts, from as many calls on one thread.
+  void Add(uint32_t file, const TokenList& tokens);
+
+  // Sorts the postings of the shards as tasks on |pool| and packs them.
+  // Nothing can be added after this. Lookups go on while it packs, they
+  // only wait for the packed table to be swapped in.
+  void Finish(ThreadPool* pool);
+
+  // Sets |files| to the files, in index order, that contain |token|. Returns
+  // false while the build still has files to go.
+  bool Lookup(const std::string& token, std::vector<uint32_t>* files) const;
+
+  bool finished() const;
+
+  // About how many bytes it takes, counting the dictionaries of the shards
+  // while it is being built. Kept up to date as the files go in, so it is
+  // cheap and never waits on the build.
+  size_t memory_size() const { return bytes_.load(std::memory_order_relaxed); }
+
+private:
+  typedef std::unordered_map<std::string, std::vector<uint32_t> > PostingMap;
+
+  static const size_t kShards = 64;
+  struct Shard {
+    std::mutex lock;
+    PostingMap building;
+  };
+
+  static size_t ShardOf(const char* token, size_t len);
+  void LockAll() const;
+  void UnlockAll() const;
+  // Sorts and dedups the postings of shard |sx|.
+  void SortShard(size_t sx);
+
+  // Returns the position of |token| in the packed keys or -1.
+  size_t Find(const std::string& token) const;
+
+  mutable Shard shards_[kShards];
+  // Only changes with every shard locked, reading it takes any one of them.
+  bool finished_;
+  // What memory_size() returns.
+  std::atomic<size_t> bytes_;
+
+  // Once finished. Token |kx| is the characters [key_starts_[kx],
+  // key_starts_[kx + 1]) of |keys_|, its files are [starts_[kx],
+  // starts_[kx + 1]) of |postings_|.
+  PodArray<char> keys_;
+  PodArray<uint32_t> key_starts_;
+  PodArray<uint32_t> starts_;
+  PodArray<uint32_t> postings_;
+
+  ContentIndex(const ContentIndex&);
+  void operator=(const ContentIndex&);
+};
@@ -0,0 +1,422 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "content_trigrams.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include "thread_pool.h"
+
+namespace {
+  unsigned char Fold(unsigned char c) {
+    return ((c >= 'A') && (c <= 'Z')) ? static_cast<unsigned char>(c + ('a' - 'A')) : c;
+  }
+
+  uint32_t Key(const char* three) {
+    return (static_cast<uint32_t>(Fold(three[0])) << 16) |
+           (static_cast<uint32_t>(Fold(three[1])) << 8) |
+           static_cast<uint32_t>(Fold(three[2]));
+  }
+
+  void AppendKey(uint32_t key, std::string* out) {
+    for (int shift = 16; shift >= 0; shift -= 8) {
+      unsigned char c = static_cast<unsigned char>(key >> shift);
+      if ((c < 0x20) || (c > 0x7E)) {
+        const char kHex[] = "0123456789abcdef";
+        out->append("\\x");
+        out->append(1, kHex[c >> 4]);
+        out->append(1, kHex[c & 0xF]);
+      } else {
+        out->append(1, static_cast<char>(c));
+      }
+    }
+  }
+
+  // A '\n', or the '\r' of a "\r\n".
+  bool IsLineBreak(const char* pc, const char* end) {
+    return (*pc == '\n') || ((*pc == '\r') && (pc + 1 != end) && (pc[1] == '\n'));
+  }
+
+  // Appends |sub| to the ANDs or ORs of |out|, merging it in if it is the
+  // same kind of node.
+  void Merge(const TrigramQuery& sub, TrigramQuery* out) {
+    if (sub.op == out->op)
+      out->subs.insert(out->subs.end(), sub.subs.begin(), sub.subs.end());
+    else
+      out->subs.push_back(sub);
+  }
+
+  bool Same(const TrigramQuery& lhs, const TrigramQuery& rhs) {
+    if ((lhs.op != rhs.op) || (lhs.trigram != rhs.trigram) || (lhs.subs.size() != rhs.subs.size()))
+      return false;
+    for (size_t ix = 0; ix != lhs.subs.size(); ++ix) {
+      if (!Same(lhs.subs[ix], rhs.subs[ix]))
+        return false;
+    }
+    return true;
+  }
+
+  // Drops the subs of an AND or OR that repeat another, a pattern like a{1000}
+  // or a long literal names the same trigrams over and over. The trigrams are
+  // sorted and go first. Returns the only sub if one is left.
+  TrigramQuery Dedup(TrigramQuery query) {
+    std::vector<uint32_t> keys;
+    std::vector<TrigramQuery> others;
+    for (size_t ix = 0; ix != query.subs.size(); ++ix) {
+      const TrigramQuery& sub = query.subs[ix];
+      if (sub.op == TrigramQuery::kTrigram) {
+        keys.push_back(sub.trigram);
+        continue;
+      }
+      bool seen = false;
+      for (size_t ox = 0; (ox != others.size()) && !seen; ++ox) {
+        seen = Same(others[ox], sub);
+      }
+      if (!seen)
+        others.push_back(sub);
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    query.subs.clear();
+    for (size_t kx = 0; kx != keys.size(); ++kx) {
+      TrigramQuery leaf(TrigramQuery::kTrigram);
+      leaf.trigram = keys[kx];
+      query.subs.push_back(leaf);
+    }
+    query.subs.insert(query.subs.end(), others.begin(), others.end());
+    if (query.subs.size() == 1)
+      return query.subs[0];
+    return query;
+  }
+}
+
+TrigramQuery TrigramQuery::Trigram(const char* three) {
+  TrigramQuery query(kTrigram);
+  query.trigram = Key(three);
+  return query;
+}
+
+TrigramQuery TrigramQuery::And(const TrigramQuery& lhs, const TrigramQuery& rhs) {
+  if ((lhs.op == kNone) || (rhs.op == kAll))
+    return lhs;
+  if ((rhs.op == kNone) || (lhs.op == kAll))
+    return rhs;
+  TrigramQuery query(kAnd);
+  Merge(lhs, &query);
+  Merge(rhs, &query);
+  return Dedup(query);
+}
+
+TrigramQuery TrigramQuery::Or(const TrigramQuery& lhs, const TrigramQuery& rhs) {
+  if ((lhs.op == kAll) || (rhs.op == kNone))
+    return lhs;
+  if ((rhs.op == kAll) || (lhs.op == kNone))
+    return rhs;
+  TrigramQuery query(kOr);
+  Merge(lhs, &query);
+  Merge(rhs, &query);
+  return Dedup(query);
+}
+
+// One AND of all the trigrams, deduplicated once, rather than an And() per
+// trigram that copies the ones so far.
+TrigramQuery TrigramQuery::Literal(const std::string& str) {
+  if (str.size() < 3)
+    return TrigramQuery(kAll);
+  TrigramQuery query(kAnd);
+  for (size_t ix = 0; ix + 3 <= str.size(); ++ix) {
+    query.subs.push_back(Trigram(&str[ix]));
+  }
+  return Dedup(query);
+}
+
+std::string TrigramQuery::ToString() const {
+  std::string out;
+  switch (op) {
+    case kAll:
+      return "+";
+    case kNone:
+      return "-";
+    case kTrigram:
+      AppendKey(trigram, &out);
+      return out;
+    case kAnd:
+    case kOr:
+      for (size_t ix = 0; ix != subs.size(); ++ix) {
+        if (ix)
+          out.append((op == kAnd) ? " " : "|");
+        bool paren = (subs[ix].op == kAnd) || (subs[ix].op == kOr);
+        if (paren)
+          out.append("(");
+        out.append(subs[ix].ToString());
+        if (paren)
+          out.append(")");
+      }
+      return out;
+  }
+  return out;
+}
+
+ContentTrigrams::ContentTrigrams() : finished_(false), bytes_(0) {
+}
+
+void ContentTrigrams::LockAll() const {
+  for (size_t sx = 0; sx != kShards; ++sx) {
+    shards_[sx].lock.lock();
+  }
+}
+
+void ContentTrigrams::UnlockAll() const {
+  for (size_t sx = 0; sx != kShards; ++sx) {
+    shards_[sx].lock.unlock();
+  }
+}
+
+void ContentTrigrams::Start() {
+  LockAll();
+  finished_ = false;
+  // The bucket arrays and |files_| keep their room.
+  size_t bytes = files_.capacity() * sizeof(uint32_t);
+  for (size_t sx = 0; sx != kShards; ++sx) {
+    shards_[sx].building.clear();
+    bytes += shards_[sx].building.bucket_count() * sizeof(void*);
+  }
+  files_.clear();
+  keys_.clear();
+  starts_.clear();
+  postings_.clear();
+  bytes_ = bytes;
+  UnlockAll();
+}
+
+void ContentTrigrams::Add(uint32_t file, const char* beg, const char* end, Scratch* scratch) {
+  // A bitmap of all the 2^24 trigrams finds the distinct ones of the file
+  // in one pass, much faster than sorting them. Queries go a line at a time,
+  // so no trigram spans a line break. That is a '\n' or the "\r\n" the
+  // matcher strips as one, see RegexQuery::FindLines(). A lone '\r' is part
+  // of its line.
+  std::vector<uint64_t>& seen = scratch->seen;
+  if (seen.empty())
+    seen.resize((1 << 24) / 64);
+  std::vector<uint32_t>& keys = scratch->keys;
+  keys.clear();
+  for (const char* pc = beg; pc + 3 <= end; ++pc) {
+    if (IsLineBreak(pc + 2, end)) {
+      pc += 2;
+      continue;
+    }
+    if (IsLineBreak(pc + 1, end)) {
+      ++pc;
+      continue;
+    }
+    if (IsLineBreak(pc, end))
+      continue;
+    uint32_t key = Key(pc);
+    uint64_t bit = 1ull << (key & 63);
+    if (!(seen[key >> 6] & bit)) {
+      seen[key >> 6] |= bit;
+      keys.push_back(key);
+    }
+  }
+  for (size_t ix = 0; ix != keys.size(); ++ix) {
+    seen[keys[ix] >> 6] = 0;
+  }
+
+  // Group them by shard so that each shard is locked once.
+  size_t counts[kShards + 1] = {0};
+  for (size_t ix = 0; ix != keys.size(); ++ix) {
+    ++counts[ShardOf(keys[ix]) + 1];
+  }
+  for (size_t sx = 0; sx != kShards; ++sx) {
+    counts[sx + 1] += counts[sx];
+  }
+  std::vector<uint32_t>& order = scratch->order;
+  order.resize(keys.size());
+  size_t next[kShards];
+  std::copy(counts, counts + kShards, next);
+  for (size_t ix = 0; ix != keys.size(); ++ix) {
+    order[next[ShardOf(keys[ix])]++] = keys[ix];
+  }
+
+  // What the dictionaries grow by, see ContentIndex::Add().
+  size_t grown = 0;
+  for (size_t sx = 0; sx != kShards; ++sx) {
+    Shard& shard = shards_[sx];
+    std::lock_guard<std::mutex> lock(shard.lock);
+    if (sx == 0) {
+      const size_t capacity = files_.capacity();
+      files_.push_back(file);
+      grown += (files_.capacity() - capacity) * sizeof(uint32_t);
+    }
+    const size_t buckets = shard.building.bucket_count();
+    for (size_t ox = counts[sx]; ox != counts[sx + 1]; ++ox) {
+      const size_t entries = shard.building.size();
+      std::vector<uint32_t>& files = shard.building[order[ox]];
+      if (shard.building.size() != entries)
+        grown += sizeof(void*) + sizeof(PostingMap::value_type);
+      const size_t capacity = files.capacity();
+      files.push_back(file);
+      grown += (files.capacity() - capacity) * sizeof(uint32_t);
+    }
+    grown += (shard.building.bucket_count() - buckets) * sizeof(void*);
+  }
+  bytes_.fetch_add(grown, std::memory_order_relaxed);
+}
+
+void ContentTrigrams::SortShard(size_t sx) {
+  PostingMap& building = shards_[sx].building;
+  for (PostingMap::iterator it = building.begin(); it != building.end(); ++it) {
+    // The workers finish files out of order.
+    std::sort(it->second.begin(), it->second.end());
+  }
+}
+
+// Like ContentIndex::Finish(), the locks are only held to sort a shard and
+// to publish, not while packing.
+void ContentTrigrams::Finish(ThreadPool* pool) {
+  TaskGroup sorts;
+  for (size_t sx = 0; sx != kShards; ++sx) {
+    pool->Post(&sorts, [this, sx]() {
+      std::lock_guard<std::mutex> lock(shards_[sx].lock);
+      SortShard(sx);
+    });
+  }
+  {
+    std::lock_guard<std::mutex> lock(shards_[0].lock);
+    std::sort(files_.begin(), files_.end());
+  }
+  sorts.Wait();
+
+  std::vector<std::pair<uint32_t, const std::vector<uint32_t>*> > order;
+  size_t total = 0;
+  for (size_t sx = 0; sx != kShards; ++sx) {
+    const PostingMap& building = shards_[sx].building;
+    for (PostingMap::const_iterator it = building.begin(); it != building.end(); ++it) {
+      order.push_back(std::make_pair(it->first, &it->second));
+      total += it->second.size();
+    }
+  }
+  std::sort(order.begin(), order.end());
+
+  keys_.resize(order.size());
+  starts_.resize(order.size() + 1);
+  postings_.resize(total);
+  uint32_t* keys = keys_.mutable_data();
+  uint32_t* starts = starts_.mutable_data();
+  uint32_t* postings = postings_.mutable_data();
+
+  uint32_t sum = 0;
+  for (size_t kx = 0; kx != order.size(); ++kx) {
+    const std::vector<uint32_t>& files = *order[kx].second;
+    keys[kx] = order[kx].first;
+    starts[kx] = sum;
+    std::copy(files.begin(), files.end(), postings + sum);
+    sum += static_cast<uint32_t>(files.size());
+  }
+  starts[order.size()] = sum;
+
+  PostingMap retired[kShards];
+  LockAll();
+  for (size_t sx = 0; sx != kShards; ++sx) {
+    retired[sx].swap(shards_[sx].building);
+  }
+  bytes_ = files_.capacity() * sizeof(uint32_t) + keys_.memory_size() + starts_.memory_size() +
+           postings_.memory_size();
+  finished_ = true;
+  UnlockAll();
+}
+
+void ContentTrigrams::Postings(uint32_t trigram, std::vector<uint32_t>* files) const {
+  files->clear();
+  Shard& shard = shards_[ShardOf(trigram)];
+  std::lock_guard<std::mutex> lock(shard.lock);
+  if (finished_) {
+    const uint32_t* it = std::lower_bound(keys_.begin(), keys_.end(), trigram);
+    if ((it != keys_.end()) && (*it == trigram)) {
+      size_t pos = it - keys_.begin();
+      files->assign(postings_.begin() + starts_[pos], postings_.begin() + starts_[pos + 1]);
+    }
+    return;
+  }
+
+  PostingMap::const_iterator it = shard.building.find(trigram);
+  if (it != shard.building.end()) {
+    files->assign(it->second.begin(), it->second.end());
+    std::sort(files->begin(), files->end());
+  }
+}
+
+void ContentTrigrams::Eval(const TrigramQuery& query, std::vector<uint32_t>* files,
+                           bool* all) const {
+  files->clear();
+  *all = false;
+  switch (query.op) {
+    case TrigramQuery::kAll:
+      *all = true;
+      return;
+    case TrigramQuery::kNone:
+      return;
+    case TrigramQuery::kTrigram:
+      Postings(query.trigram, files);
+      return;
+    case TrigramQuery::kAnd:
+    case TrigramQuery::kOr:
+      break;
+  }
+
+  const bool is_and = (query.op == TrigramQuery::kAnd);
+  *all = is_and;
+  std::vector<uint32_t> sub;
+  std::vector<uint32_t> merged;
+  for (size_t ix = 0; ix != query.subs.size(); ++ix) {
+    bool sub_all;
+    Eval(query.subs[ix], &sub, &sub_all);
+    if (sub_all) {
+      if (!is_and) {
+        *all = true;
+        files->clear();
+        return;
+      }
+      continue;
+    }
+    merged.clear();
+    if (*all) {
+      files->swap(sub);
+      *all = false;
+    } else if (is_and) {
+      std::set_intersection(files->begin(), files->end(), sub.begin(), sub.end(),
+                            std::back_inserter(merged));
+      files->swap(merged);
+    } else {
+      std::set_union(files->begin(), files->end(), sub.begin(), sub.end(),
+                     std::back_inserter(merged));
+      files->swap(merged);
+    }
+    if (is_and && files->empty())
+      return;
+  }
+}
+
+bool ContentTrigrams::Evaluate(const TrigramQuery& query, std::vector<uint32_t>* files) const {
+  bool finished;
+  {
+    std::lock_guard<std::mutex> lock(shards_[0].lock);
+    finished = finished_;
+  }
+  bool all;
+  Eval(query, files, &all);
+  if (all) {
+    std::lock_guard<std::mutex> lock(shards_[0].lock);
+    files->assign(files_.begin(), files_.end());
+    if (!finished_)
+      std::sort(files->begin(), files->end());
+  }
+  return finished;
+}
+
+bool ContentTrigrams::finished() const {
+  std::lock_guard<std::mutex> lock(shards_[0].lock);
+  return finished_;
+}
@@ -0,0 +1,117 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "pod_array.h"
+
+class ThreadPool;
+
+// Which files can match a text query, as a tree of trigrams. A file is a
+// candidate for a leaf if its contents have the trigram; ALL takes every file
+// and NONE none. Trigrams are three bytes, ASCII letters folded to lower case.
+struct TrigramQuery {
+  enum Op {
+    kAll,
+    kNone,
+    kAnd,
+    kOr,
+    kTrigram
+  };
+
+  Op op;
+  uint32_t trigram;
+  std::vector<TrigramQuery> subs;
+
+  explicit TrigramQuery(Op i_op = kAll) : op(i_op), trigram(0) {}
+
+  static TrigramQuery Trigram(const char* three);
+  // Both simplify: ALL and NONE fold away, nested ANDs or ORs are merged and
+  // the subs that repeat are dropped.
+  static TrigramQuery And(const TrigramQuery& lhs, const TrigramQuery& rhs);
+  static TrigramQuery Or(const TrigramQuery& lhs, const TrigramQuery& rhs);
+  // The AND of the trigrams of |str|, ALL if it is shorter than three.
+  static TrigramQuery Literal(const std::string& str);
+
+  // For debugging, like (abc def)|ghi.
+  std::string ToString() const;
+};
+
+// Maps every trigram found in the contents of the files to the files that
+// have it, built like the ContentIndex and next to it: any number of threads
+// add files in any order, queries see the files added so far and Finish()
+// packs the postings.
+class ContentTrigrams {
+public:
+  ContentTrigrams();
+
+  // Forgets everything.
+  void Start();
+
+  // What Add() reuses from file to file, one per thread adding.
+  struct Scratch {
+    // One bit per possible trigram, clear between calls.
+    std::vector<uint64_t> seen;
+    std::vector<uint32_t> keys;
+    std::vector<uint32_t> order;
+  };
+
+  // Adds the trigrams of the contents of |file|. Each file is added once.
+  void Add(uint32_t file, const char* beg, const char* end, Scratch* scratch);
+
+  // Sorts the postings of the shards as tasks on |pool| and packs them.
+  // Nothing can be added after this. Queries go on while it packs.
+  void Finish(ThreadPool* pool);
+
+  // Sets |files| to the files, in index order, that |query| lets through.
+  // Returns false while the build still has files to go.
+  bool Evaluate(const TrigramQuery& query, std::vector<uint32_t>* files) const;
+
+  bool finished() const;
+
+  // About how many bytes it takes, see ContentIndex::memory_size().
+  size_t memory_size() const { return bytes_.load(std::memory_order_relaxed); }
+
+private:
+  typedef std::unordered_map<uint32_t, std::vector<uint32_t> > PostingMap;
+
+  static const size_t kShards = 64;
+  struct Shard {
+    std::mutex lock;
+    PostingMap building;
+  };
+
+  static size_t ShardOf(uint32_t trigram) { return (trigram * 2654435761u) >> 26; }
+  void LockAll() const;
+  void UnlockAll() const;
+  void SortShard(size_t sx);
+
+  void Postings(uint32_t trigram, std::vector<uint32_t>* files) const;
+  // Leaves |*all| set instead of listing every file.
+  void Eval(const TrigramQuery& query, std::vector<uint32_t>* files, bool* all) const;
+
+  mutable Shard shards_[kShards];
+  // Every file added. Under the lock of shard 0.
+  std::vector<uint32_t> files_;
+  // Only changes with every shard locked, reading it takes any one of them.
+  bool finished_;
+  // What memory_size() returns.
+  std::atomic<size_t> bytes_;
+
+  // Once finished. Sorted keys, the files of |keys_[kx]| are [starts_[kx],
+  // starts_[kx + 1]) of |postings_|.
+  PodArray<uint32_t> keys_;
+  PodArray<uint32_t> starts_;
+  PodArray<uint32_t> postings_;
+
+  ContentTrigrams(const ContentTrigrams&);
+  void operator=(const ContentTrigrams&);
+};
@@ -0,0 +1,214 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "dir_crawler_posix.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "engine_v1.h"
+
+namespace {
+  // Enough for a few thousand entries per getdents64 call.
+  const size_t kDentsBufSize = 128 * 1024;
+
+  // The kernel's struct linux_dirent64, glibc does not export it.
+  struct Dirent64 {
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+  };
+
+  unsigned char TypeFromStat(int dir_fd, const char* name) {
+    struct stat st;
+    if (::fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+      return DT_UNKNOWN;
+    if (S_ISDIR(st.st_mode))
+      return DT_DIR;
+    if (S_ISREG(st.st_mode))
+      return DT_REG;
+    return DT_UNKNOWN;
+  }
+
+  // What a crawl does with a directory entry.
+  enum EntryAction {
+    kDescend,
+    kKeepFile,
+    kDiscardDir,
+    kDiscardFile,
+    kHidden,
+    kSkip       // Symlinks, devices and the like are not followed.
+  };
+
+  EntryAction ActionFor(const char* name, size_t len, unsigned char type) {
+    if (type == DT_DIR) {
+      if (IgnoreDirName(name, len))
+        return kDiscardDir;
+      return (name[0] == '.') ? kHidden : kDescend;
+    }
+    if (type == DT_REG) {
+      if (name[0] == '.')
+        return kHidden;
+      return (ClassifyFile(name, len) == kUnknown) ? kDiscardFile : kKeepFile;
+    }
+    return kSkip;
+  }
+
+  // Calls |fn(name, len, action)| for every entry of the open directory |fd|.
+  // Returns false on a read error, after the entries read until then. Adds
+  // the system calls it makes to |*syscalls|.
+  template <typename Fn>
+  bool ForEachEntry(int fd, char* buf, size_t* syscalls, Fn fn) {
+    while (true) {
+      ++*syscalls;
+      long read = ::syscall(SYS_getdents64, fd, buf, kDentsBufSize);
+      if (read <= 0)
+        return (read == 0);
+
+      for (long pos = 0; pos < read;) {
+        const Dirent64* de = reinterpret_cast<const Dirent64*>(buf + pos);
+        pos += de->d_reclen;
+
+        const char* name = de->d_name;
+        size_t len = strlen(name);
+        unsigned char type = de->d_type;
+        if (type == DT_UNKNOWN) {
+          ++*syscalls;
+          type = TypeFromStat(fd, name);
+        }
+        fn(name, len, ActionFor(name, len, type));
+      }
+    }
+  }
+}
+
+DirCrawler::DirCrawler(size_t num_threads)
+    : root_fd_(-1), files_found_(0), dirs_found_(0), pool_(num_threads) {
+  workers_.resize(pool_.size());
+}
+
+DirCrawler::~DirCrawler() {
+  group_.Wait();
+  if (root_fd_ != -1)
+    ::close(root_fd_);
+}
+
+int DirCrawler::Start(const char* root) {
+  root_fd_ = ::open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (root_fd_ == -1)
+    return -1;
+
+  // Nothing runs on the pool yet, worker 0 is ours for the root.
+  std::vector<std::string> subdirs;
+  uint32_t root_ix = ProcessDir(0, std::string(), kNoParent, kNoParent, &subdirs);
+  for (size_t ix = 0; ix != subdirs.size(); ++ix) {
+    std::string rel_path;
+    rel_path.swap(subdirs[ix]);
+    pool_.Post(&group_, [this, rel_path, root_ix]() { CrawlDir(rel_path, 0, root_ix); });
+  }
+  return 0;
+}
+
+bool DirCrawler::Wait(unsigned int ms) {
+  return group_.WaitFor(ms);
+}
+
+void DirCrawler::CrawlDir(const std::string& rel_path, uint32_t parent_worker,
+                          uint32_t parent_ix) {
+  std::vector<std::string> subdirs;
+  const uint32_t wix = static_cast<uint32_t>(pool_.CurrentWorker());
+  const uint32_t dir_ix = ProcessDir(wix, rel_path, parent_worker, parent_ix, &subdirs);
+  // The pool runs the last one posted first, go down in order.
+  for (size_t ix = subdirs.size(); ix-- != 0;) {
+    std::string child;
+    child.swap(subdirs[ix]);
+    pool_.Post(&group_, [this, child, wix, dir_ix]() { CrawlDir(child, wix, dir_ix); });
+  }
+}
+
+uint32_t DirCrawler::ProcessDir(size_t wix, const std::string& rel_path, uint32_t parent_worker,
+                                uint32_t parent_ix, std::vector<std::string>* subdirs) {
+  Worker& self = workers_[wix];
+  Results& res = self.results;
+  if (self.buf.empty())
+    self.buf.resize(kDentsBufSize);
+
+  int fd = ::openat(root_fd_, rel_path.empty() ? "." : rel_path.c_str(),
+                    O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+  ++res.syscalls;
+  if (fd == -1) {
+    ++res.errors;
+    return kNoParent;
+  }
+
+  const uint32_t dir_ix = static_cast<uint32_t>(res.dirs.size());
+  const size_t slash = rel_path.rfind('/');
+  const size_t name_pos = (slash == std::string::npos) ? 0 : slash + 1;
+  res.dirs.push_back(Dir(rel_path.c_str() + name_pos, rel_path.size() - name_pos, parent_worker,
+                         parent_ix));
+  size_t files_added = 0;
+
+  bool ok = ForEachEntry(fd, &self.buf[0], &res.syscalls,
+                         [&](const char* name, size_t len, EntryAction action) {
+    switch (action) {
+      case kDescend:
+        subdirs->push_back(rel_path);
+        if (!rel_path.empty())
+          subdirs->back().append(1, '/');
+        subdirs->back().append(name, len);
+        break;
+      case kKeepFile:
+        res.files.push_back(File(name, len, dir_ix));
+        ++files_added;
+        break;
+      case kDiscardDir:
+        ++res.dirs_discarded;
+        break;
+      case kDiscardFile:
+        ++res.files_discarded;
+        break;
+      case kHidden:
+        ++res.hidden_discarded;
+        break;
+      case kSkip:
+        break;
+    }
+  });
+  if (!ok)
+    ++res.errors;
+
+  ::close(fd);
+  ++res.syscalls;
+  files_found_ += files_added;
+  ++dirs_found_;
+  return dir_ix;
+}
+
+bool DirCrawler::Keeps(const char* name, size_t len, bool is_dir) {
+  EntryAction action = ActionFor(name, len, is_dir ? DT_DIR : DT_REG);
+  return (action == kDescend) || (action == kKeepFile);
+}
+
+bool DirCrawler::ListDir(const char* path, std::vector<std::string>* dirs,
+                         std::vector<std::string>* files) {
+  int fd = ::open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+  if (fd == -1)
+    return false;
+
+  std::vector<char> buf(kDentsBufSize);
+  size_t syscalls = 0;
+  bool ok = ForEachEntry(fd, &buf[0], &syscalls, [&](const char* name, size_t len, EntryAction action) {
+    if (action == kDescend)
+      dirs->push_back(std::string(name, len));
+    else if (action == kKeepFile)
+      files->push_back(std::string(name, len));
+  });
+  ::close(fd);
+  return ok;
+}
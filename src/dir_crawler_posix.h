@@ -0,0 +1,111 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "thread_pool.h"
+
+// Walks a directory tree on a ThreadPool, one task per directory. The pool
+// keeps each thread depth first on the directories it found and lets idle
+// threads steal the oldest ones of the others. Directories are opened
+// relative to the root with openat() and read with raw getdents64() calls.
+class DirCrawler {
+public:
+  static const uint32_t kNoParent = static_cast<uint32_t>(-1);
+
+  // A directory by its name and where its parent was recorded: the Results
+  // of |parent_worker|, at |parent_ix| in its |dirs|. The root has no name
+  // and kNoParent for both.
+  struct Dir {
+    std::string name;
+    uint32_t parent_worker;
+    uint32_t parent_ix;
+
+    Dir(const char* dname, size_t len, uint32_t worker, uint32_t ix)
+      : name(dname, len), parent_worker(worker), parent_ix(ix) {
+    }
+  };
+
+  struct File {
+    std::string name;
+    // Index into the |dirs| of the same Results.
+    size_t dir_ix;
+
+    File(const char* fname, size_t len, size_t dir)
+      : name(fname, len), dir_ix(dir) {
+    }
+  };
+
+  // What one pool thread found. A directory is recorded by the thread that
+  // drains it so every file refers to a directory of the same thread, but
+  // its parent can be in the results of any thread.
+  struct Results {
+    std::vector<Dir> dirs;
+    std::vector<File> files;
+    size_t dirs_discarded;
+    size_t files_discarded;
+    size_t hidden_discarded;
+    size_t errors;
+    size_t syscalls;
+
+    Results()
+      : dirs_discarded(0), files_discarded(0), hidden_discarded(0), errors(0), syscalls(0) {
+    }
+  };
+
+  // Zero |num_threads| means one per core.
+  explicit DirCrawler(size_t num_threads);
+  ~DirCrawler();
+
+  // Drains |root| on the calling thread and posts its subdirectories to the
+  // pool. The root ends up as the first directory of worker 0. Returns -1
+  // if the root cannot be opened.
+  int Start(const char* root);
+
+  // Returns true once every directory is done. Waits up to |ms| otherwise.
+  bool Wait(unsigned int ms);
+
+  size_t files_found() const { return files_found_; }
+  size_t dirs_found() const { return dirs_found_; }
+
+  size_t num_workers() const { return workers_.size(); }
+  const Results& results(size_t worker) const { return workers_[worker].results; }
+
+  // Whether a crawl keeps a directory or a regular file called |name|.
+  static bool Keeps(const char* name, size_t len, bool is_dir);
+
+  // The subdirectories and files of |path| that a crawl would keep, by the
+  // same rules, without descending. Returns false if it cannot be read.
+  static bool ListDir(const char* path, std::vector<std::string>* dirs,
+                      std::vector<std::string>* files);
+
+private:
+  // Only touched by its own pool thread, and by Start() before the first task.
+  struct Worker {
+    Results results;
+    std::vector<char> buf;
+  };
+
+  void CrawlDir(const std::string& rel_path, uint32_t parent_worker, uint32_t parent_ix);
+  // Records |rel_path| in the results of |wix| and appends the directories
+  // to descend into to |subdirs|. Returns its index there, or kNoParent if
+  // it cannot be opened.
+  uint32_t ProcessDir(size_t wix, const std::string& rel_path, uint32_t parent_worker,
+                      uint32_t parent_ix, std::vector<std::string>* subdirs);
+
+  std::vector<Worker> workers_;
+  int root_fd_;
+
+  std::atomic<size_t> files_found_;
+  std::atomic<size_t> dirs_found_;
+
+  TaskGroup group_;
+  // Declared last, so the threads are gone before the rest.
+  ThreadPool pool_;
+};
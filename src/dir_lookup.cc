@@ -0,0 +1,88 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "dir_lookup.h"
+
+#include <algorithm>
+
+#include "dir_table.h"
+#include "file_table.h"
+
+namespace {
+  const uint32_t kNoParent = static_cast<uint32_t>(-1);
+
+  void EraseValue(std::vector<uint32_t>* vec, uint32_t value) {
+    std::vector<uint32_t>::iterator it = std::find(vec->begin(), vec->end(), value);
+    if (it != vec->end())
+      vec->erase(it);
+  }
+}
+
+void DirLookup::Build(const DirTable& dirs, const FileTable& files,
+                      const PodArray<uint8_t>& removed) {
+  parents_.assign(dirs.size(), kNoParent);
+  subdirs_.assign(dirs.size(), std::vector<uint32_t>());
+  for (size_t dx = 1; dx < dirs.size(); ++dx) {
+    parents_[dx] = static_cast<uint32_t>(dirs.parent(dx));
+    subdirs_[parents_[dx]].push_back(static_cast<uint32_t>(dx));
+  }
+
+  files_.assign(dirs.size(), std::vector<uint32_t>());
+  for (size_t fx = 0; fx != files.size(); ++fx) {
+    if ((fx < removed.size()) && removed[fx])
+      continue;
+    files_[files.dir_ix(fx)].push_back(static_cast<uint32_t>(fx));
+  }
+}
+
+size_t DirLookup::FindChild(const DirTable& dirs, size_t parent_ix, const char* name,
+                            size_t len) const {
+  uint32_t name_id = dirs.FindName(name, len);
+  if (name_id == DirTable::kNoName)
+    return kNotFound;
+  const std::vector<uint32_t>& subdirs = subdirs_[parent_ix];
+  for (size_t ix = 0; ix != subdirs.size(); ++ix) {
+    if (dirs.name_id(subdirs[ix]) == name_id)
+      return subdirs[ix];
+  }
+  return kNotFound;
+}
+
+bool DirLookup::Alive(size_t dir_ix) const {
+  return !dir_ix || (parents_[dir_ix] != kNoParent);
+}
+
+void DirLookup::AddDir(size_t dir_ix, size_t parent_ix) {
+  parents_.resize(dir_ix + 1, kNoParent);
+  files_.resize(dir_ix + 1);
+  subdirs_.resize(dir_ix + 1);
+  parents_[dir_ix] = static_cast<uint32_t>(parent_ix);
+  subdirs_[parent_ix].push_back(static_cast<uint32_t>(dir_ix));
+}
+
+void DirLookup::AddFile(size_t dir_ix, uint32_t file_ix) {
+  files_[dir_ix].push_back(file_ix);
+}
+
+void DirLookup::RemoveFile(size_t dir_ix, uint32_t file_ix) {
+  EraseValue(&files_[dir_ix], file_ix);
+}
+
+void DirLookup::RemoveTree(size_t dir_ix, std::vector<uint32_t>* removed_dirs,
+                           std::vector<uint32_t>* removed_files) {
+  if (parents_[dir_ix] != kNoParent)
+    EraseValue(&subdirs_[parents_[dir_ix]], static_cast<uint32_t>(dir_ix));
+
+  std::vector<uint32_t> stack(1, static_cast<uint32_t>(dir_ix));
+  while (!stack.empty()) {
+    uint32_t dx = stack.back();
+    stack.pop_back();
+    stack.insert(stack.end(), subdirs_[dx].begin(), subdirs_[dx].end());
+    removed_files->insert(removed_files->end(), files_[dx].begin(), files_[dx].end());
+    removed_dirs->push_back(dx);
+
+    parents_[dx] = kNoParent;
+    std::vector<uint32_t>().swap(files_[dx]);
+    std::vector<uint32_t>().swap(subdirs_[dx]);
+  }
+}
@@ -0,0 +1,53 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "pod_array.h"
+
+class DirTable;
+class FileTable;
+
+// The files and subdirectories of each directory. The tables themselves only
+// go from a file to its directory and from a directory to its parent; the
+// engine builds this once it starts applying changes to an indexed tree, so a
+// change only touches the directory it happened in.
+class DirLookup {
+public:
+  static const size_t kNotFound = static_cast<size_t>(-1);
+
+  DirLookup() {}
+
+  // The files marked in |removed| are left out.
+  void Build(const DirTable& dirs, const FileTable& files, const PodArray<uint8_t>& removed);
+
+  // Returns the subdirectory of |parent_ix| called |name|.
+  size_t FindChild(const DirTable& dirs, size_t parent_ix, const char* name, size_t len) const;
+  // False once |dir_ix| has been removed.
+  bool Alive(size_t dir_ix) const;
+
+  // |dir_ix| is new in the DirTable.
+  void AddDir(size_t dir_ix, size_t parent_ix);
+  void AddFile(size_t dir_ix, uint32_t file_ix);
+  void RemoveFile(size_t dir_ix, uint32_t file_ix);
+
+  // Forgets |dir_ix| and everything below it. Appends those directories to
+  // |removed_dirs| and the files they had to |removed_files|.
+  void RemoveTree(size_t dir_ix, std::vector<uint32_t>* removed_dirs,
+                  std::vector<uint32_t>* removed_files);
+
+  const std::vector<uint32_t>& files(size_t dir_ix) const { return files_[dir_ix]; }
+  const std::vector<uint32_t>& subdirs(size_t dir_ix) const { return subdirs_[dir_ix]; }
+
+private:
+  std::vector<uint32_t> parents_;
+  std::vector<std::vector<uint32_t> > files_;
+  std::vector<std::vector<uint32_t> > subdirs_;
+
+  DirLookup(const DirLookup&);
+  void operator=(const DirLookup&);
+};
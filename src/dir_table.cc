@@ -0,0 +1,155 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "dir_table.h"
+
+#include <string.h>
+
+#include "index_snapshot.h"
+
+namespace {
+  // FNV-1a over the bytes.
+  size_t HashName(const char* name, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t ix = 0; ix != len; ++ix) {
+      hash = (hash ^ static_cast<unsigned char>(name[ix])) * 16777619u;
+    }
+    return hash;
+  }
+}
+
+void DirTable::Reserve(size_t dirs, size_t name_bytes) {
+  parents_.reserve(dirs);
+  name_ids_.reserve(dirs);
+  path_lengths_.reserve(dirs);
+  names_.reserve(name_bytes);
+}
+
+size_t DirTable::Add(size_t parent, const char* name, size_t len) {
+  size_t path_len = len;
+  if (parent != kNoParent)
+    path_len += path_lengths_[parent] + 1;
+  parents_.push_back(static_cast<uint32_t>(parent));
+  name_ids_.push_back(Intern(name, len));
+  path_lengths_.push_back(static_cast<uint32_t>(path_len));
+  return parents_.size() - 1;
+}
+
+void DirTable::ShrinkToFit() {
+  parents_.shrink_to_fit();
+  name_ids_.shrink_to_fit();
+  path_lengths_.shrink_to_fit();
+  names_.shrink_to_fit();
+  name_offsets_.shrink_to_fit();
+  name_lengths_.shrink_to_fit();
+}
+
+uint32_t DirTable::FindName(const char* name, size_t len) const {
+  if (name_slots_.empty())
+    return kNoName;
+  const size_t mask = name_slots_.size() - 1;
+  for (size_t sx = HashName(name, len) & mask; name_slots_[sx]; sx = (sx + 1) & mask) {
+    uint32_t id = name_slots_[sx] - 1;
+    if ((name_lengths_[id] == len) && (0 == memcmp(&names_[name_offsets_[id]], name, len)))
+      return id;
+  }
+  return kNoName;
+}
+
+uint32_t DirTable::Intern(const char* name, size_t len) {
+  uint32_t id = FindName(name, len);
+  if (id != kNoName)
+    return id;
+
+  id = static_cast<uint32_t>(name_offsets_.size());
+  name_offsets_.push_back(static_cast<uint32_t>(names_.size()));
+  name_lengths_.push_back(static_cast<uint32_t>(len));
+  names_.append(name, len);
+  names_.push_back('\0');
+  // Kept at most half full.
+  if (name_slots_.size() < 2 * name_offsets_.size()) {
+    Rehash(name_slots_.empty() ? 256 : 2 * name_slots_.size());
+  } else {
+    const size_t mask = name_slots_.size() - 1;
+    uint32_t* slots = name_slots_.mutable_data();
+    size_t sx = HashName(name, len) & mask;
+    while (slots[sx])
+      sx = (sx + 1) & mask;
+    slots[sx] = id + 1;
+  }
+  return id;
+}
+
+void DirTable::Rehash(size_t slots) {
+  name_slots_.clear();
+  name_slots_.resize(slots);
+  uint32_t* data = name_slots_.mutable_data();
+  const size_t mask = slots - 1;
+  for (size_t id = 0; id != name_offsets_.size(); ++id) {
+    size_t sx = HashName(&names_[name_offsets_[id]], name_lengths_[id]) & mask;
+    while (data[sx])
+      sx = (sx + 1) & mask;
+    data[sx] = static_cast<uint32_t>(id + 1);
+  }
+}
+
+// Back to front, each name goes right before the one of its child.
+void DirTable::CopyPath(size_t ix, char* out) const {
+  size_t end = path_lengths_[ix];
+  while (true) {
+    size_t len = name_len(ix);
+    end -= len;
+    memcpy(out + end, name(ix), len);
+    if (parents_[ix] == kNoParent)
+      break;
+    out[--end] = kPathSeparator;
+    ix = parents_[ix];
+  }
+}
+
+std::string DirTable::Path(size_t ix) const {
+  std::string path(path_len(ix), '\0');
+  if (!path.empty())
+    CopyPath(ix, &path[0]);
+  return path;
+}
+
+void DirTable::Write(SnapshotWriter* out) const {
+  out->Add(parents_);
+  out->Add(name_ids_);
+  out->Add(names_);
+  out->Add(name_offsets_);
+  out->Add(name_lengths_);
+}
+
+// The path lengths and the name hash are rebuilt, checking on the way that
+// every parent comes first so a path can never loop.
+bool DirTable::Map(SnapshotReader* in) {
+  if (!in->Next(&parents_) || !in->Next(&name_ids_) || !in->Next(&names_) ||
+      !in->Next(&name_offsets_) || !in->Next(&name_lengths_))
+    return false;
+  if ((parents_.size() != name_ids_.size()) || (name_offsets_.size() != name_lengths_.size()))
+    return false;
+  for (size_t id = 0; id != name_offsets_.size(); ++id) {
+    size_t end = static_cast<size_t>(name_offsets_[id]) + name_lengths_[id];
+    if ((end >= names_.size()) || (names_[end] != '\0'))
+      return false;
+  }
+
+  path_lengths_.clear();
+  path_lengths_.reserve(parents_.size());
+  for (size_t ix = 0; ix != parents_.size(); ++ix) {
+    if ((name_ids_[ix] >= name_offsets_.size()) || ((parents_[ix] == kNoParent) != (ix == 0)) ||
+        ((ix != 0) && (parents_[ix] >= ix)))
+      return false;
+    size_t path_len = name_len(ix);
+    if (ix != 0)
+      path_len += path_lengths_[parents_[ix]] + 1;
+    path_lengths_.push_back(static_cast<uint32_t>(path_len));
+  }
+  size_t slots = 256;
+  while (slots < 2 * name_offsets_.size())
+    slots *= 2;
+  Rehash(slots);
+  return true;
+}
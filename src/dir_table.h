@@ -0,0 +1,87 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "pod_array.h"
+
+class SnapshotReader;
+class SnapshotWriter;
+
+#if defined(_WIN32)
+const char kPathSeparator = '\\';
+#else
+const char kPathSeparator = '/';
+#endif
+
+// The directories of the tree as a tree of (parent, name) nodes, the root
+// first with its whole path as its name. A directory always comes after its
+// parent. Names are interned: "src" or "test" is stored once however many
+// directories are called that, so a deep tree costs a few integers per
+// directory instead of its full path. Paths are put together on demand from
+// the names up to the root. Names and paths are UTF-8, lengths in bytes.
+class DirTable {
+public:
+  static const uint32_t kNoParent = static_cast<uint32_t>(-1);
+  static const uint32_t kNoName = static_cast<uint32_t>(-1);
+
+  DirTable() {}
+
+  void Reserve(size_t dirs, size_t name_bytes);
+
+  // Returns the index of the new directory. |parent| is kNoParent for the
+  // root and |name| is then its path.
+  size_t Add(size_t parent, const char* name, size_t len);
+  // Frees the spare capacity once the crawl is over.
+  void ShrinkToFit();
+
+  size_t size() const { return parents_.size(); }
+  bool empty() const { return parents_.empty(); }
+
+  size_t parent(size_t ix) const { return parents_[ix]; }
+  // Directories with the same name have the same name id.
+  uint32_t name_id(size_t ix) const { return name_ids_[ix]; }
+  const char* name(size_t ix) const { return &names_[name_offsets_[name_ids_[ix]]]; }
+  size_t name_len(size_t ix) const { return name_lengths_[name_ids_[ix]]; }
+
+  // Returns the id of the name |name|, or kNoName if no directory has it.
+  uint32_t FindName(const char* name, size_t len) const;
+
+  size_t path_len(size_t ix) const { return path_lengths_[ix]; }
+  // Writes the path_len() bytes of the path of |ix| to |out|, without
+  // a terminator.
+  void CopyPath(size_t ix, char* out) const;
+  std::string Path(size_t ix) const;
+
+  size_t memory_size() const {
+    return parents_.memory_size() + name_ids_.memory_size() + path_lengths_.memory_size() +
+           names_.memory_size() + name_offsets_.memory_size() + name_lengths_.memory_size() +
+           name_slots_.memory_size();
+  }
+
+  void Write(SnapshotWriter* out) const;
+  bool Map(SnapshotReader* in);
+
+private:
+  uint32_t Intern(const char* name, size_t len);
+  void Rehash(size_t slots);
+
+  // One entry per directory.
+  PodArray<uint32_t> parents_;
+  PodArray<uint32_t> name_ids_;
+  PodArray<uint32_t> path_lengths_;
+  // One entry per name, each followed by a '\0' in the arena.
+  PodArray<char> names_;
+  PodArray<uint32_t> name_offsets_;
+  PodArray<uint32_t> name_lengths_;
+  // Open addressing hash of the names, each slot a name id plus one or zero
+  // if empty. Rebuilt rather than saved.
+  PodArray<uint32_t> name_slots_;
+
+  DirTable(const DirTable&);
+  void operator=(const DirTable&);
+};
@@ -0,0 +1,104 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "dir_watcher_posix.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace {
+  // Room for a few hundred events per read.
+  const size_t kEventBufSize = 64 * 1024;
+
+  const uint32_t kWatchMask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                              IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+}
+
+DirWatcher::DirWatcher() : inotify_fd_(-1) {
+  stop_fds_[0] = -1;
+  stop_fds_[1] = -1;
+}
+
+DirWatcher::~DirWatcher() {
+  StopWatching();
+  if (stop_fds_[0] != -1) {
+    ::close(stop_fds_[0]);
+    ::close(stop_fds_[1]);
+  }
+}
+
+bool DirWatcher::Init() {
+  if ((stop_fds_[0] == -1) && (::pipe2(stop_fds_, O_CLOEXEC) != 0)) {
+    stop_fds_[0] = -1;
+    stop_fds_[1] = -1;
+    return false;
+  }
+  if (inotify_fd_ == -1)
+    inotify_fd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  return true;
+}
+
+void DirWatcher::StopWatching() {
+  if (inotify_fd_ != -1)
+    ::close(inotify_fd_);
+  inotify_fd_ = -1;
+}
+
+int DirWatcher::Add(const char* path) {
+  if (inotify_fd_ == -1) {
+    errno = ENOSYS;
+    return -1;
+  }
+  return ::inotify_add_watch(inotify_fd_, path, kWatchMask);
+}
+
+void DirWatcher::Remove(int watch) {
+  if (inotify_fd_ != -1)
+    ::inotify_rm_watch(inotify_fd_, watch);
+}
+
+bool DirWatcher::Wait(int ms, std::vector<Event>* events) {
+  pollfd fds[2] = {
+    { stop_fds_[0], POLLIN, 0 },
+    { inotify_fd_, POLLIN, 0 }
+  };
+  int rv = ::poll(fds, (inotify_fd_ != -1) ? 2 : 1, ms);
+  if (rv < 0)
+    return errno == EINTR;
+  if (fds[0].revents)
+    return false;
+  if (!rv || !fds[1].revents)
+    return true;
+
+  // Drain what is there, the events come back to back, each followed by
+  // its name padded with zeros.
+  alignas(inotify_event) char buf[kEventBufSize];
+  while (true) {
+    ssize_t read = ::read(inotify_fd_, buf, sizeof(buf));
+    if (read <= 0)
+      break;
+    for (ssize_t pos = 0; pos < read;) {
+      const inotify_event* ie = reinterpret_cast<const inotify_event*>(buf + pos);
+      pos += sizeof(inotify_event) + ie->len;
+      Event event;
+      event.watch = ie->wd;
+      event.mask = ie->mask;
+      if (ie->len)
+        event.name.assign(ie->name, strlen(ie->name));
+      events->push_back(event);
+    }
+  }
+  return true;
+}
+
+void DirWatcher::Stop() {
+  if (stop_fds_[1] != -1) {
+    char byte = 0;
+    ssize_t rv = ::write(stop_fds_[1], &byte, 1);
+    (void)rv;
+  }
+}
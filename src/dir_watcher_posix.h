@@ -0,0 +1,54 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// Reports the entries created, deleted and moved in a set of directories with
+// inotify. Each directory needs its own watch; the caller adds them as it
+// learns about directories and maps the watch ids back to its own.
+//
+// Wait() doubles as an interruptible sleep, so a caller that has to poll the
+// tree instead, because inotify is missing or out of watches, uses it too.
+class DirWatcher {
+public:
+  struct Event {
+    int watch;
+    // The IN_* bits.
+    uint32_t mask;
+    std::string name;
+  };
+
+  DirWatcher();
+  ~DirWatcher();
+
+  // Returns false on failure. Without inotify it succeeds but watching() is
+  // false; Wait() and Stop() work all the same.
+  bool Init();
+  bool watching() const { return inotify_fd_ != -1; }
+  // Drops inotify and every watch.
+  void StopWatching();
+
+  // Returns the id of the new watch or -1, with errno ENOSPC when the
+  // system limit on watches has been reached.
+  int Add(const char* path);
+  void Remove(int watch);
+
+  // Waits up to |ms| milliseconds, or forever if negative, for events and
+  // appends them to |events|. Returns false once Stop() has been called.
+  bool Wait(int ms, std::vector<Event>* events);
+
+  // Makes Wait() return false from now on. Can be called from any thread.
+  void Stop();
+
+private:
+  int inotify_fd_;
+  // A pipe whose read end becomes readable on Stop().
+  int stop_fds_[2];
+
+  DirWatcher(const DirWatcher&);
+  void operator=(const DirWatcher&);
+};
@@ -0,0 +1,1077 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "engine_v1.h"
+
+#include <assert.h>
+#include <string.h>
+#include <wchar.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "bounded_queue.h"
+#include "file_stream.h"
+#include "fuzzy_match.h"
+#include "index_snapshot.h"
+#include "regex_match.h"
+#include "substring_match.h"
+#include "thread_pool.h"
+#include "utf8.h"
+
+namespace {
+  // Scans look for the stop conditions between blocks of this many files.
+  const size_t kScanBlock = 8 * 1024;
+  // And the candidate checks every this many files.
+  const size_t kCheckEvery = 1024;
+  // Fuzzy queries rank this many files, Continue() pages through them.
+  const size_t kFuzzyResults = 100;
+  // Smallest share of the work worth a thread of its own.
+  const size_t kMinFilesPerThread = 32 * 1024;
+
+  // The content index build. Reading is mostly waiting on the disk, so there
+  // are more readers than cores would say.
+  const size_t kContentReaders = 4;
+  // The crawl takes the table lock this often.
+  const size_t kCrawlBatch = 256;
+  // Files a reader takes off the queue at once.
+  const size_t kReadBatch = 32;
+  // Paths waiting to be read, and bytes read waiting to be indexed.
+  const size_t kReadQueueFiles = 4 * 1024;
+  const size_t kIndexQueueBytes = 32 * 1024 * 1024;
+  // How often the client hears about the build.
+  const unsigned int kContentProgressMs = 50;
+  // Text searches read the candidate files on several threads, at least
+  // this many files each.
+  const size_t kMinFilesPerTextThread = 64;
+  // A TextHit carries this much of its line at most.
+  const size_t kMaxHitText = 512;
+
+  // One part per core, but none smaller than |min_part|.
+  size_t PartCount(size_t count, size_t min_part) {
+    size_t parts = std::thread::hardware_concurrency();
+    parts = std::min(parts, count / min_part);
+    return parts ? parts : 1;
+  }
+
+  // Splits [0, count) into |parts| ranges and calls |fn(part, begin, end)| for
+  // each one on its own thread. The calling thread takes the first part.
+  template <typename Fn>
+  void ParallelFor(size_t parts, size_t count, Fn fn) {
+    const size_t chunk = (count + parts - 1) / parts;
+    std::vector<std::thread> threads;
+    for (size_t px = 1; px < parts; ++px) {
+      threads.push_back(std::thread(fn, px, std::min(px * chunk, count),
+                                    std::min((px + 1) * chunk, count)));
+    }
+    fn(0, 0, std::min(chunk, count));
+    for (size_t tx = 0; tx != threads.size(); ++tx) {
+      threads[tx].join();
+    }
+  }
+}
+
+// Tells a search loop when a bounded call has to return.
+class V1CodeSearch::StopCheck {
+public:
+  explicit StopCheck(const Control* control) : control_(control) {
+    if (control_ && control_->budget_ms) {
+      deadline_ = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(control_->budget_ms);
+    }
+  }
+
+  bool ShouldStop(Status* why) const {
+    if (!control_)
+      return false;
+    if (control_->generation && (*control_->generation != control_->expected)) {
+      *why = CodeSearch::Cancelled;
+      return true;
+    }
+    if (control_->budget_ms && (std::chrono::steady_clock::now() >= deadline_)) {
+      *why = CodeSearch::Deadline;
+      return true;
+    }
+    return false;
+  }
+
+private:
+  const Control* control_;
+  std::chrono::steady_clock::time_point deadline_;
+};
+
+V1CodeSearch::V1CodeSearch()
+    : indexed_files_(0), index_ns_(0), crawl_syscalls_(0), content_stop_(false), content_ns_(0),
+      finish_ns_(0), dir_path_ix_(DirTable::kNoParent),
+      wide_dir_path_ix_(DirTable::kNoParent) {
+  dirs_.Reserve(200, 200 * 16);
+  files_.Reserve(2000, 2000 * 16);
+}
+
+std::string V1CodeSearch::FilePath(size_t file_ix) const {
+  const std::string& dir = DirPath(files_.dir_ix(file_ix));
+  std::string result;
+  result.reserve(dir.size() + 1 + files_.name_len(file_ix));
+  result.append(dir);
+  result.append(1, kPathSeparator);
+  result.append(files_.name(file_ix), files_.name_len(file_ix));
+  return result;
+}
+
+// A directory's path never changes once it is in the table, only a new
+// Index() or Load() starts it over.
+const std::string& V1CodeSearch::DirPath(size_t dir_ix) const {
+  if (dir_ix != dir_path_ix_) {
+    dir_path_.resize(dirs_.path_len(dir_ix));
+    dirs_.CopyPath(dir_ix, &dir_path_[0]);
+    dir_path_ix_ = dir_ix;
+  }
+  return dir_path_;
+}
+
+const std::wstring& V1CodeSearch::WideDirPath(size_t dir_ix) const {
+  if (dir_ix != wide_dir_path_ix_) {
+    const std::string& dir = DirPath(dir_ix);
+    wide_dir_path_.resize(dir.size());
+    wide_dir_path_.resize(Utf8ToWide(dir.c_str(), dir.size(), &wide_dir_path_[0]));
+    wide_dir_path_ix_ = dir_ix;
+  }
+  return wide_dir_path_;
+}
+
+size_t V1CodeSearch::WideFilePath(size_t file_ix, wchar_t* out) const {
+  const std::wstring& dir = WideDirPath(files_.dir_ix(file_ix));
+  size_t len = dir.size();
+  wmemcpy(out, dir.c_str(), len);
+  out[len++] = kPathSeparator;
+  return len + Utf8ToWide(files_.name(file_ix), files_.name_len(file_ix), out + len);
+}
+
+std::wstring V1CodeSearch::WideFilePath(size_t file_ix) const {
+  std::wstring path(dirs_.path_len(files_.dir_ix(file_ix)) + 1 + files_.name_len(file_ix), L'\0');
+  path.resize(WideFilePath(file_ix, &path[0]));
+  return path;
+}
+
+class V1CodeSearch::QuerySession : public CodeSearch::Session {
+public:
+  QueryState query;
+};
+
+V1CodeSearch::QueryState* V1CodeSearch::StateOf(Session* session) {
+  return session ? &static_cast<QuerySession*>(session)->query : &query_;
+}
+
+std::vector<std::wstring> V1CodeSearch::Paths(const std::vector<uint32_t>& files) {
+  std::vector<std::wstring> paths;
+  paths.reserve(files.size());
+  std::lock_guard<std::mutex> lock(lock_);
+  for (size_t ix = 0; ix != files.size(); ++ix) {
+    paths.push_back(WideFilePath(files[ix]));
+  }
+  return paths;
+}
+
+std::vector<std::wstring> V1CodeSearch::Search(const wchar_t* txt, Options options) {
+  std::vector<uint32_t> files;
+  SearchImpl(&query_, txt, true, options, NULL, &files);
+  return Paths(files);
+}
+
+std::vector<std::wstring> V1CodeSearch::Continue() {
+  std::vector<uint32_t> files;
+  SearchImpl(&query_, NULL, false, CodeSearch::None, NULL, &files);
+  return Paths(files);
+}
+
+std::vector<std::wstring> V1CodeSearch::Search(const wchar_t* txt, Options options,
+                                               const Control& control, Status* status) {
+  std::vector<uint32_t> files;
+  *status = SearchImpl(&query_, txt, true, options, &control, &files);
+  return Paths(files);
+}
+
+std::vector<std::wstring> V1CodeSearch::Continue(const Control& control, Status* status) {
+  std::vector<uint32_t> files;
+  *status = SearchImpl(&query_, NULL, false, CodeSearch::None, &control, &files);
+  return Paths(files);
+}
+
+CodeSearch::Session* V1CodeSearch::NewSession() {
+  return new QuerySession;
+}
+
+std::vector<std::wstring> V1CodeSearch::Search(Session* session, const wchar_t* txt,
+                                               Options options, const Control& control,
+                                               Status* status) {
+  std::vector<uint32_t> files;
+  *status = SearchImpl(StateOf(session), txt, true, options, &control, &files);
+  return Paths(files);
+}
+
+std::vector<std::wstring> V1CodeSearch::Continue(Session* session, const Control& control,
+                                                 Status* status) {
+  std::vector<uint32_t> files;
+  *status = SearchImpl(StateOf(session), NULL, false, CodeSearch::None, &control, &files);
+  return Paths(files);
+}
+
+CodeSearch::Status V1CodeSearch::SearchIds(Session* session, const wchar_t* txt,
+                                           Options options, const Control& control,
+                                           std::vector<FileId>* ids) {
+  return SearchImpl(StateOf(session), txt, true, options, &control, ids);
+}
+
+CodeSearch::Status V1CodeSearch::ContinueIds(Session* session, const Control& control,
+                                             std::vector<FileId>* ids) {
+  return SearchImpl(StateOf(session), NULL, false, CodeSearch::None, &control, ids);
+}
+
+// The length in characters is only known once the path is decoded, so all of
+// it is, into |path_chars_|.
+size_t V1CodeSearch::GetPath(FileId id, wchar_t* buf, size_t size) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (id >= files_.size())
+    return 0;
+  path_chars_.resize(dirs_.path_len(files_.dir_ix(id)) + 1 + files_.name_len(id));
+  size_t len = WideFilePath(id, &path_chars_[0]);
+  if (!size)
+    return len;
+  size_t part = std::min(len, size - 1);
+  wmemcpy(buf, &path_chars_[0], part);
+  buf[part] = 0;
+  return len;
+}
+
+size_t V1CodeSearch::GetPathUtf8(FileId id, char* buf, size_t size) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (id >= files_.size())
+    return 0;
+  const std::string& dir = DirPath(files_.dir_ix(id));
+  size_t dir_len = dir.size();
+  size_t name_len = files_.name_len(id);
+  size_t len = dir_len + 1 + name_len;
+  if (!size)
+    return len;
+  // The directory, the separator and the name, each cut short if need be.
+  size_t room = size - 1;
+  size_t part = std::min(dir_len, room);
+  memcpy(buf, dir.c_str(), part);
+  size_t pos = part;
+  if (pos < room)
+    buf[pos++] = kPathSeparator;
+  part = std::min(name_len, room - pos);
+  memcpy(buf + pos, files_.name(id), part);
+  buf[pos + part] = 0;
+  return len;
+}
+
+
+// What the stages of the build share. Every file ends up counted in |done|
+// by the stage that drops it or by the indexer.
+struct V1CodeSearch::ContentPipeline {
+  struct Source {
+    uint32_t file;
+    std::string path;
+  };
+  // Either the whole file in |data| or, for the files ReadContent() turned
+  // down, the |path| to stream it from.
+  struct Loaded {
+    uint32_t file;
+    std::vector<char> data;
+    std::string path;
+  };
+
+  size_t total;
+  std::atomic<size_t> done;
+  // Readers still running, the last one closes |to_index|.
+  std::atomic<size_t> readers;
+  BoundedQueue<Source> to_read;
+  BoundedQueue<Loaded> to_index;
+
+  explicit ContentPipeline(size_t i_total)
+      : total(i_total), done(0), readers(0),
+        to_read(kReadQueueFiles), to_index(kIndexQueueBytes) {}
+
+  void Close() {
+    to_read.Close();
+    to_index.Close();
+  }
+};
+
+int V1CodeSearch::IndexContent(Client* client) {
+  if (content_thread_.joinable())
+    return 0;
+  if (dirs_.empty())
+    return -1;
+  content_thread_ = std::thread(&V1CodeSearch::ContentLoop, this, client);
+  return 0;
+}
+
+void V1CodeSearch::StopContent() {
+  content_stop_ = true;
+  if (content_thread_.joinable())
+    content_thread_.join();
+}
+
+// Covers the files there are now, the ones Watch() adds later are not read.
+// This thread only starts the stages and reports on them.
+void V1CodeSearch::ContentLoop(Client* client) {
+  // The metrics of the build are of this build only.
+  counters_.Reset();
+  read_queue_.Reset();
+  index_queue_.Reset();
+  content_ns_ = 0;
+  finish_ns_ = 0;
+  ElapsedTimer timer;
+  size_t total;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    total = files_.size();
+  }
+  content_.Start();
+  content_trigrams_.Start();
+
+  size_t indexers = std::max(1u, std::thread::hardware_concurrency());
+  ContentPipeline pipeline(total);
+  pipeline.readers = kContentReaders;
+  // Every stage blocks on its queues, so each one gets a thread of its own.
+  ThreadPool pool(1 + kContentReaders + indexers);
+  TaskGroup stages;
+  pool.Post(&stages, [this, &pipeline]() { CrawlContent(&pipeline); });
+  for (size_t ix = 0; ix != kContentReaders; ++ix) {
+    pool.Post(&stages, [this, &pipeline]() { ReadContentLoop(&pipeline); });
+  }
+  for (size_t ix = 0; ix != indexers; ++ix) {
+    pool.Post(&stages, [this, &pipeline]() { IndexContentLoop(&pipeline); });
+  }
+
+  ContentProgress progress = { 0, total, 0, 0, false };
+  while (!stages.WaitFor(kContentProgressMs) && !content_stop_) {
+    progress.done = pipeline.done;
+    progress.read_queue = pipeline.to_read.size();
+    progress.index_queue = pipeline.to_index.size();
+    read_queue_.Set(progress.read_queue);
+    index_queue_.Set(progress.index_queue);
+    content_ns_ = timer.ns();
+    if (client)
+      client->OnContentProgress(this, progress);
+  }
+  read_queue_.Set(0);
+  index_queue_.Set(0);
+  // Unblocks every stage if stopping, a no-op otherwise.
+  if (content_stop_)
+    pipeline.Close();
+  stages.Wait();
+  if (content_stop_)
+    return;
+
+  ElapsedTimer finish_timer;
+  content_.Finish(&pool);
+  content_trigrams_.Finish(&pool);
+  finish_ns_ = finish_timer.ns();
+  content_ns_ = timer.ns();
+  if (client) {
+    ContentProgress last = { total, total, 0, 0, true };
+    client->OnContentProgress(this, last);
+  }
+}
+
+void V1CodeSearch::CrawlContent(ContentPipeline* pipeline) {
+  std::vector<ContentPipeline::Source> batch;
+  for (size_t first = 0; first < pipeline->total; first += kCrawlBatch) {
+    size_t last = std::min(first + kCrawlBatch, pipeline->total);
+    size_t skipped = 0;
+    batch.clear();
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      for (size_t fx = first; fx != last; ++fx) {
+        if (Removed(fx) || (ClassifyFile(files_.name(fx), files_.name_len(fx)) != kCpp)) {
+          ++skipped;
+          continue;
+        }
+        ContentPipeline::Source source = { static_cast<uint32_t>(fx), FilePath(fx) };
+        batch.push_back(source);
+      }
+    }
+    pipeline->done += skipped;
+    for (size_t ix = 0; ix != batch.size(); ++ix) {
+      if (!pipeline->to_read.Push(std::move(batch[ix])))
+        return;
+    }
+  }
+  pipeline->to_read.Close();
+}
+
+void V1CodeSearch::ReadContentBatch(ContentFile* files, size_t count) {
+  for (size_t ix = 0; ix != count; ++ix) {
+    files[ix].ok = ReadContent(files[ix].path, &files[ix].data);
+  }
+  // Opening, sizing, reading and closing each file.
+  counters_.Add(kReadSyscalls, 4 * count);
+}
+
+void V1CodeSearch::ReadContentLoop(ContentPipeline* pipeline) {
+  std::vector<ContentPipeline::Source> sources;
+  std::vector<ContentFile> files;
+  bool closed = false;
+  while (!closed && pipeline->to_read.PopSome(&sources, kReadBatch)) {
+    files.resize(sources.size());
+    for (size_t ix = 0; ix != sources.size(); ++ix) {
+      files[ix].path.swap(sources[ix].path);
+      files[ix].data.clear();
+      files[ix].ok = false;
+    }
+    ElapsedTimer timer;
+    ReadContentBatch(&files[0], files.size());
+    counters_.Add(kReadNs, timer.ns());
+
+    for (size_t ix = 0; (ix != files.size()) && !closed; ++ix) {
+      ContentPipeline::Loaded loaded;
+      loaded.file = sources[ix].file;
+      size_t cost;
+      if (files[ix].ok) {
+        loaded.data.swap(files[ix].data);
+        cost = loaded.data.size();
+        counters_.Add(kFilesRead, 1);
+        counters_.Add(kBytesRead, cost);
+      } else {
+        // Mostly files over kMaxContentFile. The indexer streams them, or
+        // finds out the file is empty or gone.
+        loaded.path.swap(files[ix].path);
+        cost = kTokenizeChunk;
+      }
+      closed = !pipeline->to_index.Push(std::move(loaded), cost);
+    }
+  }
+  if (--pipeline->readers == 0)
+    pipeline->to_index.Close();
+}
+
+void V1CodeSearch::IndexContentLoop(ContentPipeline* pipeline) {
+  ContentPipeline::Loaded loaded;
+  TokenList tokens;
+  ContentTrigrams::Scratch scratch;
+  FileDataStream stream;
+  StreamTokenizer streamer;
+  while (pipeline->to_index.Pop(&loaded)) {
+    if (loaded.data.empty()) {
+      // Its tokens go in a chunk at a time, the memory it takes does not
+      // depend on its size. Text searches read whole files, so it gets no
+      // trigrams.
+      if (stream.Open(loaded.path.c_str())) {
+        streamer.Reset(&stream);
+        // The open, the fstat() and the close.
+        uint64_t syscalls = 3;
+        bool more;
+        do {
+          tokens.clear();
+          ++syscalls;
+          ElapsedTimer timer;
+          more = streamer.Next(&tokens);
+          // The chunk is read as part of it.
+          counters_.Add(kTokenizeNs, timer.ns());
+          ElapsedTimer add_timer;
+          content_.Add(loaded.file, tokens);
+          counters_.Add(kAddNs, add_timer.ns());
+        } while (more && !content_stop_);
+        counters_.Add(kFilesStreamed, 1);
+        counters_.Add(kBytesRead, stream.GetPos());
+        counters_.Add(kReadSyscalls, syscalls);
+        stream.Close();
+      }
+      ++pipeline->done;
+      continue;
+    }
+    tokens.clear();
+    // Binary files fail to tokenize, what came before is still good. Their
+    // trigrams are still those of the whole file: SearchText() reads all of
+    // it, so leaving any out would hide lines it can match.
+    const char* beg = &loaded.data[0];
+    const char* end = beg + loaded.data.size();
+    ElapsedTimer timer;
+    Tokenize(beg, end, &tokens);
+    counters_.Add(kTokenizeNs, timer.ns());
+    ElapsedTimer add_timer;
+    content_.Add(loaded.file, tokens);
+    content_trigrams_.Add(loaded.file, beg, end, &scratch);
+    counters_.Add(kAddNs, add_timer.ns());
+    ++pipeline->done;
+  }
+}
+
+std::vector<std::wstring> V1CodeSearch::SearchContent(const wchar_t* token, bool* partial) {
+  std::vector<std::wstring> matches;
+  // The tokens are the bytes of the file and the non-ASCII ones are part of
+  // them, so a UTF-8 key matches what was indexed from UTF-8 sources.
+  std::string key(WideToUtf8(token, wcslen(token)));
+  if (key.empty()) {
+    *partial = !content_.finished();
+    return matches;
+  }
+
+  std::vector<uint32_t> files;
+  *partial = !content_.Lookup(key, &files);
+
+  std::lock_guard<std::mutex> lock(lock_);
+  for (size_t ix = 0; ix != files.size(); ++ix) {
+    if (!Removed(files[ix]))
+      matches.push_back(WideFilePath(files[ix]));
+  }
+  return matches;
+}
+
+int V1CodeSearch::SearchText(const wchar_t* pattern, unsigned int flags, size_t max_hits,
+                             std::vector<TextHit>* hits, bool* partial, std::string* error) {
+  hits->clear();
+  unsigned int query_flags = ((flags & TextLiteral) ? RegexQuery::kLiteral : 0) |
+                             ((flags & TextIgnoreCase) ? RegexQuery::kIgnoreCase : 0);
+  RegexQuery query;
+  std::string compile_error;
+  if (!query.Compile(WideToUtf8(pattern, wcslen(pattern)), query_flags, &compile_error)) {
+    if (error)
+      *error = compile_error;
+    return -1;
+  }
+
+  std::vector<uint32_t> files;
+  *partial = !content_trigrams_.Evaluate(query.trigrams(), &files);
+  std::vector<std::string> paths;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    for (size_t ix = 0; ix != files.size(); ++ix) {
+      if (!Removed(files[ix]))
+        paths.push_back(FilePath(files[ix]));
+    }
+  }
+  if (paths.empty() || !max_hits)
+    return 0;
+
+  // Each part can fill all of |max_hits| on its own, so that the first ones
+  // in index order are there whatever the parts before it found.
+  const size_t parts = PartCount(paths.size(), kMinFilesPerTextThread);
+  std::vector<std::vector<TextHit> > found(parts);
+  ParallelFor(parts, paths.size(), [&](size_t part, size_t begin, size_t end) {
+    std::vector<TextHit>& out = found[part];
+    std::vector<char> data;
+    std::vector<RegexQuery::LineMatch> lines;
+    for (size_t ix = begin; (ix != end) && (out.size() < max_hits); ++ix) {
+      if (!ReadContent(paths[ix], &data))
+        continue;
+      lines.clear();
+      query.FindLines(&data[0], &data[0] + data.size(), max_hits - out.size(), &lines);
+      for (size_t lx = 0; lx != lines.size(); ++lx) {
+        TextHit hit;
+        hit.path = Utf8ToWide(paths[ix].c_str(), paths[ix].size());
+        hit.line = lines[lx].line;
+        hit.text = Utf8ToWide(lines[lx].beg,
+                              std::min<size_t>(lines[lx].end - lines[lx].beg, kMaxHitText));
+        out.push_back(hit);
+      }
+    }
+  });
+
+  for (size_t px = 0; (px != parts) && (hits->size() < max_hits); ++px) {
+    size_t take = std::min(found[px].size(), max_hits - hits->size());
+    hits->insert(hits->end(), found[px].begin(), found[px].begin() + take);
+  }
+  return 0;
+}
+
+namespace {
+  double Ms(uint64_t ns) {
+    return ns / 1e6;
+  }
+
+  void FillLatency(const LatencyHistogram& histogram, CodeSearch::Latency* latency) {
+    latency->count = histogram.count();
+    latency->p50_ms = Ms(histogram.ValueAt(50));
+    latency->p90_ms = Ms(histogram.ValueAt(90));
+    latency->p99_ms = Ms(histogram.ValueAt(99));
+    latency->p999_ms = Ms(histogram.ValueAt(99.9));
+    latency->max_ms = Ms(histogram.max());
+    std::vector<std::pair<uint64_t, uint64_t> > buckets;
+    histogram.Buckets(&buckets);
+    latency->buckets.clear();
+    for (size_t bx = 0; bx != buckets.size(); ++bx) {
+      latency->buckets.push_back(std::make_pair(Ms(buckets[bx].first), buckets[bx].second));
+    }
+  }
+}
+
+int V1CodeSearch::GetMetrics(Metrics* metrics) {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    metrics->dirs = dirs_.size();
+    metrics->files = files_.size();
+    metrics->dirs_discarded = stats_.dirs_discarded;
+    metrics->files_discarded = stats_.files_discarded;
+    metrics->hidden_discarded = stats_.hidden_discarded;
+    metrics->dir_table_bytes = dirs_.memory_size();
+    metrics->file_table_bytes = files_.memory_size();
+    metrics->name_index_bytes = trigrams_.memory_size() + by_name_.memory_size() +
+                                name_masks_.memory_size();
+  }
+  metrics->index_ms = Ms(index_ns_);
+  metrics->crawl_syscalls = crawl_syscalls_;
+
+  metrics->content_ms = Ms(content_ns_);
+  metrics->read_ms = Ms(counters_.Get(kReadNs));
+  metrics->tokenize_ms = Ms(counters_.Get(kTokenizeNs));
+  metrics->add_ms = Ms(counters_.Get(kAddNs));
+  metrics->finish_ms = Ms(finish_ns_);
+  metrics->files_read = counters_.Get(kFilesRead);
+  metrics->files_streamed = counters_.Get(kFilesStreamed);
+  metrics->bytes_read = counters_.Get(kBytesRead);
+  metrics->read_syscalls = counters_.Get(kReadSyscalls);
+  metrics->read_queue = read_queue_.value();
+  metrics->read_queue_max = read_queue_.max();
+  metrics->index_queue = index_queue_.value();
+  metrics->index_queue_max = index_queue_.max();
+  metrics->content_index_bytes = content_.memory_size();
+  metrics->content_trigram_bytes = content_trigrams_.memory_size();
+
+  FillLatency(search_latency_, &metrics->search);
+  FillLatency(continue_latency_, &metrics->more);
+  return 0;
+}
+
+void V1CodeSearch::BuildSearchIndexes() {
+  dirs_.ShrinkToFit();
+  dir_path_ix_ = DirTable::kNoParent;
+  wide_dir_path_ix_ = DirTable::kNoParent;
+  trigrams_.Build(files_);
+  by_name_.Build(files_);
+  name_masks_.resize(files_.size());
+  uint64_t* masks = name_masks_.mutable_data();
+  for (size_t ix = 0; ix != files_.size(); ++ix) {
+    masks[ix] = FuzzyQuery::CharMask(files_.name(ix), files_.name_len(ix));
+  }
+  indexed_files_ = files_.size();
+  removed_.clear();
+}
+
+// The order of the arrays is the snapshot format, see index_snapshot.h.
+// Only the gathering happens under |lock_|, the file is written after. The
+// tables the watch thread grows are copied, the name indexes are not: they
+// only change in Index(), which does not run alongside Save().
+int V1CodeSearch::Save(const wchar_t* path) {
+  SnapshotWriter out;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (dirs_.empty())
+      return -1;
+    uint64_t stats[] = {
+      stats_.dirs_discarded, stats_.files_discarded, stats_.hidden_discarded,
+      stats_.time_taken_secs, indexed_files_
+    };
+    out.Add(stats, 5);
+    dirs_.Write(&out);
+    files_.Write(&out);
+    out.set_copy(false);
+    trigrams_.Write(&out);
+    by_name_.Write(&out);
+    out.set_copy(true);
+    out.Add(name_masks_);
+    out.Add(removed_);
+  }
+  if (!out.Open(path))
+    return -1;
+  return out.Commit() ? 0 : -1;
+}
+
+int V1CodeSearch::Load(const wchar_t* path, const wchar_t* root_dir) {
+  // The tables start borrowing as soon as they are mapped, even if a later
+  // check fails, so the file stays mapped for as long as the engine lives.
+  snapshot_.reset(new MappedFile);
+  if (!snapshot_->Open(path))
+    return -1;
+
+  SnapshotReader in;
+  if (!in.Init(snapshot_->data(), snapshot_->size()))
+    return -1;
+
+  const uint64_t* stats;
+  size_t stats_count;
+  if (!in.Next(&stats, &stats_count) || (stats_count != 5))
+    return -1;
+  indexed_files_ = static_cast<size_t>(stats[4]);
+  // Every index into another array is checked as it is mapped, so a corrupt
+  // or truncated snapshot fails here and not on the first query.
+  if (!dirs_.Map(&in) || !files_.Map(&in, dirs_.size()) || (indexed_files_ > files_.size()) ||
+      !trigrams_.Map(&in, indexed_files_) || !by_name_.Map(&in, indexed_files_) ||
+      !in.Next(&name_masks_) || !in.Next(&removed_) || (name_masks_.size() != files_.size()) ||
+      (removed_.size() > files_.size()))
+    return -1;
+  if (dirs_.empty() || (dirs_.Path(0) != WideToUtf8(root_dir, wcslen(root_dir))))
+    return -1;
+  dir_path_ix_ = DirTable::kNoParent;
+  wide_dir_path_ix_ = DirTable::kNoParent;
+
+  stats_.dirs_discarded = static_cast<size_t>(stats[0]);
+  stats_.files_discarded = static_cast<size_t>(stats[1]);
+  stats_.hidden_discarded = static_cast<size_t>(stats[2]);
+  stats_.time_taken_secs = static_cast<size_t>(stats[3]);
+  return 0;
+}
+
+CodeSearch::Status V1CodeSearch::SearchImpl(QueryState* query, const wchar_t* txt, bool reset,
+                                            Options options, const Control* control,
+                                            std::vector<uint32_t>* matches) {
+  // Waiting for the lock counts, the caller waits for it too.
+  ScopedLatency latency(reset ? &search_latency_ : &continue_latency_);
+  std::lock_guard<std::mutex> lock(lock_);
+  StopCheck stop(control);
+  matches->clear();
+  Status status = CodeSearch::Done;
+
+  // The query is matched in UTF-8, like the names.
+  std::string utf8(reset ? WideToUtf8(txt, wcslen(txt)) : query->search_term);
+  const char* term = utf8.c_str();
+  size_t len = utf8.size();
+
+  if (reset) {
+    if ((options == CodeSearch::BeginsWith) || (options == CodeSearch::Substring)) {
+      size_t name_pos = len;
+      while (name_pos && (term[name_pos - 1] != '/') && (term[name_pos - 1] != kPathSeparator))
+        --name_pos;
+      if (query->dir_term.compare(0, std::string::npos, term, name_pos) != 0) {
+        // Other directories, the previous matches are of no use.
+        query->dir_term.assign(term, name_pos);
+        query->current_options = CodeSearch::None;
+      }
+      MatchDirs(query);
+      term += name_pos;
+      len -= name_pos;
+    }
+    if (options == CodeSearch::BeginsWith)
+      StartBeginsWith(query, term, len);
+    else if (options == CodeSearch::Substring)
+      StartSubstring(query, term, len);
+    else if (options == CodeSearch::Fuzzy)
+      status = RankFuzzy(query, term, len, &stop);
+    query->search_term.assign(term, len);
+    query->current_options = options;
+    if (status == CodeSearch::Cancelled)
+      return status;
+  } else {
+    // A Continue() with no Search() before it has nothing to go on with.
+    if (query->current_options == CodeSearch::None)
+      return status;
+    options = query->current_options;
+  }
+
+  if (options == CodeSearch::BeginsWith) {
+    status = WalkPrefixRange(query, term, len, &stop, matches);
+  } else if (options == CodeSearch::Substring) {
+    status = FindSubstrings(query, term, len, &stop, matches);
+  } else if (options == CodeSearch::Fuzzy) {
+    status = WalkRanked(query, matches);
+  } else {
+    assert(false);
+  }
+
+  return status;
+}
+
+// The components of the directory part have to be the names of the last
+// directories of the path, or of the first ones below the root when it starts
+// with a separator. Comparing name ids, most directories are ruled out by
+// their own name.
+void V1CodeSearch::MatchDirs(QueryState* query) {
+  query->in_dirs.clear();
+  if (!query->dir_term.empty())
+    ExtendDirs(query);
+}
+
+// Matches the directories from the end of |in_dirs| on. A directory never
+// changes its name or its parent, so the ones already there stay valid and
+// the ones that Watch() adds later are only looked at when a file needs them.
+void V1CodeSearch::ExtendDirs(QueryState* query) {
+  const std::string& term = query->dir_term;
+  const size_t first = query->in_dirs.size();
+  query->in_dirs.resize(dirs_.size());
+
+  std::vector<uint32_t> names;
+  size_t pos = 0;
+  while (pos != term.size()) {
+    size_t end = pos;
+    while ((term[end] != '/') && (term[end] != kPathSeparator))
+      ++end;
+    if (end != pos) {
+      uint32_t name_id = dirs_.FindName(&term[pos], end - pos);
+      // No directory is called that.
+      if (name_id == DirTable::kNoName)
+        return;
+      names.push_back(name_id);
+    }
+    pos = end + 1;
+  }
+  const bool rooted = (term[0] == '/') || (term[0] == kPathSeparator);
+
+  for (size_t dx = first; dx != dirs_.size(); ++dx) {
+    size_t dir_ix = dx;
+    size_t nx = names.size();
+    while (nx && dir_ix && (dirs_.name_id(dir_ix) == names[nx - 1])) {
+      dir_ix = dirs_.parent(dir_ix);
+      --nx;
+    }
+    query->in_dirs[dx] = !nx && (!rooted || !dir_ix);
+  }
+}
+
+// When |txt| extends the previous prefix the new range is inside the old one,
+// so only that part of the name order is searched.
+void V1CodeSearch::StartBeginsWith(QueryState* query, const char* txt, size_t len) {
+  const size_t prev_len = query->search_term.size();
+  bool refine = (query->current_options == CodeSearch::BeginsWith) && prev_len &&
+                (len >= prev_len) && (0 == memcmp(txt, query->search_term.c_str(), prev_len));
+  if (!len && query->dir_term.empty()) {
+    query->range_begin = 0;
+    query->range_end = 0;
+    query->tail_pos = files_.size();
+  } else {
+    if (!refine) {
+      query->range_begin = 0;
+      query->range_end = indexed_files_;
+    }
+    by_name_.Narrow(files_, txt, len, &query->range_begin, &query->range_end);
+    query->tail_pos = indexed_files_;
+  }
+  query->cursor = query->range_begin;
+}
+
+// Any file that contains |txt| also contains every substring of it. When the
+// previous term is one of them the new query only looks at what the previous
+// one matched plus what it had not checked yet. Anything else, a backspace or
+// an edit in the middle, starts from the trigram index or from a full scan.
+void V1CodeSearch::StartSubstring(QueryState* query, const char* txt, size_t len) {
+  bool refine = (query->current_options == CodeSearch::Substring) &&
+                (strstr(txt, query->search_term.c_str()) != NULL);
+  // An unfinished scan of the indexed files is not cheaper than the trigrams
+  // of the new term.
+  if (refine && (query->scan_pos < indexed_files_) && (len >= 3))
+    refine = false;
+
+  if (refine) {
+    std::vector<uint32_t> pending;
+    pending.reserve(query->matched.size() + query->pending.size() - query->pending_pos);
+    pending.assign(query->matched.begin(), query->matched.end());
+    pending.insert(pending.end(), query->pending.begin() + query->pending_pos, query->pending.end());
+    query->pending.swap(pending);
+  } else if (len >= 3) {
+    trigrams_.Candidates(txt, len, &query->pending);
+    // The files added since the trigrams were built are scanned.
+    query->scan_pos = indexed_files_;
+  } else {
+    query->pending.clear();
+    query->scan_pos = 0;
+  }
+  query->pending_pos = 0;
+  query->matched.clear();
+}
+
+// The matches of a prefix are contiguous in the name order. Without a
+// directory part every file of the range is a match and there is no reason
+// to look at the clock, with one most of them can be skipped. Only the few
+// files added after the index was built are compared one by one.
+CodeSearch::Status V1CodeSearch::WalkPrefixRange(QueryState* query, const char* txt,
+                                                 size_t len, StopCheck* stop,
+                                                 std::vector<uint32_t>* matches) {
+  Status status;
+  size_t checked = 0;
+  while ((query->cursor < query->range_end) && (matches->size() != 25)) {
+    if ((++checked % kCheckEvery == 0) && stop->ShouldStop(&status))
+      return status;
+    uint32_t file = by_name_.file(query->cursor++);
+    if (!Removed(file) && InDirs(query, file))
+      matches->push_back(file);
+  }
+  while ((query->tail_pos < files_.size()) && (matches->size() != 25)) {
+    if ((++checked % kCheckEvery == 0) && stop->ShouldStop(&status))
+      return status;
+    size_t file = query->tail_pos++;
+    if (!Removed(file) && InDirs(query, file) && (files_.name_len(file) >= len) &&
+        (0 == memcmp(files_.name(file), txt, len)))
+      matches->push_back(static_cast<uint32_t>(file));
+  }
+  return (matches->size() == 25) ? CodeSearch::More : CodeSearch::Done;
+}
+
+CodeSearch::Status V1CodeSearch::FindSubstrings(QueryState* query, const char* txt,
+                                                size_t len, StopCheck* stop,
+                                                std::vector<uint32_t>* matches) {
+  Status status;
+  size_t checked = 0;
+  while (query->pending_pos != query->pending.size()) {
+    if ((++checked % kCheckEvery == 0) && stop->ShouldStop(&status))
+      return status;
+
+    uint32_t file = query->pending[query->pending_pos++];
+    if (Removed(file) || !InDirs(query, file))
+      continue;
+    if (FindSubstring(files_.name(file), files_.name_len(file), txt, len) == kSubstringNotFound)
+      continue;
+
+    // A match has been found.
+    query->matched.push_back(file);
+    matches->push_back(file);
+    if (matches->size() == 25) {
+      return CodeSearch::More;
+    }
+  }
+
+  // The scan walks the name arena front to back a block of files at a time and
+  // maps each hit back to its file. The names are zero terminated so a match
+  // can never straddle two of them.
+  const size_t end = files_.size();
+  const char* arena = files_.arena();
+  const size_t arena_size = files_.arena_size();
+  while (query->scan_pos != end) {
+    if (stop->ShouldStop(&status))
+      return status;
+
+    size_t block_end = std::min(query->scan_pos + kScanBlock, end);
+    size_t from = files_.name_offset(query->scan_pos);
+    size_t to = (block_end == end) ? arena_size : files_.name_offset(block_end);
+    size_t pos = FindSubstring(arena + from, to - from, txt, len);
+    if (pos == kSubstringNotFound) {
+      query->scan_pos = block_end;
+      continue;
+    }
+    size_t file = files_.FileAt(from + pos, query->scan_pos);
+    query->scan_pos = file + 1;
+    if (Removed(file) || !InDirs(query, file))
+      continue;
+
+    // A match has been found.
+    query->matched.push_back(static_cast<uint32_t>(file));
+    matches->push_back(static_cast<uint32_t>(file));
+    if (matches->size() == 25) {
+      return CodeSearch::More;
+    }
+  }
+  return CodeSearch::Done;
+}
+
+// Every file gets a score, but each thread only keeps its own best few in a
+// small heap. The heaps are merged at the end, nothing else is ever sorted.
+// The ranking is all or nothing: it honors a cancellation but not a budget.
+CodeSearch::Status V1CodeSearch::RankFuzzy(QueryState* query, const char* txt, size_t len,
+                                           StopCheck* stop) {
+  query->ranked.clear();
+  query->ranked_pos = 0;
+  if (!len || files_.empty())
+    return CodeSearch::Done;
+
+  const FuzzyQuery fuzzy(txt, len);
+
+  // How much of the query each directory can take, without the root. Each
+  // one goes on from where its parent left off, parents come first.
+  std::vector<uint16_t> dir_prefix(dirs_.size());
+  for (size_t dx = 1; dx < dirs_.size(); ++dx) {
+    size_t parent = dirs_.parent(dx);
+    size_t matched = dir_prefix[parent];
+    if (parent != 0)
+      matched = fuzzy.PrefixMatched(matched, &kPathSeparator, 1);
+    dir_prefix[dx] = static_cast<uint16_t>(
+        fuzzy.PrefixMatched(matched, dirs_.name(dx), dirs_.name_len(dx)));
+  }
+
+  const size_t parts = PartCount(files_.size(), kMinFilesPerThread);
+  std::vector<FuzzyTopK> heaps(parts, FuzzyTopK(kFuzzyResults));
+  std::vector<char> stopped(parts, 0);
+  ParallelFor(parts, files_.size(), [&](size_t part, size_t begin, size_t end) {
+    FuzzyTopK& heap = heaps[part];
+    Status why;
+    for (size_t fx = begin; fx != end; ++fx) {
+      if (((fx - begin) % kScanBlock == 0) && stop->ShouldStop(&why) &&
+          (why == CodeSearch::Cancelled)) {
+        stopped[part] = 1;
+        return;
+      }
+      size_t prefix = dir_prefix[files_.dir_ix(fx)];
+      if (!fuzzy.MayMatch(name_masks_[fx], prefix) || Removed(fx))
+        continue;
+      int score;
+      if (fuzzy.Score(files_.name(fx), files_.name_len(fx), prefix, &score))
+        heap.Add(score, static_cast<uint32_t>(fx));
+    }
+  });
+  if (std::find(stopped.begin(), stopped.end(), 1) != stopped.end())
+    return CodeSearch::Cancelled;
+
+  FuzzyTopK best(kFuzzyResults);
+  std::vector<FuzzyHit> hits;
+  for (size_t px = 0; px != parts; ++px) {
+    heaps[px].Take(&hits);
+    for (size_t hx = 0; hx != hits.size(); ++hx) {
+      best.Add(hits[hx].score, hits[hx].file);
+    }
+  }
+  best.Take(&hits);
+  for (size_t hx = 0; hx != hits.size(); ++hx) {
+    query->ranked.push_back(hits[hx].file);
+  }
+  return CodeSearch::Done;
+}
+
+CodeSearch::Status V1CodeSearch::WalkRanked(QueryState* query,
+                                            std::vector<uint32_t>* matches) {
+  while ((query->ranked_pos != query->ranked.size()) && (matches->size() != 25)) {
+    matches->push_back(query->ranked[query->ranked_pos++]);
+  }
+  return (query->ranked_pos != query->ranked.size()) ? CodeSearch::More : CodeSearch::Done;
+}
+
+void V1CodeSearch::StartEdits() {
+  lookup_.Build(dirs_, files_, removed_);
+}
+
+size_t V1CodeSearch::FindDir(size_t parent_ix, const char* name, size_t len) const {
+  return lookup_.FindChild(dirs_, parent_ix, name, len);
+}
+
+size_t V1CodeSearch::AddDir(size_t parent_ix, const char* name, size_t len) {
+  size_t dir_ix = lookup_.FindChild(dirs_, parent_ix, name, len);
+  if (dir_ix != DirLookup::kNotFound)
+    return dir_ix;
+  dir_ix = dirs_.Add(parent_ix, name, len);
+  lookup_.AddDir(dir_ix, parent_ix);
+  return dir_ix;
+}
+
+void V1CodeSearch::RemoveDir(size_t dir_ix, std::vector<uint32_t>* removed_dirs) {
+  std::vector<uint32_t> files;
+  lookup_.RemoveTree(dir_ix, removed_dirs, &files);
+  removed_.resize(files_.size());
+  uint8_t* removed = removed_.mutable_data();
+  for (size_t ix = 0; ix != files.size(); ++ix) {
+    removed[files[ix]] = 1;
+  }
+}
+
+size_t V1CodeSearch::FindFile(size_t dir_ix, const char* name, size_t len) const {
+  const std::vector<uint32_t>& files = lookup_.files(dir_ix);
+  for (size_t ix = 0; ix != files.size(); ++ix) {
+    if ((files_.name_len(files[ix]) == len) && (0 == memcmp(files_.name(files[ix]), name, len)))
+      return files[ix];
+  }
+  return DirLookup::kNotFound;
+}
+
+void V1CodeSearch::AddFile(size_t dir_ix, const char* name, size_t len, uint64_t size) {
+  if (FindFile(dir_ix, name, len) != DirLookup::kNotFound)
+    return;
+  size_t file_ix = files_.Add(name, len, dir_ix, size);
+  name_masks_.push_back(FuzzyQuery::CharMask(name, len));
+  lookup_.AddFile(dir_ix, static_cast<uint32_t>(file_ix));
+}
+
+void V1CodeSearch::RemoveFile(size_t file_ix) {
+  if (removed_.size() <= file_ix)
+    removed_.resize(files_.size());
+  removed_.mutable_data()[file_ix] = 1;
+  lookup_.RemoveFile(files_.dir_ix(file_ix), static_cast<uint32_t>(file_ix));
+}
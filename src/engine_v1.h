@@ -0,0 +1,308 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <string.h>
+#include <wchar.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
+
+#include "code_search.h"
+#include "content_index.h"
+#include "content_trigrams.h"
+#include "dir_lookup.h"
+#include "dir_table.h"
+#include "file_table.h"
+#include "mapped_file.h"
+#include "metrics.h"
+#include "pod_array.h"
+#include "prefix_index.h"
+#include "scoped_ptr.h"
+#include "trigram_index.h"
+
+enum FileType {
+  kUnknown,
+  kGyp,
+  kCpp
+};
+
+// |Ch| is wchar_t for the windows engine and char for names that come
+// straight from the POSIX file system.
+template <typename Ch>
+bool IgnoreDirName(const Ch* name, size_t len) {
+  if ((len == 1) && (name[0] == '.'))
+    return true;
+  if ((len == 2) && (name[0] == '.') && (name[1] == '.'))
+    return true;
+  if (len != 4)
+    return false;
+  return (name[0] == '.') && (name[1] == 's') && (name[2] == 'v') && (name[3] == 'n');
+}
+
+template <typename Ch>
+FileType ClassifyFile(const Ch* name, size_t len) {
+  size_t of = len - 1;
+  if ((len > 2) && (name[of] == 'h') && (name[of-1] == '.'))
+    return kCpp;   // .h
+  if ((len > 2) && (name[of] == 'c') && (name[of-1] == '.'))
+    return kCpp;   // .c
+  if ((len > 3) && (name[of] == 'c') && (name[of-1] == 'c') && (name[of-2] == '.'))
+    return kCpp;   // .cc
+  if ((len > 3) && (name[of] == 'm') && (name[of-1] == 'm') && (name[of-2] == '.'))
+    return kCpp;   // .mm
+  if ((len > 4) && (name[of] == 'p') && (name[of-1] == 'p') && (name[of-2] == 'c') && (name[of-3] == '.'))
+    return kCpp;   // .cpp
+  if ((len > 4) && (name[of] == 'l') && (name[of-1] == 'd') && (name[of-2] == 'i') && (name[of-3] == '.'))
+    return kCpp;   // .idl
+  if ((len > 4) && (name[of] == 'p') && (name[of-1] == 'y') && (name[of-2] == 'g') && (name[of-3] == '.'))
+    return kGyp;   // .gyp
+  if ((len > 5) && (name[of] == 'i') && (name[of-1] == 'p') && (name[of-2] == 'y') && (name[of-3] == 'g') && (name[of-4] == '.'))
+    return kGyp;   // .gypi
+
+  return kUnknown;
+}
+
+// Bigger files are not read whole for the content index, their tokens are
+// streamed and they are left out of text searches.
+const size_t kMaxContentFile = 16 * 1024 * 1024;
+
+// The platform independent part of the engine. It owns the directory and file
+// tables and answers the queries. The platform engines derive from it and fill
+// |dirs_| and |files_| in their Index() method. All of it can be saved to and
+// mapped back from a snapshot.
+class V1CodeSearch : public CodeSearch {
+public:
+  V1CodeSearch();
+  virtual int IndexContent(Client* client) override;
+  virtual int Save(const wchar_t* path) override;
+  virtual int Load(const wchar_t* path, const wchar_t* root_dir) override;
+  virtual std::vector<std::wstring> Search(const wchar_t* txt, Options options) override;
+  virtual std::vector<std::wstring> Continue() override;
+  virtual std::vector<std::wstring> Search(const wchar_t* txt, Options options,
+                                           const Control& control, Status* status) override;
+  virtual std::vector<std::wstring> Continue(const Control& control, Status* status) override;
+  virtual Session* NewSession() override;
+  virtual std::vector<std::wstring> Search(Session* session, const wchar_t* txt, Options options,
+                                           const Control& control, Status* status) override;
+  virtual std::vector<std::wstring> Continue(Session* session, const Control& control,
+                                             Status* status) override;
+  virtual Status SearchIds(Session* session, const wchar_t* txt, Options options,
+                           const Control& control, std::vector<FileId>* ids) override;
+  virtual Status ContinueIds(Session* session, const Control& control,
+                             std::vector<FileId>* ids) override;
+  virtual size_t GetPath(FileId id, wchar_t* buf, size_t size) override;
+  virtual size_t GetPathUtf8(FileId id, char* buf, size_t size) override;
+  virtual std::vector<std::wstring> SearchContent(const wchar_t* token, bool* partial) override;
+  virtual int SearchText(const wchar_t* pattern, unsigned int flags, size_t max_hits,
+                         std::vector<TextHit>* hits, bool* partial, std::string* error) override;
+  virtual int GetMetrics(Metrics* metrics) override;
+
+protected:
+  struct Stats {
+    size_t dirs_discarded;
+    size_t files_discarded;
+    size_t hidden_discarded;
+    size_t time_taken_secs;
+    Stats()
+      : dirs_discarded(0), files_discarded(0), hidden_discarded(0), time_taken_secs(0) {
+    }
+  };
+
+  // All need |lock_|. The tables hold UTF-8, see DirTable and FileTable.
+  std::string FilePath(size_t file_ix) const;
+  const std::string& DirPath(size_t dir_ix) const;
+  const std::wstring& WideDirPath(size_t dir_ix) const;
+  // The path decoded for the API. |out| needs room for as many characters as
+  // the path has bytes, the return is how many it took.
+  size_t WideFilePath(size_t file_ix, wchar_t* out) const;
+  std::wstring WideFilePath(size_t file_ix) const;
+
+  // Builds the search structures over the finished tables. The platform
+  // engines call it at the end of Index().
+  void BuildSearchIndexes();
+
+  // Changes to the tables after Index() or Load(), for the platform engines
+  // that watch the tree. The search indexes keep covering the files they were
+  // built over; files added later are checked one by one and removed ones are
+  // skipped, so a change costs the same whatever the size of the tree. The
+  // space of removed files is reclaimed by the next Index(). Call StartEdits()
+  // once first. All of them need |lock_|.
+  void StartEdits();
+  size_t FindDir(size_t parent_ix, const char* name, size_t len) const;
+  bool DirAlive(size_t dir_ix) const { return lookup_.Alive(dir_ix); }
+  // Returns the index of the directory called |name| inside |parent_ix|,
+  // adding it if it is not there.
+  size_t AddDir(size_t parent_ix, const char* name, size_t len);
+  // Removes the directory and everything below it. The directories go to
+  // |removed_dirs|.
+  void RemoveDir(size_t dir_ix, std::vector<uint32_t>* removed_dirs);
+  size_t FindFile(size_t dir_ix, const char* name, size_t len) const;
+  void AddFile(size_t dir_ix, const char* name, size_t len, uint64_t size);
+  void RemoveFile(size_t file_ix);
+
+  bool Removed(size_t file_ix) const {
+    return (file_ix < removed_.size()) && removed_[file_ix];
+  }
+
+  // Loads all of the file at |path|, in UTF-8, for the content index. Returns
+  // false if it can't or the file is over kMaxContentFile. Called on several
+  // threads at once.
+  virtual bool ReadContent(const std::string& path, std::vector<char>* buf) = 0;
+  struct ContentFile {
+    std::string path;
+    std::vector<char> data;
+    bool ok;
+  };
+  // The same for |count| files at once, for the platforms that can batch the
+  // system calls. Calls ReadContent() for each by default.
+  virtual void ReadContentBatch(ContentFile* files, size_t count);
+  // Stops the content index build, if any, and waits for it. The platform
+  // engines call it first thing in their destructor, ReadContent() can't be
+  // called once they are gone.
+  void StopContent();
+
+  DirTable dirs_;
+  FileTable files_;
+  TrigramIndex trigrams_;
+  PrefixIndex by_name_;
+  // FuzzyQuery::CharMask() of every name.
+  PodArray<uint64_t> name_masks_;
+  // How many files |trigrams_| and |by_name_| cover.
+  size_t indexed_files_;
+  // Non zero for the files removed since. Can be shorter than |files_|.
+  PodArray<uint8_t> removed_;
+  DirLookup lookup_;
+
+  ContentIndex content_;
+  ContentTrigrams content_trigrams_;
+
+  Stats stats_;
+
+  // What GetMetrics() adds up, see Metrics.
+  enum Counter {
+    kReadNs,
+    kTokenizeNs,
+    kAddNs,
+    kFilesRead,
+    kFilesStreamed,
+    kBytesRead,
+    kReadSyscalls,
+    kCounters
+  };
+  Counters<kCounters> counters_;
+  // The platform engines set these at the end of Index().
+  std::atomic<uint64_t> index_ns_;
+  std::atomic<uint64_t> crawl_syscalls_;
+
+  // What the tables borrow from after a Load().
+  scoped_ptr<MappedFile> snapshot_;
+
+  // Taken by queries and by edits to the tables. Queries of different
+  // sessions take turns, each is a few milliseconds at most and the fuzzy
+  // ranking already runs on every core.
+  std::mutex lock_;
+
+private:
+  class StopCheck;
+  class QuerySession;
+  struct ContentPipeline;
+
+  // The stages of the content index build, see ContentProgress.
+  void ContentLoop(Client* client);
+  void CrawlContent(ContentPipeline* pipeline);
+  void ReadContentLoop(ContentPipeline* pipeline);
+  void IndexContentLoop(ContentPipeline* pipeline);
+
+  std::thread content_thread_;
+  std::atomic<bool> content_stop_;
+  // The whole build and its last phase, so far.
+  std::atomic<uint64_t> content_ns_;
+  std::atomic<uint64_t> finish_ns_;
+  Gauge read_queue_;
+  Gauge index_queue_;
+
+  LatencyHistogram search_latency_;
+  LatencyHistogram continue_latency_;
+
+  // The last path DirPath() put together. The files of a directory come
+  // together, in the tables and in the matches, so it is mostly the one the
+  // next file needs. Under |lock_|.
+  mutable size_t dir_path_ix_;
+  mutable std::string dir_path_;
+  // The same, decoded for the wide paths of the CodeSearch calls.
+  mutable size_t wide_dir_path_ix_;
+  mutable std::wstring wide_dir_path_;
+  // Where GetPath() decodes a path. Under |lock_|.
+  std::vector<wchar_t> path_chars_;
+
+  // Where a query is, for the next Continue(). The engine has one for the
+  // calls without a session, each session has its own.
+  struct QueryState {
+    // BeginsWith state. The matches are the positions [range_begin,
+    // range_end) of |by_name_|, |cursor| is the next one to return, and then
+    // the files added since the index was built, from |tail_pos| on.
+    size_t range_begin;
+    size_t range_end;
+    size_t cursor;
+    size_t tail_pos;
+
+    // Substring state. |matched| has every match returned so far, in file
+    // order. The files still to check are |pending| from |pending_pos| on and
+    // then every file from |scan_pos| on. When the next query contains this
+    // one, those two sets are all it has to look at.
+    std::vector<uint32_t> matched;
+    std::vector<uint32_t> pending;
+    size_t pending_pos;
+    size_t scan_pos;
+
+    // Fuzzy state. The best files, best first, and the next one to return.
+    std::vector<uint32_t> ranked;
+    size_t ranked_pos;
+
+    // A path qualified query, like net/http, is split at the last separator:
+    // |search_term| is the name part, |dir_term| the rest with the separator
+    // and |in_dirs| marks the directories that it names.
+    std::string dir_term;
+    std::vector<uint8_t> in_dirs;
+
+    // In UTF-8 like the names, so matching compares bytes.
+    std::string search_term;
+    Options current_options;
+
+    QueryState()
+      : range_begin(0), range_end(0), cursor(0), tail_pos(0), pending_pos(0), scan_pos(0),
+        ranked_pos(0), current_options(CodeSearch::None) {
+    }
+  };
+
+  QueryState* StateOf(Session* session);
+  // Sets |matches| to the next batch of files of the query.
+  Status SearchImpl(QueryState* query, const wchar_t* txt, bool reset, Options options,
+                    const Control* control, std::vector<uint32_t>* matches);
+  // The paths of the files of a batch, for the calls that return paths.
+  std::vector<std::wstring> Paths(const std::vector<uint32_t>& files);
+  void MatchDirs(QueryState* query);
+  void ExtendDirs(QueryState* query);
+  bool InDirs(QueryState* query, size_t file) {
+    if (query->dir_term.empty())
+      return true;
+    size_t dir_ix = files_.dir_ix(file);
+    if (dir_ix >= query->in_dirs.size())
+      ExtendDirs(query);
+    return query->in_dirs[dir_ix] != 0;
+  }
+  void StartBeginsWith(QueryState* query, const char* txt, size_t len);
+  void StartSubstring(QueryState* query, const char* txt, size_t len);
+  Status WalkPrefixRange(QueryState* query, const char* txt, size_t len, StopCheck* stop,
+                         std::vector<uint32_t>* matches);
+  Status FindSubstrings(QueryState* query, const char* txt, size_t len, StopCheck* stop,
+                        std::vector<uint32_t>* matches);
+  Status RankFuzzy(QueryState* query, const char* txt, size_t len, StopCheck* stop);
+  Status WalkRanked(QueryState* query, std::vector<uint32_t>* matches);
+
+  QueryState query_;
+};
@@ -0,0 +1,465 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "engine_v1.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#include "dir_crawler_posix.h"
+#include "dir_watcher_posix.h"
+#include "file_reader_posix.h"
+#include "utf8.h"
+
+namespace {
+  // How often the crawl progress is reported to the client.
+  const unsigned int kProgressMs = 50;
+  // How often the tree is polled when it can't be watched.
+  const int kPollMs = 2000;
+
+  // The mtime of a directory, or -1.
+  long long DirStamp(const char* path) {
+    struct stat st;
+    if (::stat(path, &st) != 0)
+      return -1;
+    return static_cast<long long>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  }
+
+  unsigned long long TickCountMs() {
+    timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<unsigned long long>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+  }
+}
+
+class V1CodeSearchPosix : public V1CodeSearch {
+public:
+  // Zero |num_threads| means one crawler thread per core.
+  explicit V1CodeSearchPosix(size_t num_threads) : num_threads_(num_threads), polling_(false) {}
+  virtual ~V1CodeSearchPosix();
+  virtual int Index(const wchar_t* root_dir, Client* client) override;
+  virtual int Watch() override;
+
+protected:
+  virtual bool ReadContent(const std::string& path, std::vector<char>* buf) override;
+  virtual void ReadContentBatch(ContentFile* files, size_t count) override;
+
+private:
+  void MergeCrawl(const std::string& root_dir, const DirCrawler& crawler);
+
+  void WatchLoop();
+  std::string NativeDirPath(size_t dir_ix) const;
+  std::vector<uint32_t> LiveDirs() const;
+  // Adds watches to the directories from |first_dir| on. Falls back to
+  // polling if the system runs out of watches.
+  void WatchDirs(size_t first_dir);
+  void StartPolling();
+  void OnEvent(const DirWatcher::Event& event);
+  // Crawls the directory |name| inside |parent_ix| and adds all of it.
+  void AddTree(size_t parent_ix, const std::string& name);
+  void RemoveTree(size_t dir_ix);
+  // Lists |dir_ix| again and applies the difference with the tables.
+  void RescanDir(size_t dir_ix);
+
+  size_t num_threads_;
+
+  DirWatcher watcher_;
+  std::thread watch_thread_;
+  // The inotify watch of each directory, by watch id.
+  std::unordered_map<int, uint32_t> watched_dirs_;
+  std::vector<int> dir_watches_;
+  // Without inotify every directory is stat()ed every kPollMs and the ones
+  // with a new mtime are listed again. These are the mtimes of the last pass.
+  bool polling_;
+  std::vector<long long> dir_stamps_;
+
+  // Idle readers, each content reader thread takes one for a batch. They
+  // keep their io_uring from one batch and one build to the next.
+  std::mutex readers_lock_;
+  std::vector<FileReader*> readers_;
+};
+
+CodeSearch* CodeSearchFactory(const char* name) {
+  if (!name || (0 == strcmp(name, "posix"))) return new V1CodeSearchPosix(0);
+  return NULL;
+}
+
+V1CodeSearchPosix::~V1CodeSearchPosix() {
+  StopContent();
+  watcher_.Stop();
+  if (watch_thread_.joinable())
+    watch_thread_.join();
+  for (size_t ix = 0; ix != readers_.size(); ++ix) {
+    delete readers_[ix];
+  }
+}
+
+int V1CodeSearchPosix::Index(const wchar_t* root_dir, Client* client) {
+  unsigned long long time_start = TickCountMs();
+  ElapsedTimer timer;
+
+  // The crawler and the tables both take the UTF-8 names as they are.
+  std::string root(WideToUtf8(root_dir, wcslen(root_dir)));
+  DirCrawler crawler(num_threads_);
+  if (crawler.Start(root.c_str()) != 0)
+    return -1;
+
+  while (!crawler.Wait(kProgressMs)) {
+    if (client) {
+      client->OnIndexProgress(this, crawler.files_found(), crawler.dirs_found());
+    }
+  }
+
+  MergeCrawl(root, crawler);
+  BuildSearchIndexes();
+  if (client) {
+    client->OnIndexProgress(this, files_.size(), dirs_.size());
+  }
+
+  unsigned long long time_taken = TickCountMs() - time_start;
+  stats_.time_taken_secs = static_cast<size_t>(time_taken / 1000);
+  index_ns_ = timer.ns();
+  return 0;
+}
+
+// Lays the per-worker tables one after another. Worker 0 goes first so the
+// root stays at dirs_[0] like in the windows engine. A directory stolen by
+// another worker can be recorded before its parent; the DirTable wants the
+// parent first, so such a directory waits for it.
+void V1CodeSearchPosix::MergeCrawl(const std::string& root_dir, const DirCrawler& crawler) {
+  const uint32_t kNotAdded = static_cast<uint32_t>(-1);
+  std::vector<std::vector<uint32_t> > dir_map(crawler.num_workers());
+  for (size_t wix = 0; wix != crawler.num_workers(); ++wix) {
+    dir_map[wix].assign(crawler.results(wix).dirs.size(), kNotAdded);
+  }
+  dirs_.Reserve(crawler.dirs_found(), 0);
+
+  uint64_t crawl_syscalls = 0;
+  // The directories still to add, each one's parent after it.
+  std::vector<std::pair<uint32_t, uint32_t> > chain;
+  for (size_t wix = 0; wix != crawler.num_workers(); ++wix) {
+    const DirCrawler::Results& res = crawler.results(wix);
+    for (size_t ix = 0; ix != res.dirs.size(); ++ix) {
+      uint32_t worker = static_cast<uint32_t>(wix);
+      uint32_t dir_ix = static_cast<uint32_t>(ix);
+      while (dir_map[worker][dir_ix] == kNotAdded) {
+        chain.push_back(std::make_pair(worker, dir_ix));
+        const DirCrawler::Dir& dir = crawler.results(worker).dirs[dir_ix];
+        if (dir.parent_worker == DirCrawler::kNoParent)
+          break;
+        worker = dir.parent_worker;
+        dir_ix = dir.parent_ix;
+      }
+      while (!chain.empty()) {
+        const DirCrawler::Dir& dir = crawler.results(chain.back().first).dirs[chain.back().second];
+        size_t added;
+        if (dir.parent_worker == DirCrawler::kNoParent) {
+          added = dirs_.Add(DirTable::kNoParent, root_dir.c_str(), root_dir.size());
+        } else {
+          added = dirs_.Add(dir_map[dir.parent_worker][dir.parent_ix], dir.name.c_str(),
+                            dir.name.size());
+        }
+        dir_map[chain.back().first][chain.back().second] = static_cast<uint32_t>(added);
+        chain.pop_back();
+      }
+    }
+    stats_.dirs_discarded += res.dirs_discarded;
+    stats_.files_discarded += res.files_discarded;
+    stats_.hidden_discarded += res.hidden_discarded;
+    crawl_syscalls += res.syscalls;
+  }
+
+  files_.Reserve(crawler.files_found(), crawler.files_found() * 16);
+  for (size_t wix = 0; wix != crawler.num_workers(); ++wix) {
+    const DirCrawler::Results& res = crawler.results(wix);
+    for (size_t ix = 0; ix != res.files.size(); ++ix) {
+      const DirCrawler::File& file = res.files[ix];
+      // The crawler does not stat regular files, the size is not known.
+      files_.Add(file.name.c_str(), file.name.size(), dir_map[wix][file.dir_ix], 0);
+    }
+  }
+  crawl_syscalls_ = crawl_syscalls;
+}
+
+bool V1CodeSearchPosix::ReadContent(const std::string& path, std::vector<char>* buf) {
+  return FileReader::ReadOne(path.c_str(), buf);
+}
+
+void V1CodeSearchPosix::ReadContentBatch(ContentFile* files, size_t count) {
+  FileReader* reader = NULL;
+  {
+    std::lock_guard<std::mutex> lock(readers_lock_);
+    if (!readers_.empty()) {
+      reader = readers_.back();
+      readers_.pop_back();
+    }
+  }
+  if (!reader)
+    reader = new FileReader;
+
+  std::vector<FileReader::Request> requests(count);
+  for (size_t ix = 0; ix != count; ++ix) {
+    FileReader::Request request = { files[ix].path.c_str(), &files[ix].data, false };
+    requests[ix] = request;
+  }
+  size_t syscalls = reader->syscalls();
+  reader->Read(&requests[0], count);
+  counters_.Add(kReadSyscalls, reader->syscalls() - syscalls);
+  for (size_t ix = 0; ix != count; ++ix) {
+    files[ix].ok = requests[ix].ok;
+  }
+
+  std::lock_guard<std::mutex> lock(readers_lock_);
+  readers_.push_back(reader);
+}
+
+int V1CodeSearchPosix::Watch() {
+  if (watch_thread_.joinable())
+    return 0;
+  if (dirs_.empty() || !watcher_.Init())
+    return -1;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    StartEdits();
+  }
+  watch_thread_ = std::thread(&V1CodeSearchPosix::WatchLoop, this);
+  return 0;
+}
+
+// Only this thread changes the tables, so it reads them without the lock and
+// takes it just to write.
+void V1CodeSearchPosix::WatchLoop() {
+  if (watcher_.watching())
+    WatchDirs(0);
+  else
+    StartPolling();
+
+  std::vector<DirWatcher::Event> events;
+  while (watcher_.Wait(polling_ ? kPollMs : -1, &events)) {
+    if (polling_) {
+      std::vector<uint32_t> dirs(LiveDirs());
+      for (size_t ix = 0; ix != dirs.size(); ++ix) {
+        long long stamp = DirStamp(NativeDirPath(dirs[ix]).c_str());
+        if (stamp != dir_stamps_[dirs[ix]]) {
+          dir_stamps_[dirs[ix]] = stamp;
+          RescanDir(dirs[ix]);
+        }
+      }
+      continue;
+    }
+    for (size_t ix = 0; (ix != events.size()) && !polling_; ++ix) {
+      OnEvent(events[ix]);
+    }
+    events.clear();
+  }
+}
+
+std::string V1CodeSearchPosix::NativeDirPath(size_t dir_ix) const {
+  return dirs_.Path(dir_ix);
+}
+
+// Walks down from the root, removed directories are not reachable.
+std::vector<uint32_t> V1CodeSearchPosix::LiveDirs() const {
+  std::vector<uint32_t> dirs(1, 0);
+  for (size_t ix = 0; ix != dirs.size(); ++ix) {
+    const std::vector<uint32_t>& subdirs = lookup_.subdirs(dirs[ix]);
+    dirs.insert(dirs.end(), subdirs.begin(), subdirs.end());
+  }
+  return dirs;
+}
+
+void V1CodeSearchPosix::WatchDirs(size_t first_dir) {
+  dir_watches_.resize(dirs_.size(), -1);
+  for (size_t dx = first_dir; dx != dirs_.size(); ++dx) {
+    if ((dir_watches_[dx] != -1) || !DirAlive(dx))
+      continue;
+    int watch = watcher_.Add(NativeDirPath(dx).c_str());
+    if (watch != -1) {
+      dir_watches_[dx] = watch;
+      watched_dirs_[watch] = static_cast<uint32_t>(dx);
+    } else if (errno == ENOSPC) {
+      StartPolling();
+      return;
+    }
+  }
+}
+
+// Changes made while switching over would be lost, so everything is listed
+// again once. From then on only directories with a new mtime are.
+void V1CodeSearchPosix::StartPolling() {
+  watcher_.StopWatching();
+  watched_dirs_.clear();
+  dir_watches_.clear();
+  polling_ = true;
+
+  std::vector<uint32_t> dirs(LiveDirs());
+  dir_stamps_.assign(dirs_.size(), -1);
+  for (size_t ix = 0; ix != dirs.size(); ++ix) {
+    dir_stamps_[dirs[ix]] = DirStamp(NativeDirPath(dirs[ix]).c_str());
+  }
+  for (size_t ix = 0; ix != dirs.size(); ++ix) {
+    RescanDir(dirs[ix]);
+  }
+}
+
+void V1CodeSearchPosix::OnEvent(const DirWatcher::Event& event) {
+  if (event.mask & IN_Q_OVERFLOW) {
+    // Events were dropped, only a full pass can tell what they were.
+    std::vector<uint32_t> dirs(LiveDirs());
+    for (size_t ix = 0; ix != dirs.size(); ++ix) {
+      RescanDir(dirs[ix]);
+    }
+    return;
+  }
+
+  std::unordered_map<int, uint32_t>::iterator it = watched_dirs_.find(event.watch);
+  if (it == watched_dirs_.end())
+    return;
+  const size_t dir_ix = it->second;
+  if (event.mask & IN_IGNORED) {
+    // The directory is gone or was unwatched.
+    dir_watches_[dir_ix] = -1;
+    watched_dirs_.erase(it);
+    return;
+  }
+
+  const std::string& name = event.name;
+  const bool added = (event.mask & (IN_CREATE | IN_MOVED_TO)) != 0;
+  const bool is_dir = (event.mask & IN_ISDIR) != 0;
+  if (name.empty() || (added && !DirCrawler::Keeps(name.c_str(), name.size(), is_dir)))
+    return;
+
+  if (is_dir) {
+    if (added) {
+      AddTree(dir_ix, name);
+      return;
+    }
+    size_t child = FindDir(dir_ix, name.c_str(), name.size());
+    if (child != DirLookup::kNotFound)
+      RemoveTree(child);
+    return;
+  }
+
+  if (added) {
+    // Like the crawler, only regular files and not what symlinks point to.
+    struct stat st;
+    std::string path(NativeDirPath(dir_ix) + "/" + name);
+    if ((::lstat(path.c_str(), &st) != 0) || !S_ISREG(st.st_mode))
+      return;
+    std::lock_guard<std::mutex> lock(lock_);
+    AddFile(dir_ix, name.c_str(), name.size(), 0);
+  } else {
+    std::lock_guard<std::mutex> lock(lock_);
+    size_t file_ix = FindFile(dir_ix, name.c_str(), name.size());
+    if (file_ix != DirLookup::kNotFound)
+      RemoveFile(file_ix);
+  }
+}
+
+// The crawl runs without the lock. With a single worker a directory is always
+// recorded before the ones inside it, and all of them in worker 0.
+void V1CodeSearchPosix::AddTree(size_t parent_ix, const std::string& name) {
+  DirCrawler crawler(1);
+  if (crawler.Start((NativeDirPath(parent_ix) + "/" + name).c_str()) != 0)
+    return;
+  while (!crawler.Wait(kProgressMs)) {
+  }
+
+  const size_t first_new = dirs_.size();
+  const DirCrawler::Results& res = crawler.results(0);
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    std::vector<size_t> dir_map(res.dirs.size());
+    for (size_t ix = 0; ix != res.dirs.size(); ++ix) {
+      const DirCrawler::Dir& dir = res.dirs[ix];
+      const bool top = (dir.parent_ix == DirCrawler::kNoParent);
+      const std::string& last = top ? name : dir.name;
+      dir_map[ix] = AddDir(top ? parent_ix : dir_map[dir.parent_ix], last.c_str(), last.size());
+    }
+    for (size_t ix = 0; ix != res.files.size(); ++ix) {
+      const DirCrawler::File& file = res.files[ix];
+      AddFile(dir_map[file.dir_ix], file.name.c_str(), file.name.size(), 0);
+    }
+  }
+
+  if (polling_) {
+    dir_stamps_.resize(dirs_.size(), -1);
+    for (size_t dx = first_new; dx != dirs_.size(); ++dx) {
+      dir_stamps_[dx] = DirStamp(NativeDirPath(dx).c_str());
+    }
+    return;
+  }
+
+  // What was created in the new directories after the crawl went through
+  // them and before they had watches shows up in a second listing.
+  const size_t last_new = dirs_.size();
+  WatchDirs(first_new);
+  for (size_t dx = first_new; (dx != last_new) && !polling_; ++dx) {
+    RescanDir(dx);
+  }
+}
+
+void V1CodeSearchPosix::RemoveTree(size_t dir_ix) {
+  std::vector<uint32_t> removed;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    RemoveDir(dir_ix, &removed);
+  }
+  // A directory moved out of the tree keeps its watches otherwise.
+  for (size_t ix = 0; ix != removed.size(); ++ix) {
+    if ((removed[ix] < dir_watches_.size()) && (dir_watches_[removed[ix]] != -1)) {
+      watched_dirs_.erase(dir_watches_[removed[ix]]);
+      watcher_.Remove(dir_watches_[removed[ix]]);
+      dir_watches_[removed[ix]] = -1;
+    }
+  }
+}
+
+void V1CodeSearchPosix::RescanDir(size_t dir_ix) {
+  if (!DirAlive(dir_ix))
+    return;
+
+  std::vector<std::string> dirs;
+  std::vector<std::string> files;
+  if (!DirCrawler::ListDir(NativeDirPath(dir_ix).c_str(), &dirs, &files)) {
+    // Its parent's listing takes care of it, unless it is the root.
+    return;
+  }
+
+  std::unordered_set<std::string> on_disk(files.begin(), files.end());
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    std::vector<uint32_t> known(lookup_.files(dir_ix));
+    for (size_t ix = 0; ix != known.size(); ++ix) {
+      std::string name(files_.name(known[ix]), files_.name_len(known[ix]));
+      if (!on_disk.erase(name))
+        RemoveFile(known[ix]);
+    }
+    for (std::unordered_set<std::string>::const_iterator it = on_disk.begin();
+         it != on_disk.end(); ++it) {
+      AddFile(dir_ix, it->c_str(), it->size(), 0);
+    }
+  }
+
+  std::unordered_set<std::string> dirs_on_disk(dirs.begin(), dirs.end());
+  std::vector<uint32_t> known(lookup_.subdirs(dir_ix));
+  for (size_t ix = 0; ix != known.size(); ++ix) {
+    std::string name(dirs_.name(known[ix]), dirs_.name_len(known[ix]));
+    if (!dirs_on_disk.erase(name))
+      RemoveTree(known[ix]);
+  }
+  for (std::unordered_set<std::string>::const_iterator it = dirs_on_disk.begin();
+       it != dirs_on_disk.end(); ++it) {
+    AddTree(dir_ix, *it);
+  }
+}
@@ -0,0 +1,316 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "file_reader_posix.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define KF_IO_URING 1
+#endif
+
+#include "engine_v1.h"
+
+namespace {
+  bool ContentSize(long long size) {
+    return (size > 0) && (static_cast<uint64_t>(size) <= kMaxContentFile);
+  }
+}
+
+FileReader::FileReader()
+    : ring_fd_(-1), sq_ring_(NULL), sq_ring_size_(0), cq_ring_(NULL), cq_ring_size_(0),
+      sqes_(NULL), sqes_size_(0), sq_tail_(NULL), sq_mask_(NULL),
+      sq_array_(NULL), cq_head_(NULL), cq_tail_(NULL), cq_mask_(NULL), cqes_(NULL),
+      to_submit_(0), syscalls_(0) {
+  if (!SetUpRing())
+    TearDownRing();
+}
+
+FileReader::~FileReader() {
+  TearDownRing();
+}
+
+void FileReader::TearDownRing() {
+  if (sqes_)
+    ::munmap(sqes_, sqes_size_);
+  if (cq_ring_ && (cq_ring_ != sq_ring_))
+    ::munmap(cq_ring_, cq_ring_size_);
+  if (sq_ring_)
+    ::munmap(sq_ring_, sq_ring_size_);
+  if (ring_fd_ != -1)
+    ::close(ring_fd_);
+  ring_fd_ = -1;
+  sq_ring_ = NULL;
+  cq_ring_ = NULL;
+  sqes_ = NULL;
+}
+
+bool FileReader::ReadOne(const char* path, std::vector<char>* data) {
+  int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+  struct stat st;
+  bool ok = (::fstat(fd, &st) == 0) && S_ISREG(st.st_mode) && ContentSize(st.st_size);
+  if (ok) {
+    data->resize(static_cast<size_t>(st.st_size));
+    size_t done = 0;
+    while (done != data->size()) {
+      ssize_t rv = ::pread(fd, &(*data)[done], data->size() - done, done);
+      if (rv < 0 && errno == EINTR)
+        continue;
+      if (rv <= 0)
+        break;
+      done += static_cast<size_t>(rv);
+    }
+    // The file can shrink under us.
+    data->resize(done);
+    ok = done != 0;
+  }
+  ::close(fd);
+  return ok;
+}
+
+void FileReader::Read(Request* requests, size_t count) {
+  while (count) {
+    size_t batch = std::min(count, kMaxBatch);
+    if (uring()) {
+      ReadRing(requests, batch);
+    } else {
+      for (size_t ix = 0; ix != batch; ++ix) {
+        requests[ix].ok = ReadOne(requests[ix].path, requests[ix].data);
+      }
+      syscalls_ += 4 * batch;
+    }
+    requests += batch;
+    count -= batch;
+  }
+}
+
+#if defined(KF_IO_URING)
+
+bool FileReader::SetUpRing() {
+  // Old kernels and most container sandboxes say no here.
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring_fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, 2 * kMaxBatch, &params));
+  if (ring_fd_ < 0) {
+    ring_fd_ = -1;
+    return false;
+  }
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap)
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+
+  void* map = ::mmap(NULL, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     ring_fd_, IORING_OFF_SQ_RING);
+  if (map == MAP_FAILED)
+    return false;
+  sq_ring_ = map;
+  if (single_mmap) {
+    cq_ring_ = sq_ring_;
+  } else {
+    map = ::mmap(NULL, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 ring_fd_, IORING_OFF_CQ_RING);
+    if (map == MAP_FAILED)
+      return false;
+    cq_ring_ = map;
+  }
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  map = ::mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+               ring_fd_, IORING_OFF_SQES);
+  if (map == MAP_FAILED)
+    return false;
+  sqes_ = static_cast<io_uring_sqe*>(map);
+
+  char* sq = static_cast<char*>(sq_ring_);
+  sq_tail_ = reinterpret_cast<unsigned int*>(sq + params.sq_off.tail);
+  sq_mask_ = reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned int*>(sq + params.sq_off.array);
+  char* cq = static_cast<char*>(cq_ring_);
+  cq_head_ = reinterpret_cast<unsigned int*>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned int*>(cq + params.cq_off.tail);
+  cq_mask_ = reinterpret_cast<unsigned int*>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+  // The ring itself is 5.1, opening, statx() and plain reads came later.
+  const unsigned int kOps = 256;
+  std::vector<char> probe_buf(sizeof(io_uring_probe) + kOps * sizeof(io_uring_probe_op));
+  io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(&probe_buf[0]);
+  if (::syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PROBE, probe, kOps) < 0)
+    return false;
+  const int kNeeded[] = { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE };
+  for (size_t ix = 0; ix != sizeof(kNeeded) / sizeof(kNeeded[0]); ++ix) {
+    if ((kNeeded[ix] > probe->last_op) || !(probe->ops[kNeeded[ix]].flags & IO_URING_OP_SUPPORTED))
+      return false;
+  }
+  return true;
+}
+
+io_uring_sqe* FileReader::NextSqe() {
+  // Only this thread adds entries and every submit waits for the kernel to
+  // take them, so the tail is ours to read plainly.
+  unsigned int index = (*sq_tail_ + to_submit_) & *sq_mask_;
+  sq_array_[index] = index;
+  ++to_submit_;
+  io_uring_sqe* sqe = &sqes_[index];
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+template <typename Fn>
+bool FileReader::SubmitAndWait(unsigned int count, Fn fn) {
+  __atomic_store_n(sq_tail_, *sq_tail_ + to_submit_, __ATOMIC_RELEASE);
+  unsigned int submit = to_submit_;
+  to_submit_ = 0;
+
+  unsigned int seen = 0;
+  while (seen != count) {
+    long rv = ::syscall(__NR_io_uring_enter, ring_fd_, submit, count - seen,
+                        IORING_ENTER_GETEVENTS, NULL, 0);
+    ++syscalls_;
+    if (rv < 0) {
+      if ((errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY))
+        return false;
+    } else {
+      submit -= std::min(submit, static_cast<unsigned int>(rv));
+    }
+
+    unsigned int head = *cq_head_;
+    unsigned int tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head, ++seen) {
+      const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+      fn(cqe.user_data, cqe.res);
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  }
+  return true;
+}
+
+void FileReader::ReadRing(Request* requests, size_t count) {
+  int fds[kMaxBatch];
+  int stat_res[kMaxBatch];
+  struct statx stats[kMaxBatch];
+
+  // The opens and the statx() calls all go at once, both by path. Entry
+  // |ix| * 2 is the open of request |ix|, the one after is its statx().
+  for (size_t ix = 0; ix != count; ++ix) {
+    requests[ix].ok = false;
+    fds[ix] = -1;
+    stat_res[ix] = -1;
+    io_uring_sqe* sqe = NextSqe();
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<uintptr_t>(requests[ix].path);
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    sqe->user_data = ix * 2;
+    sqe = NextSqe();
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<uintptr_t>(requests[ix].path);
+    sqe->len = STATX_TYPE | STATX_SIZE;
+    sqe->off = reinterpret_cast<uintptr_t>(&stats[ix]);
+    sqe->user_data = ix * 2 + 1;
+  }
+  bool ok = SubmitAndWait(static_cast<unsigned int>(count * 2), [&](uint64_t user_data, int res) {
+    if (user_data & 1)
+      stat_res[user_data / 2] = res;
+    else
+      fds[user_data / 2] = res;
+  });
+  if (!ok) {
+    for (size_t ix = 0; ix != count; ++ix) {
+      if (fds[ix] >= 0)
+        ::close(fds[ix]);
+    }
+    TearDownRing();
+    Read(requests, count);
+    return;
+  }
+
+  // Then the reads, each with the close of its file linked after it. A
+  // failed read cancels the close, which is then ours to do.
+  unsigned int entries = 0;
+  for (size_t ix = 0; ix != count; ++ix) {
+    if (fds[ix] < 0)
+      continue;
+    if ((stat_res[ix] == 0) && S_ISREG(stats[ix].stx_mode) &&
+        ContentSize(static_cast<long long>(stats[ix].stx_size))) {
+      std::vector<char>* data = requests[ix].data;
+      data->resize(static_cast<size_t>(stats[ix].stx_size));
+      io_uring_sqe* sqe = NextSqe();
+      sqe->opcode = IORING_OP_READ;
+      sqe->fd = fds[ix];
+      sqe->addr = reinterpret_cast<uintptr_t>(&(*data)[0]);
+      sqe->len = static_cast<unsigned int>(data->size());
+      sqe->flags = IOSQE_IO_LINK;
+      sqe->user_data = ix * 2;
+      ++entries;
+    }
+    io_uring_sqe* sqe = NextSqe();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fds[ix];
+    sqe->user_data = ix * 2 + 1;
+    ++entries;
+  }
+  if (!entries)
+    return;
+
+  bool short_read[kMaxBatch] = { false };
+  ok = SubmitAndWait(entries, [&](uint64_t user_data, int res) {
+    size_t ix = static_cast<size_t>(user_data / 2);
+    if (user_data & 1) {
+      if (res == -ECANCELED)
+        ::close(fds[ix]);
+      fds[ix] = -1;
+      return;
+    }
+    std::vector<char>* data = requests[ix].data;
+    if (res <= 0) {
+      data->clear();
+    } else if (static_cast<size_t>(res) == data->size()) {
+      requests[ix].ok = true;
+    } else {
+      // Rare, the file changed since the statx(). Its descriptor is closed
+      // by now, so it gets read again from the start.
+      short_read[ix] = true;
+    }
+  });
+  if (!ok) {
+    // Whatever files are still open stay so: a descriptor the kernel might
+    // have closed could already belong to some other thread.
+    TearDownRing();
+    Read(requests, count);
+    return;
+  }
+  for (size_t ix = 0; ix != count; ++ix) {
+    if (short_read[ix]) {
+      requests[ix].ok = ReadOne(requests[ix].path, requests[ix].data);
+      syscalls_ += 4;
+    }
+  }
+}
+
+#else
+
+bool FileReader::SetUpRing() {
+  return false;
+}
+
+void FileReader::ReadRing(Request* requests, size_t count) {
+}
+
+#endif
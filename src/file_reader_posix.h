@@ -0,0 +1,80 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stddef.h>
+
+#include <vector>
+
+struct io_uring_cqe;
+struct io_uring_sqe;
+
+// Reads whole files for the content index, many at a time. On Linux kernels
+// with io_uring, a batch costs two system calls however many files are in it:
+// one for the opens and the statx() calls, one for the reads with each file's
+// close linked after its read. Elsewhere, or when io_uring is not allowed, it
+// does open(), fstat(), pread() and close() file by file.
+//
+// A reader is used by one thread at a time.
+class FileReader {
+public:
+  struct Request {
+    const char* path;
+    // Set to all of the file.
+    std::vector<char>* data;
+    // False if the file can't be read, is empty or is over kMaxContentFile.
+    bool ok;
+  };
+
+  // The most requests that go in one Read().
+  static const size_t kMaxBatch = 64;
+
+  FileReader();
+  ~FileReader();
+
+  void Read(Request* requests, size_t count);
+
+  // Whether the batches go through io_uring.
+  bool uring() const { return ring_fd_ != -1; }
+
+  // The system calls Read() made so far. A file read on its own counts as
+  // four, ReadOne() is not counted.
+  size_t syscalls() const { return syscalls_; }
+
+  static bool ReadOne(const char* path, std::vector<char>* data);
+
+private:
+  bool SetUpRing();
+  // Back to reading file by file for good.
+  void TearDownRing();
+  void ReadRing(Request* requests, size_t count);
+  // Queues an entry, the ring has room for two per request.
+  io_uring_sqe* NextSqe();
+  // Submits the queued entries and waits for |count| completions, each
+  // handed to |fn(user_data, res)|.
+  template <typename Fn>
+  bool SubmitAndWait(unsigned int count, Fn fn);
+
+  int ring_fd_;
+  void* sq_ring_;
+  size_t sq_ring_size_;
+  void* cq_ring_;
+  size_t cq_ring_size_;
+  io_uring_sqe* sqes_;
+  size_t sqes_size_;
+
+  // Into |sq_ring_| and |cq_ring_|.
+  unsigned int* sq_tail_;
+  unsigned int* sq_mask_;
+  unsigned int* sq_array_;
+  unsigned int* cq_head_;
+  unsigned int* cq_tail_;
+  unsigned int* cq_mask_;
+  io_uring_cqe* cqes_;
+  // Entries queued since the last submit.
+  unsigned int to_submit_;
+  size_t syscalls_;
+
+  FileReader(const FileReader&);
+  void operator=(const FileReader&);
+};
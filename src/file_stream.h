@@ -0,0 +1,37 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tokenizer.h"
+
+// A file read front to back through the DataStream interface, a piece at a
+// time with plain reads, so it can be bigger than the address space and does
+// not need to be mapped. Also reads the standard input, which can be a pipe.
+class FileDataStream : public DataStream {
+public:
+  FileDataStream();
+  ~FileDataStream();
+
+  // Returns false if |path|, in UTF-8, can't be opened or is not a regular
+  // file.
+  bool Open(const char* path);
+  // Reads what comes in on the standard input. It can't seek.
+  bool OpenStandardInput();
+  void Close();
+
+  virtual size_t Read(Buffer& buffer) override;
+  virtual size_t GetPos() override;
+  virtual size_t SetPos(size_t pos) override;
+
+private:
+  // A file descriptor or a HANDLE.
+  intptr_t file_;
+  bool owned_;
+  size_t pos_;
+
+  FileDataStream(const FileDataStream&);
+  void operator=(const FileDataStream&);
+};
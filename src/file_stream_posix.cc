@@ -0,0 +1,73 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "file_stream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+FileDataStream::FileDataStream() : file_(-1), owned_(false), pos_(0) {
+}
+
+FileDataStream::~FileDataStream() {
+  Close();
+}
+
+bool FileDataStream::Open(const char* path) {
+  Close();
+  // O_NONBLOCK keeps a fifo that happens to be in the tree from blocking the
+  // open, it is not a regular file and gets closed right away.
+  int fd = ::open(path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if ((::fstat(fd, &st) != 0) || !S_ISREG(st.st_mode)) {
+    ::close(fd);
+    return false;
+  }
+  ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  file_ = fd;
+  owned_ = true;
+  return true;
+}
+
+bool FileDataStream::OpenStandardInput() {
+  Close();
+  file_ = STDIN_FILENO;
+  return true;
+}
+
+void FileDataStream::Close() {
+  if (owned_)
+    ::close(static_cast<int>(file_));
+  file_ = -1;
+  owned_ = false;
+  pos_ = 0;
+}
+
+size_t FileDataStream::Read(Buffer& buffer) {
+  if (file_ < 0)
+    return 0;
+  for (;;) {
+    ssize_t rv = ::read(static_cast<int>(file_), buffer.pbuff, buffer.size);
+    if (rv >= 0) {
+      pos_ += static_cast<size_t>(rv);
+      return static_cast<size_t>(rv);
+    }
+    if (errno != EINTR)
+      return 0;
+  }
+}
+
+size_t FileDataStream::GetPos() {
+  return pos_;
+}
+
+size_t FileDataStream::SetPos(size_t pos) {
+  size_t last_pos = pos_;
+  if ((file_ >= 0) && (::lseek(static_cast<int>(file_), static_cast<off_t>(pos), SEEK_SET) >= 0))
+    pos_ = pos;
+  return last_pos;
+}
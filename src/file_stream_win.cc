@@ -0,0 +1,88 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "target_version_win.h"
+#include "file_stream.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+#include "utf8.h"
+
+namespace {
+  HANDLE AsHandle(intptr_t file) {
+    return reinterpret_cast<HANDLE>(file);
+  }
+}
+
+FileDataStream::FileDataStream()
+    : file_(reinterpret_cast<intptr_t>(INVALID_HANDLE_VALUE)), owned_(false), pos_(0) {
+}
+
+FileDataStream::~FileDataStream() {
+  Close();
+}
+
+bool FileDataStream::Open(const char* path) {
+  Close();
+  DWORD share = FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE;
+  std::wstring wide(Utf8ToWide(path, strlen(path)));
+  HANDLE file = ::CreateFileW(wide.c_str(), GENERIC_READ, share, NULL, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  if (::GetFileType(file) != FILE_TYPE_DISK) {
+    ::CloseHandle(file);
+    return false;
+  }
+  file_ = reinterpret_cast<intptr_t>(file);
+  owned_ = true;
+  return true;
+}
+
+bool FileDataStream::OpenStandardInput() {
+  Close();
+  HANDLE input = ::GetStdHandle(STD_INPUT_HANDLE);
+  if ((input == INVALID_HANDLE_VALUE) || !input)
+    return false;
+  file_ = reinterpret_cast<intptr_t>(input);
+  return true;
+}
+
+void FileDataStream::Close() {
+  if (owned_)
+    ::CloseHandle(AsHandle(file_));
+  file_ = reinterpret_cast<intptr_t>(INVALID_HANDLE_VALUE);
+  owned_ = false;
+  pos_ = 0;
+}
+
+size_t FileDataStream::Read(Buffer& buffer) {
+  if (AsHandle(file_) == INVALID_HANDLE_VALUE)
+    return 0;
+  // ReadFile() takes a DWORD, bigger buffers fill over several calls.
+  DWORD want = static_cast<DWORD>(std::min<size_t>(buffer.size, 1u << 30));
+  DWORD read = 0;
+  // A pipe whose writer is gone fails with ERROR_BROKEN_PIPE, the end of it.
+  if (!::ReadFile(AsHandle(file_), buffer.pbuff, want, &read, NULL))
+    return 0;
+  pos_ += read;
+  return read;
+}
+
+size_t FileDataStream::GetPos() {
+  return pos_;
+}
+
+size_t FileDataStream::SetPos(size_t pos) {
+  size_t last_pos = pos_;
+  LARGE_INTEGER li;
+  li.QuadPart = static_cast<LONGLONG>(pos);
+  if ((AsHandle(file_) != INVALID_HANDLE_VALUE) &&
+      (::GetFileType(AsHandle(file_)) == FILE_TYPE_DISK) &&
+      ::SetFilePointerEx(AsHandle(file_), li, NULL, FILE_BEGIN))
+    pos_ = pos;
+  return last_pos;
+}
@@ -0,0 +1,63 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "file_table.h"
+
+#include <algorithm>
+
+#include "index_snapshot.h"
+
+void FileTable::Reserve(size_t files, size_t name_bytes) {
+  names_.reserve(name_bytes);
+  name_offsets_.reserve(files);
+  name_lengths_.reserve(files);
+  dir_ixs_.reserve(files);
+  sizes_.reserve(files);
+}
+
+size_t FileTable::Add(const char* name, size_t len, size_t dir_ix, uint64_t size) {
+  // File system names are at most 255 characters, under 1K bytes of UTF-8, so
+  // 16 bits is plenty. Offsets are 32 bits, which covers an arena of 4G bytes.
+  name_offsets_.push_back(static_cast<uint32_t>(names_.size()));
+  name_lengths_.push_back(static_cast<uint16_t>(len));
+  names_.append(name, len);
+  names_.push_back('\0');
+  dir_ixs_.push_back(static_cast<uint32_t>(dir_ix));
+  sizes_.push_back(size);
+  return name_offsets_.size() - 1;
+}
+
+size_t FileTable::FileAt(size_t arena_pos, size_t first) const {
+  const uint32_t* it =
+      std::upper_bound(name_offsets_.begin() + first, name_offsets_.end(), arena_pos);
+  return (it - name_offsets_.begin()) - 1;
+}
+
+void FileTable::Write(SnapshotWriter* out) const {
+  out->Add(names_);
+  out->Add(name_offsets_);
+  out->Add(name_lengths_);
+  out->Add(dir_ixs_);
+  out->Add(sizes_);
+}
+
+// The names have to lie back to back in the arena, each ending in its '\0',
+// as Add() puts them: FileAt() and the scans over the arena count on it.
+bool FileTable::Map(SnapshotReader* in, size_t dirs) {
+  if (!in->Next(&names_) || !in->Next(&name_offsets_) || !in->Next(&name_lengths_) ||
+      !in->Next(&dir_ixs_) || !in->Next(&sizes_))
+    return false;
+  const size_t count = name_offsets_.size();
+  if ((name_lengths_.size() != count) || (dir_ixs_.size() != count) || (sizes_.size() != count))
+    return false;
+  size_t offset = 0;
+  for (size_t ix = 0; ix != count; ++ix) {
+    if ((name_offsets_[ix] != offset) || (dir_ixs_[ix] >= dirs))
+      return false;
+    offset += name_lengths_[ix];
+    if ((offset >= names_.size()) || (names_[offset] != '\0'))
+      return false;
+    ++offset;
+  }
+  return offset == names_.size();
+}
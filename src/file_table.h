@@ -0,0 +1,62 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pod_array.h"
+
+class SnapshotReader;
+class SnapshotWriter;
+
+// The files of the tree as a structure of arrays. All the names live in one
+// contiguous arena of UTF-8, each followed by a '\0' so they can be handed out
+// as C strings and so a scan over the arena never matches across two names.
+// The other attributes are parallel arrays indexed by the file index. Lengths
+// and offsets are in bytes.
+class FileTable {
+public:
+  FileTable() {}
+
+  void Reserve(size_t files, size_t name_bytes);
+
+  // Returns the index of the new file.
+  size_t Add(const char* name, size_t len, size_t dir_ix, uint64_t size);
+
+  size_t size() const { return name_offsets_.size(); }
+  bool empty() const { return name_offsets_.empty(); }
+
+  const char* name(size_t ix) const { return &names_[name_offsets_[ix]]; }
+  size_t name_len(size_t ix) const { return name_lengths_[ix]; }
+  size_t name_offset(size_t ix) const { return name_offsets_[ix]; }
+  size_t dir_ix(size_t ix) const { return dir_ixs_[ix]; }
+  uint64_t file_size(size_t ix) const { return sizes_[ix]; }
+
+  // The raw name storage, in file order.
+  const char* arena() const { return names_.data(); }
+  size_t arena_size() const { return names_.size(); }
+
+  // Returns the index of the file whose name covers |arena_pos|. The answer is
+  // known to be |first| or later.
+  size_t FileAt(size_t arena_pos, size_t first) const;
+
+  size_t memory_size() const {
+    return names_.memory_size() + name_offsets_.memory_size() + name_lengths_.memory_size() +
+           dir_ixs_.memory_size() + sizes_.memory_size();
+  }
+
+  void Write(SnapshotWriter* out) const;
+  // |dirs| is how many directories the DirTable of the files has.
+  bool Map(SnapshotReader* in, size_t dirs);
+
+private:
+  PodArray<char> names_;
+  PodArray<uint32_t> name_offsets_;
+  PodArray<uint16_t> name_lengths_;
+  PodArray<uint32_t> dir_ixs_;
+  PodArray<uint64_t> sizes_;
+
+  FileTable(const FileTable&);
+  void operator=(const FileTable&);
+};
@@ -0,0 +1,213 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "fuzzy_match.h"
+
+#include <algorithm>
+
+#include "utf8.h"
+
+namespace {
+  // Every matched character.
+  const int kMatch = 16;
+  // Characters that had to come from the directories.
+  const int kDirMatch = 4;
+  // First character of the name, after a separator, or a camelCase hump.
+  const int kBonusStart = 10;
+  const int kBonusSeparator = 8;
+  const int kBonusCamel = 7;
+  // Matched right after the previous query character.
+  const int kBonusConsecutive = 8;
+  // The whole query is in the name, and it starts at its first character.
+  const int kBonusInName = 20;
+  const int kBonusNamePrefix = 12;
+  const int kPenaltyGapStart = 3;
+  const int kPenaltyGapExtend = 1;
+
+  // Longer names are decoded on the heap.
+  const size_t kStackChars = 256;
+
+  // |Ch| is wchar_t, or char for names known to be ASCII.
+  template <typename Ch>
+  inline wchar_t Fold(Ch c) {
+    return ((c >= 'A') && (c <= 'Z')) ? static_cast<wchar_t>(c + ('a' - 'A')) :
+                                        static_cast<wchar_t>(c);
+  }
+
+  template <typename Ch>
+  inline bool IsSeparator(Ch c) {
+    return (c == '_') || (c == '-') || (c == '.') || (c == ' ');
+  }
+
+  template <typename Ch>
+  int BoundaryBonus(const Ch* name, size_t pos) {
+    if (pos == 0)
+      return kBonusStart;
+    Ch prev = name[pos - 1];
+    if (IsSeparator(prev))
+      return kBonusSeparator;
+    if ((prev >= 'a') && (prev <= 'z') && (name[pos] >= 'A') && (name[pos] <= 'Z'))
+      return kBonusCamel;
+    return 0;
+  }
+
+  template <typename Ch>
+  uint64_t MaskOf(const Ch* txt, size_t len) {
+    uint64_t mask = 0;
+    for (size_t ix = 0; ix != len; ++ix) {
+      mask |= 1ull << (Fold(txt[ix]) & 63);
+    }
+    return mask;
+  }
+
+  bool IsAscii(const char* txt, size_t len) {
+    for (size_t ix = 0; ix != len; ++ix) {
+      if (static_cast<unsigned char>(txt[ix]) >= 0x80)
+        return false;
+    }
+    return true;
+  }
+
+  // The characters of a UTF-8 name, on the stack unless it is very long.
+  class WideName {
+  public:
+    WideName(const char* txt, size_t len) : data_(stack_) {
+      if (len > kStackChars) {
+        heap_.resize(len);
+        data_ = &heap_[0];
+      }
+      size_ = Utf8ToWide(txt, len, data_);
+    }
+
+    const wchar_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+  private:
+    wchar_t stack_[kStackChars];
+    std::vector<wchar_t> heap_;
+    wchar_t* data_;
+    size_t size_;
+
+    WideName(const WideName&);
+    void operator=(const WideName&);
+  };
+}
+
+FuzzyQuery::FuzzyQuery(const char* txt, size_t len) {
+  WideName wide(txt, len);
+  query_.reserve(wide.size());
+  for (size_t ix = 0; ix != wide.size(); ++ix) {
+    query_.append(1, Fold(wide.data()[ix]));
+  }
+  tail_masks_.assign(query_.size() + 1, 0);
+  for (size_t ix = query_.size(); ix != 0; --ix) {
+    tail_masks_[ix - 1] = tail_masks_[ix] | MaskOf(wide.data() + ix - 1, 1);
+  }
+}
+
+template <typename Ch>
+size_t FuzzyQuery::PrefixMatchedOf(size_t matched, const Ch* txt, size_t len) const {
+  size_t qx = matched;
+  for (size_t px = 0; (px != len) && (qx != query_.size()); ++px) {
+    if (Fold(txt[px]) == query_[qx])
+      ++qx;
+  }
+  return qx;
+}
+
+template <typename Ch>
+bool FuzzyQuery::ScoreOf(const Ch* name, size_t len, size_t dir_prefix, int* score) const {
+  const size_t n = query_.size();
+
+  // Match from the end of the name backwards to find the longest tail of the
+  // query that fits in it. The directories have to take the rest.
+  size_t first = n;
+  for (size_t px = len; (px != 0) && (first != 0); --px) {
+    if (Fold(name[px - 1]) == query_[first - 1])
+      --first;
+  }
+  if (first > dir_prefix)
+    return false;
+
+  *score = static_cast<int>(first) * kDirMatch - static_cast<int>(len) / 8;
+  if (first == n)
+    return true;
+
+  // Forward, find where the earliest complete match of the tail ends. Then
+  // backwards from there, the latest start. That gives the tightest window.
+  size_t qx = first;
+  size_t end = 0;
+  for (; end != len; ++end) {
+    if ((Fold(name[end]) == query_[qx]) && (++qx == n))
+      break;
+  }
+  size_t start = end;
+  qx = n;
+  for (size_t px = end + 1; px != 0; --px) {
+    if ((Fold(name[px - 1]) == query_[qx - 1]) && (--qx == first)) {
+      start = px - 1;
+      break;
+    }
+  }
+
+  qx = first;
+  bool prev_matched = false;
+  for (size_t px = start; (px <= end) && (qx != n); ++px) {
+    if (Fold(name[px]) == query_[qx]) {
+      *score += kMatch + BoundaryBonus(name, px);
+      if (prev_matched)
+        *score += kBonusConsecutive;
+      prev_matched = true;
+      ++qx;
+    } else {
+      *score -= prev_matched ? kPenaltyGapStart : kPenaltyGapExtend;
+      prev_matched = false;
+    }
+  }
+
+  if (first == 0) {
+    *score += kBonusInName;
+    if (start == 0)
+      *score += kBonusNamePrefix;
+  }
+  return true;
+}
+
+uint64_t FuzzyQuery::CharMask(const char* txt, size_t len) {
+  if (IsAscii(txt, len))
+    return MaskOf(txt, len);
+  WideName wide(txt, len);
+  return MaskOf(wide.data(), wide.size());
+}
+
+size_t FuzzyQuery::PrefixMatched(size_t matched, const char* txt, size_t len) const {
+  if (IsAscii(txt, len))
+    return PrefixMatchedOf(matched, txt, len);
+  WideName wide(txt, len);
+  return PrefixMatchedOf(matched, wide.data(), wide.size());
+}
+
+bool FuzzyQuery::Score(const char* name, size_t len, size_t dir_prefix, int* score) const {
+  if (IsAscii(name, len))
+    return ScoreOf(name, len, dir_prefix, score);
+  WideName wide(name, len);
+  return ScoreOf(wide.data(), wide.size(), dir_prefix, score);
+}
+
+void FuzzyTopK::Add(int score, uint32_t file) {
+  FuzzyHit hit = { score, file };
+  if (heap_.size() < limit_) {
+    heap_.push_back(hit);
+    std::push_heap(heap_.begin(), heap_.end(), BetterHit);
+  } else if (limit_ && BetterHit(hit, heap_.front())) {
+    std::pop_heap(heap_.begin(), heap_.end(), BetterHit);
+    heap_.back() = hit;
+    std::push_heap(heap_.begin(), heap_.end(), BetterHit);
+  }
+}
+
+void FuzzyTopK::Take(std::vector<FuzzyHit>* out) {
+  std::sort(heap_.begin(), heap_.end(), BetterHit);
+  out->swap(heap_);
+  heap_.clear();
+}
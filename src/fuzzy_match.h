@@ -0,0 +1,83 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// Scores a query that has to appear as an in-order subsequence of the path of
+// a file, relative to the root. Matching ignores ASCII case. The name is
+// preferred over the directories: the longest possible tail of the query is
+// taken from the name, the rest has to fit in the directory path. Within the
+// name, characters at word boundaries and runs of consecutive characters score
+// more and gaps score less.
+class FuzzyQuery {
+public:
+  // |txt| and the names below are UTF-8 but the query is matched, and the
+  // lengths and the score counted, in characters. ASCII names, most of them,
+  // are matched as they are and the rest decoded first.
+  FuzzyQuery(const char* txt, size_t len);
+
+  size_t size() const { return query_.size(); }
+
+  // One bit per folded character of |txt|, hashed into 64 bits. The engine
+  // keeps one per file name so most names are rejected without reading them.
+  static uint64_t CharMask(const char* txt, size_t len);
+
+  // False when a name with |name_mask| lacks some character of the part of the
+  // query the directories, which take |dir_prefix| characters, leave to it.
+  bool MayMatch(uint64_t name_mask, size_t dir_prefix) const {
+    uint64_t need = tail_masks_[dir_prefix];
+    return (name_mask & need) == need;
+  }
+
+  // Returns how many characters from the start of the query show up in order
+  // in a path that has |matched| of them and then |txt|. Used once per
+  // directory, on its name.
+  size_t PrefixMatched(size_t matched, const char* txt, size_t len) const;
+
+  // Returns false if a file called |name|, in a directory that can take
+  // |dir_prefix| characters of the query, does not match. Otherwise sets
+  // |score|, which can be negative: a long name only the directories match
+  // still ranks, just below the others.
+  bool Score(const char* name, size_t len, size_t dir_prefix, int* score) const;
+
+private:
+  template <typename Ch>
+  size_t PrefixMatchedOf(size_t matched, const Ch* txt, size_t len) const;
+  template <typename Ch>
+  bool ScoreOf(const Ch* name, size_t len, size_t dir_prefix, int* score) const;
+
+  std::wstring query_;
+  // CharMask() of the query from each position to the end.
+  std::vector<uint64_t> tail_masks_;
+};
+
+struct FuzzyHit {
+  int score;
+  uint32_t file;
+};
+
+// Higher scores first, lower file indexes among equal scores.
+inline bool BetterHit(const FuzzyHit& lhs, const FuzzyHit& rhs) {
+  return (lhs.score > rhs.score) || ((lhs.score == rhs.score) && (lhs.file < rhs.file));
+}
+
+// Keeps the best |limit| hits seen. The heap has the worst of them on top so
+// most files are rejected with a single comparison.
+class FuzzyTopK {
+public:
+  explicit FuzzyTopK(size_t limit) : limit_(limit) {}
+
+  void Add(int score, uint32_t file);
+
+  // Sorts the hits, best first, and hands them over.
+  void Take(std::vector<FuzzyHit>* out);
+
+private:
+  size_t limit_;
+  std::vector<FuzzyHit> heap_;
+};
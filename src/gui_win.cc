@@ -2,7 +2,7 @@
 // Please see the README file for attribution and license details.
 
 #include "target_version_win.h"
-#include "engine_v1_win.h"
+#include "code_search.h"
 #include "resource.h"
 
 #include <vector>
@@ -12,32 +12,74 @@
 #pragma comment(linker,"/manifestdependency:\"type='win32' name='Microsoft.Windows.Common-Controls' version='6.0.0.0' processorArchitecture='*' publicKeyToken='6595b64144ccf1df' language='*'\"")
 
 typedef std::vector<std::wstring> VoWStr;
-typedef std::vector<VoWStr*> VoVoWS;
+
+// A batch of results on its way to the list. The name modes send file ids,
+// only the rows that get drawn or opened have their path made; the content
+// modes send the text of the rows.
+struct Matches {
+  CodeSearch* engine;
+  std::vector<CodeSearch::FileId> ids;
+  VoWStr text;
+};
+
+// A row of the list: the file of a name match, or the text of a content
+// match.
+struct Row {
+  CodeSearch::FileId id;
+  std::wstring text;
+};
 
 HWND        g_dlg  = 0;
 HANDLE      g_term = NULL;
 HANDLE      g_thrd = NULL;
 CodeSearch* g_cs   = NULL;
-VoVoWS      g_vovows;
+// Only for the dialog thread. The engine the ids of the rows belong to, it
+// can be an engine that the search thread has already replaced.
+CodeSearch*      g_rows_engine = NULL;
+std::vector<Row> g_rows;
 
 volatile long  g_mode = 0;
-
-void DeleteVoWStr(VoWStr* item) {
-  delete item;
-}
+// Bumped for every query typed, a search that sees another value is stale.
+volatile long  g_generation = 0;
+
+// Time the search thread spends before it posts what it has so far.
+const unsigned int kSearchBudgetMs = 30;
+// Regex mode lists this many lines at most.
+const size_t kMaxTextHits = 1000;
+
+// A query on its way to the search thread.
+struct PendingQuery {
+  wchar_t txt[64];
+  long generation;
+};
 
 void OpenFileWithApplication(const std::wstring& file) {
   ::ShellExecuteW(NULL, L"open", file.c_str(), NULL, NULL, SW_SHOW);
 }
 
 void OpenListitem(HWND list, int id) {
-  LVITEM item = {0};
-  item.mask = LVIF_PARAM;
-  item.iItem = id;
-  if (ListView_GetItem(list, &item)) {
-    std::wstring* file = reinterpret_cast<std::wstring*>(item.lParam);
-    OpenFileWithApplication(*file);
+  if ((id < 0) || (static_cast<size_t>(id) >= g_rows.size()))
+    return;
+  const Row& row = g_rows[id];
+  std::wstring file;
+  if (row.text.empty()) {
+    wchar_t path[MAX_PATH];
+    size_t len = g_rows_engine->GetPath(row.id, path, MAX_PATH);
+    if (len < MAX_PATH) {
+      file.assign(path, len);
+    } else {
+      file.resize(len + 1);
+      g_rows_engine->GetPath(row.id, &file[0], len + 1);
+      file.resize(len);
+    }
+  } else {
+    file = row.text;
+    // Regex mode items are path(line): text.
+    size_t line = file.find(L"): ");
+    if ((g_mode == 3) && (line != std::wstring::npos))
+      file.resize(file.rfind(L'(', line));
   }
+  OpenFileWithApplication(file);
 }
 
 bool SelectFolder(HWND parent, std::wstring* path) {
@@ -83,6 +125,17 @@ class Progress : public CodeSearch::Client {
       return true;
     }
 
+    virtual bool OnContentProgress(CodeSearch* engine,
+                                   const CodeSearch::ContentProgress& progress) override {
+      DWORD ctc = ::GetTickCount();
+      if ((ctc - tc_ > 100) || progress.finished) {
+        tc_ = ctc;
+        ::PostMessageW(g_dlg, WM_APP+4,
+                       reinterpret_cast<WPARAM>(new CodeSearch::ContentProgress(progress)), 0);
+      }
+      return true;
+    }
+
     virtual bool OnError(int error_code) override {
       __debugbreak();
       return false;
@@ -93,22 +146,93 @@ private:
 };
 
 
+// The snapshot of a tree lives in the temp directory, named after a hash of
+// its path so that every tree gets its own.
+std::wstring SnapshotPath(const std::wstring& root) {
+  wchar_t dir[MAX_PATH + 1];
+  DWORD len = ::GetTempPathW(MAX_PATH + 1, dir);
+  if (!len || (len > MAX_PATH))
+    return std::wstring();
+  unsigned int hash = 2166136261u;
+  for (size_t ix = 0; ix != root.size(); ++ix) {
+    hash = (hash ^ ::towlower(root[ix])) * 16777619u;
+  }
+  wchar_t name[32];
+  ::wsprintfW(name, L"kodefind-%08x.idx", hash);
+  return std::wstring(dir, len) + name;
+}
+
+// A freshly indexed engine on its way to the search thread, and the engine
+// it replaces on its way to the dialog.
+struct EngineSwap {
+  CodeSearch* engine;
+  CodeSearch* old;
+  HANDLE done;
+};
+
+// The rows of the list can still point into the old engine, the dialog
+// deletes it once they are gone.
+void CALLBACK ApcSwapEngine(ULONG_PTR ctx) {
+  EngineSwap* swap = reinterpret_cast<EngineSwap*>(ctx);
+  swap->old = g_cs;
+  g_cs = swap->engine;
+  ::PostMessageW(g_dlg, WM_APP + 5, reinterpret_cast<WPARAM>(swap), 0);
+}
+
+// Crawls the tree again while the engine loaded from its snapshot answers
+// queries. The new engine takes over between two queries; only then can the
+// snapshot be rewritten because the old engine has it mapped until it goes.
+DWORD WINAPI RefreshThreadProc(void* ctx) {
+  std::wstring* dir = reinterpret_cast<std::wstring*>(ctx);
+  CodeSearch* fresh = CodeSearchFactory(NULL);
+  if (fresh && (fresh->Index(dir->c_str(), NULL) == 0)) {
+    fresh->IndexContent(NULL);
+    EngineSwap swap = { fresh, NULL, ::CreateEventW(NULL, TRUE, FALSE, NULL) };
+    ::QueueUserAPC(ApcSwapEngine, g_thrd, reinterpret_cast<ULONG_PTR>(&swap));
+    // If the dialog closes first this never returns, the process is exiting.
+    ::WaitForSingleObject(swap.done, INFINITE);
+    ::CloseHandle(swap.done);
+    fresh->Save(SnapshotPath(*dir).c_str());
+  } else {
+    delete fresh;
+  }
+  delete dir;
+  return 0;
+}
+
 DWORD WINAPI IndexSearchTreadProc(void* ctx) {
+  std::wstring* dir = reinterpret_cast<std::wstring*>(ctx);
+  std::wstring snapshot(SnapshotPath(*dir));
+
+  // With a snapshot of this tree queries can start right away, it gets
+  // refreshed in the background. Without one, index and then save one.
   g_cs = CodeSearchFactory(NULL);
   if (!g_cs)
     return 1;
+  // Lives as long as this thread, the engines report content progress to it.
   Progress progress;
-  std::wstring* dir = reinterpret_cast<std::wstring*>(ctx);
-  int rv = g_cs->Index(dir->c_str(), &progress);
-  
-  delete dir;
-  if (rv != 0) {
-    ::PostMessageW(g_dlg, WM_APP + 2, rv, 0);
-    return 1;
+  bool loaded = (g_cs->Load(snapshot.c_str(), dir->c_str()) == 0);
+  if (!loaded) {
+    delete g_cs;
+    g_cs = CodeSearchFactory(NULL);
+    int rv = g_cs->Index(dir->c_str(), &progress);
+    if (rv != 0) {
+      delete dir;
+      ::PostMessageW(g_dlg, WM_APP + 2, rv, 0);
+      return 1;
+    }
   }
 
   // Done indexing, now wait for queries, or if the handle is signaled, exit.
+  // The contents get indexed in the background meanwhile.
   ::PostMessageW(g_dlg, WM_APP + 2, 0, 0);
+  g_cs->IndexContent(&progress);
+  if (loaded) {
+    ::CloseHandle(::CreateThread(NULL, 0, RefreshThreadProc, dir, 0, NULL));
+  } else {
+    g_cs->Save(snapshot.c_str());
+    delete dir;
+  }
   while (true) {
     DWORD v = ::WaitForSingleObjectEx(g_term, INFINITE, TRUE);
     if (WAIT_IO_COMPLETION != v)
@@ -121,31 +245,97 @@ DWORD WINAPI IndexSearchTreadProc(void* ctx) {
 void CALLBACK ApcNewTextInput(ULONG_PTR ctx) {
   CodeSearch::Options options =
       (g_mode == 0) ? CodeSearch::Substring : CodeSearch::BeginsWith;
-  wchar_t* txt = reinterpret_cast<wchar_t*>(ctx);
-  VoWStr* res = new VoWStr(g_cs->Search(txt, options));
-  delete txt;
+  PendingQuery* query = reinterpret_cast<PendingQuery*>(ctx);
+  // Fast typing queues several of these behind a running search. All but the
+  // last one are stale by the time they run and don't touch the engine.
+  if (query->generation != g_generation) {
+    delete query;
+    return;
+  }
+
+  if (g_mode == 2) {
+    // Whole tokens only, and the files so far while the contents are being
+    // indexed.
+    bool partial = false;
+    Matches* res = new Matches;
+    res->engine = g_cs;
+    res->text = g_cs->SearchContent(query->txt, &partial);
+    if (res->text.empty()) {
+      delete res;
+    } else {
+      ::PostMessageW(g_dlg, WM_APP + 3, reinterpret_cast<WPARAM>(res), query->generation);
+    }
+    delete query;
+    return;
+  }
+
+  if (g_mode == 3) {
+    // Lines of the contents, from the files the trigrams of the expression
+    // let through.
+    bool partial = false;
+    std::vector<CodeSearch::TextHit> hits;
+    Matches* res = new Matches;
+    res->engine = g_cs;
+    if (g_cs->SearchText(query->txt, CodeSearch::TextRegex, kMaxTextHits, &hits, &partial, NULL) == 0) {
+      for (size_t ix = 0; ix != hits.size(); ++ix) {
+        res->text.push_back(hits[ix].path + L"(" +
+                            std::to_wstring(static_cast<unsigned long long>(hits[ix].line)) +
+                            L"): " + hits[ix].text);
+      }
+    }
+    if (res->text.empty()) {
+      delete res;
+    } else {
+      ::PostMessageW(g_dlg, WM_APP + 3, reinterpret_cast<WPARAM>(res), query->generation);
+    }
+    delete query;
+    return;
+  }
+
+  CodeSearch::Control control = { &g_generation, query->generation, kSearchBudgetMs };
+  Matches* res = new Matches;
+  res->engine = g_cs;
+  CodeSearch::Status status = g_cs->SearchIds(NULL, query->txt, options, control, &res->ids);
   while (true) {
-    if (res->empty()) {
+    if ((status == CodeSearch::Cancelled) || res->ids.empty()) {
       delete res;
-      return;
+    } else {
+      ::PostMessageW(g_dlg, WM_APP + 3, reinterpret_cast<WPARAM>(res), query->generation);
     }
-    ::PostMessageW(g_dlg, WM_APP + 3, reinterpret_cast<WPARAM>(res), 0);
-    res = new VoWStr(g_cs->Continue());
+    if ((status == CodeSearch::Cancelled) || (status == CodeSearch::Done))
+      break;
+    res = new Matches;
+    res->engine = g_cs;
+    status = g_cs->ContinueIds(NULL, control, &res->ids);
   }
+  delete query;
 }
 
-bool InsertListViewItems(HWND list, VoWStr* matches) {
-  g_vovows.push_back(matches);
+bool InsertListViewItems(HWND list, Matches* matches) {
   LVITEM lvI = {0};
   // Parent gets an LVN_GETDISPINFO when its time to display.
   lvI.pszText   = LPSTR_TEXTCALLBACKW;
-  lvI.mask      = LVIF_TEXT|LVIF_PARAM;
-  
-  int next = ListView_GetItemCount(list);
+  lvI.mask      = LVIF_TEXT;
+
+  // Rows go in the same order as the items, a row is found by item index.
+  g_rows_engine = matches->engine;
+  size_t next = g_rows.size();
+  if (matches->ids.empty()) {
+    for (size_t ix = 0; ix != matches->text.size(); ++ix) {
+      g_rows.push_back(Row());
+      g_rows.back().id = 0;
+      g_rows.back().text.swap(matches->text[ix]);
+    }
+  } else {
+    for (size_t ix = 0; ix != matches->ids.size(); ++ix) {
+      g_rows.push_back(Row());
+      g_rows.back().id = matches->ids[ix];
+    }
+  }
+  delete matches;
 
-  for (size_t ix = 0; ix < matches->size(); ++ix) {
-    lvI.iItem  = static_cast<int>(next + ix);
-    lvI.lParam = reinterpret_cast<LPARAM>(&matches->at(ix));
+  for (size_t ix = next; ix < g_rows.size(); ++ix) {
+    lvI.iItem  = static_cast<int>(ix);
     if (ListView_InsertItem(list, &lvI) == -1)
       return false;
   }
@@ -154,11 +344,25 @@ bool InsertListViewItems(HWND list, VoWStr* matches) {
 
 bool DeleteAllListViewItems(HWND list) {
   ListView_DeleteAllItems(list);
-  std::for_each(g_vovows.begin(), g_vovows.end(), DeleteVoWStr);
-  g_vovows.clear();
+  g_rows.clear();
   return true;
 }
 
+// Sends the text of the edit box to the search thread, superseding the
+// search that is running, if it is long enough.
+void QueueQuery(HWND hDlg) {
+  PendingQuery* query = new PendingQuery;
+  UINT count = ::GetDlgItemTextW(hDlg, IDC_EDIT1, query->txt, 64);
+  if (count > 2) {
+    // clean the list results and free the previous rows.
+    DeleteAllListViewItems(::GetDlgItem(hDlg, IDC_LIST1));
+    query->generation = ::InterlockedIncrement(&g_generation);
+    ::QueueUserAPC(ApcNewTextInput, g_thrd, reinterpret_cast<ULONG_PTR>(query));
+  } else {
+    delete query;
+  }
+}
+
 bool InitListViewColumns(HWND list) { 
   LVCOLUMN lvc;
   lvc.mask = LVCF_FMT | LVCF_WIDTH;
@@ -167,13 +371,19 @@ bool InitListViewColumns(HWND list) {
   return (ListView_InsertColumn(list, 0, &lvc) == -1)? false : true;
 }
 
+// Substring, begins with, content tokens and content regex.
+const wchar_t* ModeLabel() {
+  static const wchar_t* const labels[] = { L"s", L"x", L"c", L"r" };
+  return labels[g_mode];
+}
+
 INT_PTR CALLBACK DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam) {
 	
 	switch (message) {
 	  case WM_INITDIALOG: {
         g_dlg = hDlg;
         ::SetWindowTextW(hDlg, L"select source directory");
-        ::SetWindowTextW(::GetDlgItem(hDlg, IDC_BUTTON2), (g_mode == 0) ? L"s" : L"x");
+        ::SetWindowTextW(::GetDlgItem(hDlg, IDC_BUTTON2), ModeLabel());
 		    return static_cast<INT_PTR>(TRUE);
       }
 
@@ -200,23 +410,14 @@ INT_PTR CALLBACK DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
 
       } else if (LOWORD(wParam) == IDC_BUTTON2) {
         // The buttons to select match mode.
-        g_mode = (g_mode == 0)? 1 : 0;
-        ::SetWindowTextW(::GetDlgItem(hDlg, IDC_BUTTON2), (g_mode == 0) ? L"s" : L"x");
+        g_mode = (g_mode + 1) % 4;
+        ::SetWindowTextW(::GetDlgItem(hDlg, IDC_BUTTON2), ModeLabel());
 
       } else if (LOWORD(wParam) == IDC_EDIT1) {
         // Change on the edit control.
         switch (HIWORD(wParam)) {
           case EN_CHANGE:
-            wchar_t* txt = new wchar_t[64];
-            UINT count = ::GetDlgItemTextW(hDlg, IDC_EDIT1, txt, 64);
-            if (count > 2) {
-              // clean the list results and free the previous vectors.
-              DeleteAllListViewItems(::GetDlgItem(hDlg, IDC_LIST1));
-              // Ask the other thread to start a new search.
-              ::QueueUserAPC(ApcNewTextInput, g_thrd, reinterpret_cast<ULONG_PTR>(txt));
-            } else {
-              delete txt;
-            }
+            QueueQuery(hDlg);
             break;
         }
       } else if (LOWORD(wParam) == IDOK) {
@@ -264,13 +465,49 @@ INT_PTR CALLBACK DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
       }
       break;
 
+    case WM_APP + 4: {
+        // Progress indexing the contents, with what waits to be read and
+        // to be indexed.
+        CodeSearch::ContentProgress* progress = reinterpret_cast<CodeSearch::ContentProgress*>(wParam);
+        wchar_t buf[80];
+        // wsprintfW() has no size_t conversion.
+        ::wsprintfW(buf, L"content: %u of %u [read %u, index %u]",
+                    static_cast<unsigned int>(progress->done),
+                    static_cast<unsigned int>(progress->total),
+                    static_cast<unsigned int>(progress->read_queue),
+                    static_cast<unsigned int>(progress->index_queue));
+        ::SetWindowTextW(hDlg, buf);
+        delete progress;
+      }
+      break;
+
     case WM_APP + 3: {
-        // A set of results is available, insert them in the UI.
-        VoWStr* matches = reinterpret_cast<VoWStr*>(wParam);
+        // A set of results is available, insert them in the UI unless they
+        // belong to a query that has been typed over already.
+        Matches* matches = reinterpret_cast<Matches*>(wParam);
+        if (static_cast<long>(lParam) != g_generation) {
+          delete matches;
+          break;
+        }
         InsertListViewItems(::GetDlgItem(hDlg, IDC_LIST1), matches);
       }
       break;
 
+    case WM_APP + 5: {
+        // The search thread has switched to a fresh engine. The results of
+        // the old one were posted before this, they are all in the list by
+        // now; they are searched again in the new one.
+        EngineSwap* swap = reinterpret_cast<EngineSwap*>(wParam);
+        if (g_rows_engine == swap->old) {
+          DeleteAllListViewItems(::GetDlgItem(hDlg, IDC_LIST1));
+          g_rows_engine = NULL;
+          QueueQuery(hDlg);
+        }
+        delete swap->old;
+        ::SetEvent(swap->done);
+      }
+      break;
+
     case WM_NOTIFY: {
         NMHDR* hdr = reinterpret_cast<NMHDR*>(lParam);
         if (hdr->code == LVN_GETDISPINFO) {
@@ -279,9 +516,16 @@ INT_PTR CALLBACK DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
           if (lvdi->item.iSubItem != 0) __debugbreak();
           if (lvdi->item.mask != LVIF_TEXT) __debugbreak();
 
-          const std::wstring* txt = reinterpret_cast<std::wstring*>(lvdi->item.lParam);
-          // msdn says that strcpy into pszText works!! ??
-          lvdi->item.pszText = const_cast<wchar_t*>(txt->c_str());
+          size_t ix = static_cast<size_t>(lvdi->item.iItem);
+          if (ix >= g_rows.size())
+            break;
+          if (g_rows[ix].text.empty()) {
+            // The path is made right into the buffer of the list, cut short
+            // if it does not fit.
+            g_rows_engine->GetPath(g_rows[ix].id, lvdi->item.pszText, lvdi->item.cchTextMax);
+          } else {
+            lvdi->item.pszText = const_cast<wchar_t*>(g_rows[ix].text.c_str());
+          }
         } else if (hdr->code == LVN_ITEMACTIVATE) {
           // Item activated. (Double-clicked).
           NMITEMACTIVATE* nmia = reinterpret_cast<LPNMITEMACTIVATE>(lParam);
@@ -0,0 +1,143 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "index_snapshot.h"
+
+#include <string.h>
+
+#include "mapped_file.h"
+
+namespace {
+  const char kMagic[8] = { 'k', 'o', 'd', 'e', 'f', 'i', 'n', 'd' };
+  const uint32_t kByteOrder = 0x01020304;
+
+  // Where the first array goes.
+  const uint64_t kDataStart =
+      ((sizeof(SnapshotHeader) + kSnapshotMaxSections * sizeof(SnapshotSection) +
+        kSnapshotAlign - 1) / kSnapshotAlign) * kSnapshotAlign;
+}
+
+SnapshotWriter::SnapshotWriter() : file_(NULL), offset_(kDataStart), copy_(true), failed_(false) {
+  // |data_| points into the copies, they must never move.
+  copies_.reserve(kSnapshotMaxSections);
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  if (file_)
+    ::fclose(file_);
+}
+
+bool SnapshotWriter::Open(const wchar_t* path) {
+  path_ = path;
+  temp_path_ = path_ + L".tmp";
+  file_ = OpenFileForWrite(temp_path_.c_str());
+  return file_ != NULL;
+}
+
+void SnapshotWriter::AddRaw(const void* data, size_t elem_size, size_t count) {
+  if (failed_)
+    return;
+  if (sections_.size() == kSnapshotMaxSections) {
+    failed_ = true;
+    return;
+  }
+
+  SnapshotSection section = { offset_, count, static_cast<uint32_t>(elem_size), 0 };
+  sections_.push_back(section);
+
+  size_t bytes = elem_size * count;
+  const char* bytes_at = static_cast<const char*>(data);
+  copies_.push_back(std::vector<char>());
+  if (copy_ && bytes) {
+    copies_.back().assign(bytes_at, bytes_at + bytes);
+    bytes_at = &copies_.back()[0];
+  }
+  data_.push_back(bytes_at);
+
+  offset_ += bytes;
+  offset_ += (kSnapshotAlign - offset_ % kSnapshotAlign) % kSnapshotAlign;
+}
+
+bool SnapshotWriter::Commit() {
+  if (!file_)
+    return false;
+
+  SnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kSnapshotVersion;
+  header.wchar_size = sizeof(wchar_t);
+  header.byte_order = kByteOrder;
+  header.section_count = static_cast<uint32_t>(sections_.size());
+  header.file_size = offset_;
+
+  // The header, the section table and the padding up to the first array.
+  std::vector<char> head(static_cast<size_t>(kDataStart), 0);
+  memcpy(&head[0], &header, sizeof(header));
+  if (!sections_.empty())
+    memcpy(&head[sizeof(header)], &sections_[0], sections_.size() * sizeof(SnapshotSection));
+  if (!failed_)
+    failed_ = (::fwrite(&head[0], 1, head.size(), file_) != head.size());
+
+  static const char zeros[kSnapshotAlign] = {0};
+  uint64_t offset = kDataStart;
+  for (size_t sx = 0; !failed_ && (sx != sections_.size()); ++sx) {
+    size_t bytes = static_cast<size_t>(sections_[sx].count * sections_[sx].elem_size);
+    if (bytes && (::fwrite(data_[sx], 1, bytes, file_) != bytes)) {
+      failed_ = true;
+      break;
+    }
+    offset += bytes;
+    size_t pad = static_cast<size_t>((kSnapshotAlign - offset % kSnapshotAlign) % kSnapshotAlign);
+    if (pad && (::fwrite(zeros, 1, pad, file_) != pad))
+      failed_ = true;
+    offset += pad;
+  }
+  if (::fclose(file_) != 0)
+    failed_ = true;
+  file_ = NULL;
+
+  if (failed_)
+    return false;
+  return MoveFileOver(temp_path_.c_str(), path_.c_str());
+}
+
+bool SnapshotReader::Init(const char* data, size_t size) {
+  if (size < kDataStart)
+    return false;
+
+  const SnapshotHeader* header = reinterpret_cast<const SnapshotHeader*>(data);
+  if ((memcmp(header->magic, kMagic, sizeof(kMagic)) != 0) ||
+      (header->version != kSnapshotVersion) ||
+      (header->wchar_size != sizeof(wchar_t)) ||
+      (header->byte_order != kByteOrder) ||
+      (header->section_count > kSnapshotMaxSections) ||
+      (header->file_size != size))
+    return false;
+
+  const SnapshotSection* sections = reinterpret_cast<const SnapshotSection*>(header + 1);
+  for (size_t sx = 0; sx != header->section_count; ++sx) {
+    const SnapshotSection& section = sections[sx];
+    if ((section.offset % kSnapshotAlign) || (section.offset < kDataStart) ||
+        (section.offset > size) || !section.elem_size ||
+        (section.count > (size - section.offset) / section.elem_size))
+      return false;
+  }
+
+  data_ = data;
+  sections_ = sections;
+  section_count_ = header->section_count;
+  next_ = 0;
+  return true;
+}
+
+bool SnapshotReader::NextRaw(size_t elem_size, const void** data, size_t* count) {
+  if (next_ == section_count_)
+    return false;
+  const SnapshotSection& section = sections_[next_++];
+  if (section.elem_size != elem_size)
+    return false;
+  *data = data_ + section.offset;
+  *count = static_cast<size_t>(section.count);
+  return true;
+}
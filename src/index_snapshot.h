@@ -0,0 +1,131 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "pod_array.h"
+
+// A snapshot is the tables of an index written as flat arrays into a single
+// file, laid out so that a mapped copy can be used in place:
+//
+//   SnapshotHeader
+//   kSnapshotMaxSections x SnapshotSection
+//   the arrays, each starting at a multiple of kSnapshotAlign bytes
+//
+// Each table writes its arrays in a fixed order and reads them back in the
+// same order. The arrays are used where they are mapped, nothing is copied,
+// but each table checks its own when it maps them, so a corrupt file fails
+// Load() instead of a later query: the header and the section table, then
+// that every name lies inside its arena and ends in its terminator, every
+// parent, directory and file index is in range and the trigram lists are in
+// order. The file is written under a temporary name and renamed over the
+// old one, so a reader never sees a partial file.
+//
+// Bump kSnapshotVersion whenever the layout of any table changes.
+const uint32_t kSnapshotVersion = 4;
+const size_t kSnapshotMaxSections = 32;
+const size_t kSnapshotAlign = 64;
+
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  // The writer's sizeof(wchar_t) and its byte order, written as 0x01020304.
+  uint32_t wchar_size;
+  uint32_t byte_order;
+  uint32_t section_count;
+  uint64_t file_size;
+};
+
+struct SnapshotSection {
+  uint64_t offset;
+  uint64_t count;
+  uint32_t elem_size;
+  uint32_t reserved;
+};
+
+// Gathers the arrays and writes them all in Commit(), so a caller can add
+// them under a lock and do the I/O after releasing it. An array that can
+// change before Commit() has to be copied, which is what Add() does unless
+// set_copy(false) says the arrays added next stay as they are.
+class SnapshotWriter {
+public:
+  SnapshotWriter();
+  ~SnapshotWriter();
+
+  bool Open(const wchar_t* path);
+  void set_copy(bool copy) { copy_ = copy; }
+
+  template <typename T>
+  void Add(const PodArray<T>& array) {
+    AddRaw(array.data(), sizeof(T), array.size());
+  }
+
+  template <typename T>
+  void Add(const T* data, size_t count) {
+    AddRaw(data, sizeof(T), count);
+  }
+
+  // Writes the header, the section table and the arrays and puts the file in
+  // place. Returns false if anything on the way failed.
+  bool Commit();
+
+private:
+  void AddRaw(const void* data, size_t elem_size, size_t count);
+
+  FILE* file_;
+  std::wstring path_;
+  std::wstring temp_path_;
+  std::vector<SnapshotSection> sections_;
+  // What goes in each section, in |copies_| unless it was added uncopied.
+  std::vector<const char*> data_;
+  std::vector<std::vector<char> > copies_;
+  uint64_t offset_;
+  bool copy_;
+  bool failed_;
+
+  SnapshotWriter(const SnapshotWriter&);
+  void operator=(const SnapshotWriter&);
+};
+
+// Hands out the arrays of a mapped snapshot in the order they were written.
+// The memory has to outlive every table that borrows from it.
+class SnapshotReader {
+public:
+  SnapshotReader() : data_(NULL), sections_(NULL), section_count_(0), next_(0) {}
+
+  // Checks the header and the section table of the |size| bytes at |data|.
+  bool Init(const char* data, size_t size);
+
+  template <typename T>
+  bool Next(PodArray<T>* array) {
+    const void* data;
+    size_t count;
+    if (!NextRaw(sizeof(T), &data, &count))
+      return false;
+    array->Borrow(static_cast<const T*>(data), count);
+    return true;
+  }
+
+  template <typename T>
+  bool Next(const T** data, size_t* count) {
+    const void* raw;
+    if (!NextRaw(sizeof(T), &raw, count))
+      return false;
+    *data = static_cast<const T*>(raw);
+    return true;
+  }
+
+private:
+  bool NextRaw(size_t elem_size, const void** data, size_t* count);
+
+  const char* data_;
+  const SnapshotSection* sections_;
+  size_t section_count_;
+  size_t next_;
+};
@@ -0,0 +1,35 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stddef.h>
+#include <stdio.h>
+
+// A whole file mapped read-only into memory. The mapping stays valid until
+// Close() or the destructor, no handle is kept open besides the view.
+class MappedFile {
+public:
+  MappedFile() : data_(NULL), size_(0) {}
+  ~MappedFile() { Close(); }
+
+  // Returns false if the file can't be opened or is empty.
+  bool Open(const wchar_t* path);
+  void Close();
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  const char* data_;
+  size_t size_;
+
+  MappedFile(const MappedFile&);
+  void operator=(const MappedFile&);
+};
+
+// Opens |path| for binary writing, truncating it. Returns NULL on failure.
+FILE* OpenFileForWrite(const wchar_t* path);
+
+// Moves |from| to |to|, replacing it. Readers of |to| see either the old or
+// the new file, never a partial one.
+bool MoveFileOver(const wchar_t* from, const wchar_t* to);
@@ -0,0 +1,57 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#include "utf8.h"
+
+namespace {
+  std::string NativePath(const wchar_t* path) {
+    return WideToUtf8(path, wcslen(path));
+  }
+}
+
+bool MappedFile::Open(const wchar_t* path) {
+  Close();
+  int fd = ::open(NativePath(path).c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if ((::fstat(fd, &st) != 0) || (st.st_size <= 0)) {
+    ::close(fd);
+    return false;
+  }
+
+  void* view = ::mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping keeps its own reference to the file.
+  ::close(fd);
+  if (view == MAP_FAILED)
+    return false;
+
+  data_ = static_cast<const char*>(view);
+  size_ = static_cast<size_t>(st.st_size);
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_)
+    ::munmap(const_cast<char*>(data_), size_);
+  data_ = NULL;
+  size_ = 0;
+}
+
+FILE* OpenFileForWrite(const wchar_t* path) {
+  return ::fopen(NativePath(path).c_str(), "wb");
+}
+
+bool MoveFileOver(const wchar_t* from, const wchar_t* to) {
+  return ::rename(NativePath(from).c_str(), NativePath(to).c_str()) == 0;
+}
@@ -0,0 +1,50 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "target_version_win.h"
+#include "mapped_file.h"
+
+bool MappedFile::Open(const wchar_t* path) {
+  Close();
+  DWORD share = FILE_SHARE_DELETE | FILE_SHARE_READ;
+  HANDLE file = ::CreateFileW(path, GENERIC_READ, share, NULL, OPEN_EXISTING, 0, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER li = {0};
+  if (!::GetFileSizeEx(file, &li) || (li.QuadPart == 0) ||
+      (static_cast<ULONGLONG>(li.QuadPart) > static_cast<size_t>(-1))) {
+    ::CloseHandle(file);
+    return false;
+  }
+
+  HANDLE mapping = ::CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  ::CloseHandle(file);
+  if (!mapping)
+    return false;
+
+  // The view keeps the mapping alive.
+  const void* view = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  ::CloseHandle(mapping);
+  if (!view)
+    return false;
+
+  data_ = static_cast<const char*>(view);
+  size_ = static_cast<size_t>(li.QuadPart);
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_)
+    ::UnmapViewOfFile(data_);
+  data_ = NULL;
+  size_ = 0;
+}
+
+FILE* OpenFileForWrite(const wchar_t* path) {
+  return ::_wfopen(path, L"wb");
+}
+
+bool MoveFileOver(const wchar_t* from, const wchar_t* to) {
+  return ::MoveFileExW(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != FALSE;
+}
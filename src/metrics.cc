@@ -0,0 +1,94 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "metrics.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+  // |value| is not zero.
+  unsigned int HighestBit64(uint64_t value) {
+#if defined(_MSC_VER)
+    unsigned long ix;
+    _BitScanReverse64(&ix, value);
+    return ix;
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+  }
+}
+
+size_t LatencyHistogram::BucketOf(uint64_t ns) {
+  // The first 2^kSubBits buckets are one value wide, then each power of two
+  // gets as many.
+  if (ns < (1u << kSubBits))
+    return static_cast<size_t>(ns);
+  unsigned int bit = HighestBit64(ns);
+  size_t sub = static_cast<size_t>(ns >> (bit - kSubBits)) & ((1u << kSubBits) - 1);
+  return ((bit - kSubBits + 1) << kSubBits) + sub;
+}
+
+uint64_t LatencyHistogram::BucketEnd(size_t bucket) {
+  if (bucket < (1u << kSubBits))
+    return bucket;
+  unsigned int shift = static_cast<unsigned int>(bucket >> kSubBits) - 1;
+  uint64_t first = static_cast<uint64_t>((bucket & ((1u << kSubBits) - 1)) | (1u << kSubBits)) << shift;
+  return first + ((1ull << shift) - 1);
+}
+
+void LatencyHistogram::Record(uint64_t ns) {
+  counts_[BucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+  uint64_t max = max_.load(std::memory_order_relaxed);
+  while ((ns > max) && !max_.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+  }
+}
+
+void LatencyHistogram::Reset() {
+  for (size_t bx = 0; bx != kBuckets; ++bx) {
+    counts_[bx].store(0, std::memory_order_relaxed);
+  }
+  max_.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::count() const {
+  uint64_t sum = 0;
+  for (size_t bx = 0; bx != kBuckets; ++bx) {
+    sum += counts_[bx].load(std::memory_order_relaxed);
+  }
+  return sum;
+}
+
+uint64_t LatencyHistogram::ValueAt(double percentile) const {
+  // The counts can move while this reads them, the answer is close enough.
+  uint64_t counts[kBuckets];
+  uint64_t total = 0;
+  for (size_t bx = 0; bx != kBuckets; ++bx) {
+    counts[bx] = counts_[bx].load(std::memory_order_relaxed);
+    total += counts[bx];
+  }
+  if (!total)
+    return 0;
+  uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * total + 0.5);
+  if (rank < 1)
+    rank = 1;
+  uint64_t seen = 0;
+  for (size_t bx = 0; bx != kBuckets; ++bx) {
+    seen += counts[bx];
+    if (seen >= rank) {
+      uint64_t end = BucketEnd(bx);
+      return (end < max()) ? end : max();
+    }
+  }
+  return max();
+}
+
+void LatencyHistogram::Buckets(std::vector<std::pair<uint64_t, uint64_t> >* out) const {
+  out->clear();
+  for (size_t bx = 0; bx != kBuckets; ++bx) {
+    uint64_t count = counts_[bx].load(std::memory_order_relaxed);
+    if (count)
+      out->push_back(std::make_pair(BucketEnd(bx), count));
+  }
+}
@@ -0,0 +1,146 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <utility>
+#include <vector>
+
+// Counters that any number of threads add to at once, cheap enough to leave
+// on. Each thread adds to a slot of its own, a cache line away from the next
+// one, unless there are more threads than slots; reading sums the slots.
+template <size_t N>
+class Counters {
+public:
+  Counters() { Reset(); }
+
+  void Add(size_t id, uint64_t count) {
+    slots_[ThisSlot()].values[id].fetch_add(count, std::memory_order_relaxed);
+  }
+
+  uint64_t Get(size_t id) const {
+    uint64_t sum = 0;
+    for (size_t sx = 0; sx != kSlots; ++sx) {
+      sum += slots_[sx].values[id].load(std::memory_order_relaxed);
+    }
+    return sum;
+  }
+
+  void Reset() {
+    for (size_t sx = 0; sx != kSlots; ++sx) {
+      for (size_t ix = 0; ix != N; ++ix) {
+        slots_[sx].values[ix].store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+
+private:
+  static const size_t kSlots = 16;
+  // Padded rather than aligned, the engines are allocated with plain new.
+  struct Slot {
+    std::atomic<uint64_t> values[N];
+    char pad[64];
+  };
+
+  static size_t ThisSlot() {
+    static std::atomic<size_t> next(0);
+    static thread_local size_t slot = next++ % kSlots;
+    return slot;
+  }
+
+  Slot slots_[kSlots];
+
+  Counters(const Counters&);
+  void operator=(const Counters&);
+};
+
+// A value that goes up and down, like the length of a queue, and the most it
+// has been.
+class Gauge {
+public:
+  Gauge() : value_(0), max_(0) {}
+
+  void Set(uint64_t value) {
+    value_.store(value, std::memory_order_relaxed);
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    while ((value > max) && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+    }
+  }
+
+  void Reset() {
+    value_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+  }
+
+  uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+  uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint64_t> value_;
+  std::atomic<uint64_t> max_;
+};
+
+// Durations in nanoseconds counted in log-linear buckets, like HdrHistogram:
+// every power of two is split in 2^kSubBits buckets, so a value is known to
+// within 1/16th of it, from 1ns to centuries, in a fixed 8KB. Recording is an
+// add to a bucket; percentiles are worked out when read.
+class LatencyHistogram {
+public:
+  LatencyHistogram() { Reset(); }
+
+  void Record(uint64_t ns);
+  void Reset();
+
+  uint64_t count() const;
+  uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+  // The smallest value that |percentile| percent of the durations are at or
+  // under, rounded up to the end of its bucket. Zero if there are none.
+  uint64_t ValueAt(double percentile) const;
+  // The (largest value, count) of the buckets that have any.
+  void Buckets(std::vector<std::pair<uint64_t, uint64_t> >* out) const;
+
+private:
+  static const unsigned int kSubBits = 4;
+  static const size_t kBuckets = (64 - kSubBits + 1) << kSubBits;
+
+  static size_t BucketOf(uint64_t ns);
+  static uint64_t BucketEnd(size_t bucket);
+
+  std::atomic<uint64_t> counts_[kBuckets];
+  std::atomic<uint64_t> max_;
+
+  LatencyHistogram(const LatencyHistogram&);
+  void operator=(const LatencyHistogram&);
+};
+
+// Nanoseconds since construction.
+class ElapsedTimer {
+public:
+  ElapsedTimer() : start_(std::chrono::steady_clock::now()) {}
+
+  uint64_t ns() const {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start_).count());
+  }
+
+private:
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Records in |histogram| how long it lived.
+class ScopedLatency {
+public:
+  explicit ScopedLatency(LatencyHistogram* histogram) : histogram_(histogram) {}
+  ~ScopedLatency() { histogram_->Record(timer_.ns()); }
+
+private:
+  LatencyHistogram* histogram_;
+  ElapsedTimer timer_;
+
+  ScopedLatency(const ScopedLatency&);
+  void operator=(const ScopedLatency&);
+};
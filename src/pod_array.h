@@ -0,0 +1,84 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stddef.h>
+
+#include <vector>
+
+// An array of plain values used by the index tables. While a table is being
+// built the elements live in a vector it owns. A table loaded from a snapshot
+// borrows them straight from the mapped file instead, so loading copies
+// nothing. Changing a borrowed array first copies it into owned storage.
+template <typename T>
+class PodArray {
+public:
+  PodArray() : data_(NULL), size_(0), borrowed_(false) {}
+
+  const T* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  bool borrowed() const { return borrowed_; }
+  // What the elements take, in the mapped file or on the heap.
+  size_t memory_size() const {
+    return borrowed_ ? size_ * sizeof(T) : owned_.capacity() * sizeof(T);
+  }
+
+  const T& operator[](size_t ix) const { return data_[ix]; }
+  const T* begin() const { return data_; }
+  const T* end() const { return data_ + size_; }
+
+  void reserve(size_t count) { Own(); owned_.reserve(count); Sync(); }
+  void resize(size_t count) { Own(); owned_.resize(count); Sync(); }
+  void push_back(const T& value) { Own(); owned_.push_back(value); Sync(); }
+  // Gives back the room that growing left, the array is done changing.
+  void shrink_to_fit() {
+    if (borrowed_)
+      return;
+    owned_.shrink_to_fit();
+    Sync();
+  }
+  void append(const T* values, size_t count) {
+    Own();
+    owned_.insert(owned_.end(), values, values + count);
+    Sync();
+  }
+
+  void clear() {
+    owned_.clear();
+    borrowed_ = false;
+    Sync();
+  }
+
+  // For filling the array in place after a resize().
+  T* mutable_data() { Own(); return owned_.empty() ? NULL : &owned_[0]; }
+
+  // Points the array at |count| elements that somebody else keeps alive.
+  void Borrow(const T* data, size_t count) {
+    std::vector<T>().swap(owned_);
+    data_ = data;
+    size_ = count;
+    borrowed_ = true;
+  }
+
+private:
+  void Own() {
+    if (!borrowed_)
+      return;
+    owned_.assign(data_, data_ + size_);
+    borrowed_ = false;
+  }
+
+  void Sync() {
+    data_ = owned_.empty() ? NULL : &owned_[0];
+    size_ = owned_.size();
+  }
+
+  std::vector<T> owned_;
+  const T* data_;
+  size_t size_;
+  bool borrowed_;
+
+  PodArray(const PodArray&);
+  void operator=(const PodArray&);
+};
@@ -0,0 +1,80 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "prefix_index.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "file_table.h"
+#include "index_snapshot.h"
+
+namespace {
+  // Orders by name, and by file index among equal names so the order of the
+  // results does not depend on the sort implementation. strcmp() compares the
+  // bytes as unsigned, so UTF-8 names sort in code point order.
+  class NameLess {
+  public:
+    explicit NameLess(const FileTable& files) : files_(files) {}
+
+    bool operator()(uint32_t lhs, uint32_t rhs) const {
+      int cmp = strcmp(files_.name(lhs), files_.name(rhs));
+      return (cmp < 0) || ((cmp == 0) && (lhs < rhs));
+    }
+
+  private:
+    const FileTable& files_;
+  };
+
+  // Compares only the first |len| characters of a name against the prefix.
+  class PrefixLess {
+  public:
+    PrefixLess(const FileTable& files, const char* txt, size_t len)
+        : files_(files), txt_(txt), len_(len) {}
+
+    bool operator()(uint32_t file, const char*) const {
+      return strncmp(files_.name(file), txt_, len_) < 0;
+    }
+    bool operator()(const char*, uint32_t file) const {
+      return strncmp(files_.name(file), txt_, len_) > 0;
+    }
+
+  private:
+    const FileTable& files_;
+    const char* txt_;
+    size_t len_;
+  };
+}
+
+void PrefixIndex::Build(const FileTable& files) {
+  sorted_.resize(files.size());
+  uint32_t* sorted = sorted_.mutable_data();
+  for (size_t ix = 0; ix != sorted_.size(); ++ix) {
+    sorted[ix] = static_cast<uint32_t>(ix);
+  }
+  std::sort(sorted, sorted + sorted_.size(), NameLess(files));
+}
+
+void PrefixIndex::Narrow(const FileTable& files, const char* txt, size_t len,
+                         size_t* begin, size_t* end) const {
+  std::pair<const uint32_t*, const uint32_t*> range =
+      std::equal_range(sorted_.begin() + *begin, sorted_.begin() + *end, txt,
+                       PrefixLess(files, txt, len));
+  *begin = range.first - sorted_.begin();
+  *end = range.second - sorted_.begin();
+}
+
+void PrefixIndex::Write(SnapshotWriter* out) const {
+  out->Add(sorted_);
+}
+
+bool PrefixIndex::Map(SnapshotReader* in, size_t files) {
+  if (!in->Next(&sorted_) || (sorted_.size() != files))
+    return false;
+  for (size_t px = 0; px != sorted_.size(); ++px) {
+    if (sorted_[px] >= files)
+      return false;
+  }
+  return true;
+}
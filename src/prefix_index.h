@@ -0,0 +1,43 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pod_array.h"
+
+class FileTable;
+class SnapshotReader;
+class SnapshotWriter;
+
+// The files of a FileTable sorted by name. All the names that start with a
+// given prefix are next to each other, so a prefix query is two binary
+// searches and a walk over the range in between.
+class PrefixIndex {
+public:
+  PrefixIndex() {}
+
+  void Build(const FileTable& files);
+
+  // Shrinks the positions [*begin, *end) to those whose names start with
+  // |txt|. Pass [0, size) for the whole table. The range of a longer prefix
+  // is always inside the range of a shorter one, so typing only ever narrows.
+  void Narrow(const FileTable& files, const char* txt, size_t len,
+              size_t* begin, size_t* end) const;
+
+  // The file at position |pos| of the sorted order.
+  uint32_t file(size_t pos) const { return sorted_[pos]; }
+
+  size_t memory_size() const { return sorted_.memory_size(); }
+
+  void Write(SnapshotWriter* out) const;
+  // |files| is how many files the index was built over.
+  bool Map(SnapshotReader* in, size_t files);
+
+private:
+  PodArray<uint32_t> sorted_;
+
+  PrefixIndex(const PrefixIndex&);
+  void operator=(const PrefixIndex&);
+};
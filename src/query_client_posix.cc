@@ -0,0 +1,240 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+//
+// Command line client of kodefind_server. Opens the index of a tree, which
+// the server builds if it has not yet, and prints the matches of each query
+// one per line, the text hits as path(line): text.
+//
+// usage: kodefind_client [--socket path] [--root dir] [--mode m] [--all]
+//            [--budget ms] [query...]
+//
+// The modes are substring, prefix, fuzzy, content and text. The name modes
+// print the first batch, or every match with --all. Without queries on the
+// command line they are read from stdin, one per line, on the same session:
+// typing a longer query after a shorter one narrows the previous matches
+// like the dialog does.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "code_search.h"
+#include "query_protocol.h"
+
+namespace {
+  const uint32_t kMaxTextHits = 1000;
+
+  struct Params {
+    std::string socket;
+    std::string root;
+    std::string mode;
+    bool all;
+    uint32_t budget_ms;
+    std::vector<std::string> queries;
+
+    Params() : socket(DefaultQuerySocket()), root("."), mode("substring"), all(false),
+               budget_ms(0) {}
+  };
+
+  int Connect(const std::string& path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+      return -1;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+      return -1;
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+      ::close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  // Sends |request| and sets |body| to what follows kQueryOk in the reply.
+  // Returns false, having said why, if the server fails or says it can't.
+  bool Call(int fd, QueryWriter* request, std::string* body) {
+    if (!WriteQueryFrame(fd, request->frame()) || !ReadQueryFrame(fd, body)) {
+      fprintf(stderr, "the server went away\n");
+      return false;
+    }
+    QueryReader in(body->data(), body->size());
+    uint8_t result = kQueryError;
+    in.U8(&result);
+    if (result != kQueryOk) {
+      std::string reason;
+      in.String(&reason);
+      fprintf(stderr, "error: %s\n", reason.c_str());
+      return false;
+    }
+    body->erase(0, 1);
+    return true;
+  }
+
+  bool PrintPaths(QueryReader* in) {
+    uint32_t count = 0;
+    in->U32(&count);
+    std::string path;
+    for (uint32_t ix = 0; (ix != count) && in->String(&path); ++ix) {
+      printf("%s\n", path.c_str());
+    }
+    return in->ok();
+  }
+
+  bool NameQuery(int fd, uint32_t index, const Params& params, const std::string& query) {
+    uint8_t options = CodeSearch::Substring;
+    if (params.mode == "prefix")
+      options = CodeSearch::BeginsWith;
+    else if (params.mode == "fuzzy")
+      options = CodeSearch::Fuzzy;
+
+    QueryWriter request(kQuerySearch);
+    request.U32(index);
+    request.U8(options);
+    request.U32(params.budget_ms);
+    request.String(query);
+    while (true) {
+      std::string body;
+      if (!Call(fd, &request, &body))
+        return false;
+      QueryReader in(body.data(), body.size());
+      uint8_t status = CodeSearch::Done;
+      in.U8(&status);
+      bool ok = PrintPaths(&in);
+      if (!ok || !params.all || (status == CodeSearch::Done) ||
+          (status == CodeSearch::Cancelled))
+        return ok;
+      request = QueryWriter(kQueryContinue);
+      request.U32(index);
+      request.U32(params.budget_ms);
+    }
+  }
+
+  bool ContentQuery(int fd, uint32_t index, const Params& params, const std::string& query) {
+    const bool text = (params.mode == "text");
+    QueryWriter request(text ? kQuerySearchText : kQuerySearchContent);
+    request.U32(index);
+    if (text) {
+      request.U32(CodeSearch::TextRegex);
+      request.U32(kMaxTextHits);
+    }
+    request.String(query);
+    std::string body;
+    if (!Call(fd, &request, &body))
+      return false;
+    QueryReader in(body.data(), body.size());
+    uint8_t partial = 0;
+    in.U8(&partial);
+    if (partial)
+      fprintf(stderr, "the content index is still being built\n");
+    bool ok;
+    if (text) {
+      uint32_t count = 0;
+      in.U32(&count);
+      std::string path;
+      uint32_t line;
+      std::string line_text;
+      for (uint32_t ix = 0; (ix != count) && in.String(&path) && in.U32(&line) &&
+                            in.String(&line_text); ++ix) {
+        printf("%s(%u): %s\n", path.c_str(), line, line_text.c_str());
+      }
+      ok = in.ok();
+    } else {
+      ok = PrintPaths(&in);
+    }
+    return ok;
+  }
+
+  bool ParseArgs(int argc, char* argv[], Params* params) {
+    for (int ix = 1; ix < argc; ++ix) {
+      std::string arg = argv[ix];
+      if (arg == "--all") {
+        params->all = true;
+        continue;
+      }
+      if (arg.compare(0, 2, "--") != 0) {
+        params->queries.push_back(arg);
+        continue;
+      }
+      if (ix + 1 == argc)
+        return false;
+      const char* value = argv[++ix];
+      if (arg == "--socket")
+        params->socket = value;
+      else if (arg == "--root")
+        params->root = value;
+      else if (arg == "--mode")
+        params->mode = value;
+      else if (arg == "--budget")
+        params->budget_ms = static_cast<uint32_t>(strtoul(value, NULL, 10));
+      else
+        return false;
+    }
+    const std::string& mode = params->mode;
+    return (mode == "substring") || (mode == "prefix") || (mode == "fuzzy") ||
+           (mode == "content") || (mode == "text");
+  }
+}
+
+int main(int argc, char* argv[]) {
+  Params params;
+  if (!ParseArgs(argc, argv, &params)) {
+    fprintf(stderr, "usage: kodefind_client [--socket path] [--root dir] [--mode m] [--all]\n"
+                    "    [--budget ms] [query...]\n"
+                    "modes: substring, prefix, fuzzy, content, text\n");
+    return 1;
+  }
+
+  // The server has another working directory.
+  char* real = ::realpath(params.root.c_str(), NULL);
+  if (!real) {
+    fprintf(stderr, "no such directory %s\n", params.root.c_str());
+    return 1;
+  }
+  std::string root(real);
+  free(real);
+
+  int fd = Connect(params.socket);
+  if (fd < 0) {
+    fprintf(stderr, "can't connect to %s: %s\n", params.socket.c_str(), strerror(errno));
+    return 1;
+  }
+
+  QueryWriter open(kQueryOpen);
+  open.String(root);
+  std::string body;
+  if (!Call(fd, &open, &body))
+    return 1;
+  QueryReader in(body.data(), body.size());
+  uint32_t index = 0;
+  in.U32(&index);
+
+  const bool names = (params.mode != "content") && (params.mode != "text");
+  bool ok = true;
+  if (!params.queries.empty()) {
+    for (size_t ix = 0; ok && (ix != params.queries.size()); ++ix) {
+      ok = names ? NameQuery(fd, index, params, params.queries[ix]) :
+                   ContentQuery(fd, index, params, params.queries[ix]);
+    }
+  } else {
+    char line[4096];
+    while (ok && fgets(line, sizeof(line), stdin)) {
+      std::string query(line);
+      while (!query.empty() && ((query.back() == '\n') || (query.back() == '\r')))
+        query.erase(query.size() - 1);
+      ok = names ? NameQuery(fd, index, params, query) : ContentQuery(fd, index, params, query);
+      fflush(stdout);
+    }
+  }
+  ::close(fd);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+// The messages between kodefind_server and its clients, over a Unix socket.
+// Each one is a frame: its length as a 32 bit integer and then that many
+// bytes, the first being the message type. Integers are little endian,
+// strings are UTF-8 after their length as a 32 bit integer. A client sends a
+// request and reads its reply before sending the next one.
+//
+//   kQueryOpen           root             -> index
+//   kQuerySearch         index u8:options u32:budget_ms text
+//                                         -> u8:status u32:n n*path
+//   kQueryContinue       index u32:budget_ms
+//                                         -> u8:status u32:n n*path
+//   kQuerySearchContent  index token      -> u8:partial u32:n n*path
+//   kQuerySearchText     index u32:flags u32:max_hits pattern
+//                                         -> u8:partial u32:n n*(path u32:line text)
+//
+// Every reply starts with kQueryOk, or kQueryError and the reason. |index|
+// is a u32 that kQueryOpen hands out, any client can use it. The options,
+// status and flags are the CodeSearch ones. Search and Continue go on from
+// where the last query of the same connection on the same index was, see
+// CodeSearch::Session.
+enum QueryMessage {
+  kQueryOpen = 1,
+  kQuerySearch,
+  kQueryContinue,
+  kQuerySearchContent,
+  kQuerySearchText
+};
+
+enum QueryReply {
+  kQueryOk = 0,
+  kQueryError
+};
+
+// Bigger frames come from a broken peer.
+const size_t kMaxQueryFrame = 64 * 1024 * 1024;
+
+// Builds a frame.
+class QueryWriter {
+public:
+  explicit QueryWriter(uint8_t type);
+
+  void U8(uint8_t value);
+  void U32(uint32_t value);
+  void String(const char* str, size_t len);
+  void String(const std::string& str) { String(str.data(), str.size()); }
+
+  // The frame, length included.
+  const std::string& frame();
+
+private:
+  std::string frame_;
+};
+
+// Takes the body of a frame apart. Once a read runs past the end every read
+// after it fails, so a message can be read whole and checked once.
+class QueryReader {
+public:
+  QueryReader(const char* data, size_t size);
+
+  bool U8(uint8_t* value);
+  bool U32(uint32_t* value);
+  bool String(std::string* str);
+
+  bool ok() const { return ok_; }
+
+private:
+  const char* data_;
+  size_t size_;
+  size_t pos_;
+  bool ok_;
+};
+
+// Where the server listens unless told otherwise: kodefind.sock in
+// $XDG_RUNTIME_DIR, or /tmp/kodefind-<uid>.sock without it.
+std::string DefaultQuerySocket();
+
+// Blocking I/O of whole frames. ReadQueryFrame() sets |body| to what follows
+// the length. Both return false on errors and once the peer is gone.
+bool WriteQueryFrame(int fd, const std::string& frame);
+bool ReadQueryFrame(int fd, std::string* body);
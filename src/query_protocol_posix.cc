@@ -0,0 +1,135 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "query_protocol.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+  void PutU32(uint32_t value, char* out) {
+    out[0] = static_cast<char>(value);
+    out[1] = static_cast<char>(value >> 8);
+    out[2] = static_cast<char>(value >> 16);
+    out[3] = static_cast<char>(value >> 24);
+  }
+
+  uint32_t GetU32(const char* in) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(in);
+    return static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8) |
+           (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+  }
+
+  bool ReadAll(int fd, char* buf, size_t size) {
+    while (size) {
+      ssize_t got = ::recv(fd, buf, size, 0);
+      if (got < 0 && errno == EINTR)
+        continue;
+      if (got <= 0)
+        return false;
+      buf += got;
+      size -= got;
+    }
+    return true;
+  }
+}
+
+QueryWriter::QueryWriter(uint8_t type) : frame_(4, '\0') {
+  frame_.append(1, static_cast<char>(type));
+}
+
+void QueryWriter::U8(uint8_t value) {
+  frame_.append(1, static_cast<char>(value));
+}
+
+void QueryWriter::U32(uint32_t value) {
+  char bytes[4];
+  PutU32(value, bytes);
+  frame_.append(bytes, 4);
+}
+
+void QueryWriter::String(const char* str, size_t len) {
+  U32(static_cast<uint32_t>(len));
+  frame_.append(str, len);
+}
+
+const std::string& QueryWriter::frame() {
+  PutU32(static_cast<uint32_t>(frame_.size() - 4), &frame_[0]);
+  return frame_;
+}
+
+QueryReader::QueryReader(const char* data, size_t size)
+    : data_(data), size_(size), pos_(0), ok_(true) {
+}
+
+bool QueryReader::U8(uint8_t* value) {
+  if (size_ - pos_ < 1)
+    ok_ = false;
+  if (!ok_)
+    return false;
+  *value = static_cast<uint8_t>(data_[pos_++]);
+  return true;
+}
+
+bool QueryReader::U32(uint32_t* value) {
+  if (size_ - pos_ < 4)
+    ok_ = false;
+  if (!ok_)
+    return false;
+  *value = GetU32(data_ + pos_);
+  pos_ += 4;
+  return true;
+}
+
+bool QueryReader::String(std::string* str) {
+  uint32_t len;
+  if (!U32(&len))
+    return false;
+  if (size_ - pos_ < len)
+    ok_ = false;
+  if (!ok_)
+    return false;
+  str->assign(data_ + pos_, len);
+  pos_ += len;
+  return true;
+}
+
+std::string DefaultQuerySocket() {
+  const char* runtime = ::getenv("XDG_RUNTIME_DIR");
+  if (runtime && *runtime)
+    return std::string(runtime) + "/kodefind.sock";
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/kodefind-%u.sock", static_cast<unsigned int>(::getuid()));
+  return path;
+}
+
+// One send() per frame, a reply never waits on a second system call to go out.
+bool WriteQueryFrame(int fd, const std::string& frame) {
+  const char* data = frame.data();
+  size_t size = frame.size();
+  while (size) {
+    ssize_t sent = ::send(fd, data, size, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR)
+      continue;
+    if (sent <= 0)
+      return false;
+    data += sent;
+    size -= sent;
+  }
+  return true;
+}
+
+bool ReadQueryFrame(int fd, std::string* body) {
+  char len[4];
+  if (!ReadAll(fd, len, 4))
+    return false;
+  uint32_t size = GetU32(len);
+  if (!size || (size > kMaxQueryFrame))
+    return false;
+  body->resize(size);
+  return ReadAll(fd, &(*body)[0], size);
+}
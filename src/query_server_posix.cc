@@ -0,0 +1,380 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+//
+// Headless kodefind. Keeps the indexes of one or more trees in memory, warm
+// and following the changes to the files, and answers the queries of any
+// number of clients over a Unix socket, see query_protocol.h. Each
+// connection gets a thread and a CodeSearch::Session per index it queries,
+// so clients typing at once don't step on each other's Continue().
+//
+// usage: kodefind_server [--socket path] [--no-content] [root...]
+//
+// The roots given are indexed before the server listens, others are indexed
+// the first time a client opens them.
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "code_search.h"
+#include "query_protocol.h"
+#include "scoped_ptr.h"
+#include "utf8.h"
+
+namespace {
+  class Progress : public CodeSearch::Client {
+  public:
+    virtual bool OnIndexProgress(CodeSearch* engine, size_t files, size_t dirs) override {
+      return true;
+    }
+    virtual bool OnContentProgress(CodeSearch* engine,
+                                   const CodeSearch::ContentProgress& progress) override {
+      return true;
+    }
+    virtual bool OnError(int error_code) override {
+      return false;
+    }
+  };
+
+  // A tree and its engine. Indexed once, by whoever opens it first; the
+  // others wait on |lock| meanwhile.
+  struct Index {
+    std::wstring root;
+    std::mutex lock;
+    bool indexed;
+    int error;
+    scoped_ptr<CodeSearch> engine;
+
+    Index() : indexed(false), error(0) {}
+  };
+
+  struct Server {
+    bool content;
+    Progress progress;
+    std::mutex lock;
+    // Never shrinks, the position is the id the clients get.
+    std::vector<Index*> indexes;
+
+    Server() : content(true) {}
+  };
+
+  Server g_server;
+  volatile sig_atomic_t g_quit = 0;
+
+  void OnQuitSignal(int) {
+    g_quit = 1;
+  }
+
+  std::string Utf8(const std::wstring& str) {
+    return WideToUtf8(str.c_str(), str.size());
+  }
+
+  Index* FindIndex(uint32_t id) {
+    std::lock_guard<std::mutex> lock(g_server.lock);
+    return (id < g_server.indexes.size()) ? g_server.indexes[id] : NULL;
+  }
+
+  // Returns the id of the index of |root|, indexing it if no one has.
+  // Returns -1 if it can't be indexed.
+  int OpenIndex(const std::wstring& root) {
+    Index* index = NULL;
+    size_t id;
+    {
+      std::lock_guard<std::mutex> lock(g_server.lock);
+      for (id = 0; id != g_server.indexes.size(); ++id) {
+        if (g_server.indexes[id]->root == root)
+          break;
+      }
+      if (id == g_server.indexes.size()) {
+        g_server.indexes.push_back(new Index);
+        g_server.indexes.back()->root = root;
+      }
+      index = g_server.indexes[id];
+    }
+
+    std::lock_guard<std::mutex> lock(index->lock);
+    if (!index->indexed) {
+      index->indexed = true;
+      index->engine.reset(CodeSearchFactory(NULL));
+      index->error = index->engine->Index(root.c_str(), &g_server.progress);
+      if (index->error == 0) {
+        fprintf(stderr, "indexed %s\n", Utf8(root).c_str());
+        index->engine->Watch();
+        if (g_server.content)
+          index->engine->IndexContent(NULL);
+      } else {
+        fprintf(stderr, "can't index %s: %d\n", Utf8(root).c_str(), index->error);
+      }
+    }
+    return (index->error == 0) ? static_cast<int>(id) : -1;
+  }
+
+  void PutPaths(const std::vector<std::wstring>& paths, QueryWriter* out) {
+    out->U32(static_cast<uint32_t>(paths.size()));
+    for (size_t ix = 0; ix != paths.size(); ++ix) {
+      out->String(Utf8(paths[ix]));
+    }
+  }
+
+  // What a connection keeps between requests.
+  class Connection {
+  public:
+    explicit Connection(int fd) : fd_(fd), path_(260) {}
+
+    ~Connection() {
+      for (std::map<Index*, CodeSearch::Session*>::iterator it = sessions_.begin();
+           it != sessions_.end(); ++it) {
+        delete it->second;
+      }
+      ::close(fd_);
+    }
+
+    void Run() {
+      std::string body;
+      while (ReadQueryFrame(fd_, &body)) {
+        QueryReader in(body.data(), body.size());
+        uint8_t type = 0;
+        in.U8(&type);
+        std::string reply = Handle(type, &in);
+        if (!WriteQueryFrame(fd_, reply))
+          break;
+      }
+    }
+
+  private:
+    static std::string Error(const char* reason) {
+      QueryWriter out(kQueryError);
+      out.String(reason, strlen(reason));
+      return out.frame();
+    }
+
+    // The path goes straight from the engine, already in UTF-8, to a buffer
+    // the connection reuses.
+    std::string PathOf(CodeSearch* engine, CodeSearch::FileId id) {
+      size_t len = engine->GetPathUtf8(id, &path_[0], path_.size());
+      if (len >= path_.size()) {
+        path_.resize(len + 1);
+        len = engine->GetPathUtf8(id, &path_[0], path_.size());
+      }
+      return std::string(&path_[0], len);
+    }
+
+    CodeSearch::Session* SessionFor(Index* index) {
+      CodeSearch::Session*& session = sessions_[index];
+      if (!session)
+        session = index->engine->NewSession();
+      return session;
+    }
+
+    // Only the indexes that made it past OpenIndex() are usable.
+    Index* ReadIndex(QueryReader* in) {
+      uint32_t id;
+      if (!in->U32(&id))
+        return NULL;
+      Index* index = FindIndex(id);
+      if (!index)
+        return NULL;
+      std::lock_guard<std::mutex> lock(index->lock);
+      return (index->indexed && (index->error == 0)) ? index : NULL;
+    }
+
+    std::string Handle(uint8_t type, QueryReader* in) {
+      QueryWriter out(kQueryOk);
+      if (type == kQueryOpen) {
+        std::string root;
+        if (!in->String(&root))
+          return Error("bad request");
+        int id = OpenIndex(Utf8ToWide(root.c_str(), root.size()));
+        if (id < 0)
+          return Error("can't index the directory");
+        out.U32(static_cast<uint32_t>(id));
+        return out.frame();
+      }
+
+      Index* index = ReadIndex(in);
+      if (!index)
+        return Error("no such index");
+      CodeSearch* engine = index->engine.get();
+
+      if ((type == kQuerySearch) || (type == kQueryContinue)) {
+        uint8_t options = 0;
+        std::string text;
+        CodeSearch::Control control = { NULL, 0, 0 };
+        if (type == kQuerySearch)
+          in->U8(&options);
+        in->U32(&control.budget_ms);
+        if (type == kQuerySearch)
+          in->String(&text);
+        if (!in->ok() || (type == kQuerySearch && (options < CodeSearch::Substring ||
+                                                   options > CodeSearch::Fuzzy)))
+          return Error("bad request");
+
+        CodeSearch::Status status;
+        if (type == kQuerySearch) {
+          std::wstring wide = Utf8ToWide(text.c_str(), text.size());
+          status = engine->SearchIds(SessionFor(index), wide.c_str(),
+                                     static_cast<CodeSearch::Options>(options), control, &ids_);
+        } else {
+          status = engine->ContinueIds(SessionFor(index), control, &ids_);
+        }
+        out.U8(static_cast<uint8_t>(status));
+        out.U32(static_cast<uint32_t>(ids_.size()));
+        for (size_t ix = 0; ix != ids_.size(); ++ix) {
+          out.String(PathOf(engine, ids_[ix]));
+        }
+        return out.frame();
+      }
+
+      if (type == kQuerySearchContent) {
+        std::string token;
+        if (!in->String(&token))
+          return Error("bad request");
+        bool partial = false;
+        std::wstring wide = Utf8ToWide(token.c_str(), token.size());
+        std::vector<std::wstring> paths = engine->SearchContent(wide.c_str(), &partial);
+        out.U8(partial ? 1 : 0);
+        PutPaths(paths, &out);
+        return out.frame();
+      }
+
+      if (type == kQuerySearchText) {
+        uint32_t flags = 0;
+        uint32_t max_hits = 0;
+        std::string pattern;
+        in->U32(&flags);
+        in->U32(&max_hits);
+        if (!in->String(&pattern))
+          return Error("bad request");
+        std::vector<CodeSearch::TextHit> hits;
+        bool partial = false;
+        std::string error;
+        std::wstring wide = Utf8ToWide(pattern.c_str(), pattern.size());
+        if (engine->SearchText(wide.c_str(), flags, max_hits, &hits, &partial, &error) != 0)
+          return Error(error.c_str());
+        out.U8(partial ? 1 : 0);
+        out.U32(static_cast<uint32_t>(hits.size()));
+        for (size_t ix = 0; ix != hits.size(); ++ix) {
+          out.String(Utf8(hits[ix].path));
+          out.U32(static_cast<uint32_t>(hits[ix].line));
+          out.String(Utf8(hits[ix].text));
+        }
+        return out.frame();
+      }
+
+      return Error("unknown request");
+    }
+
+    int fd_;
+    // The engines outlive the connections, the sessions go first.
+    std::map<Index*, CodeSearch::Session*> sessions_;
+    std::vector<CodeSearch::FileId> ids_;
+    std::vector<char> path_;
+  };
+
+  void Serve(int fd) {
+    Connection connection(fd);
+    connection.Run();
+  }
+
+  int Listen(const std::string& path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+      return -1;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+      return -1;
+    // A socket file left by a server that died is in the way. One that is
+    // alive answers the connect.
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+      ::close(fd);
+      errno = EADDRINUSE;
+      return -1;
+    }
+    ::unlink(path.c_str());
+    if ((::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) ||
+        (::listen(fd, SOMAXCONN) != 0)) {
+      ::close(fd);
+      return -1;
+    }
+    return fd;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  std::string socket_path = DefaultQuerySocket();
+  std::vector<std::string> roots;
+  for (int ix = 1; ix < argc; ++ix) {
+    std::string arg = argv[ix];
+    if (arg == "--no-content") {
+      g_server.content = false;
+    } else if ((arg == "--socket") && (ix + 1 < argc)) {
+      socket_path = argv[++ix];
+    } else if (arg.compare(0, 2, "--") == 0) {
+      fprintf(stderr, "usage: kodefind_server [--socket path] [--no-content] [root...]\n");
+      return 1;
+    } else {
+      roots.push_back(arg);
+    }
+  }
+
+  for (size_t ix = 0; ix != roots.size(); ++ix) {
+    char* real = ::realpath(roots[ix].c_str(), NULL);
+    if (!real || (OpenIndex(Utf8ToWide(real, strlen(real))) < 0)) {
+      fprintf(stderr, "can't index %s\n", roots[ix].c_str());
+      free(real);
+      return 1;
+    }
+    free(real);
+  }
+
+  int listen_fd = Listen(socket_path);
+  if (listen_fd < 0) {
+    fprintf(stderr, "can't listen on %s: %s\n", socket_path.c_str(), strerror(errno));
+    return 1;
+  }
+  fprintf(stderr, "listening on %s\n", socket_path.c_str());
+
+  // Without SA_RESTART, so that the signal gets accept() out.
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = OnQuitSignal;
+  ::sigaction(SIGINT, &action, NULL);
+  ::sigaction(SIGTERM, &action, NULL);
+
+  while (!g_quit) {
+    int fd = ::accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if ((errno == EINTR) || (errno == ECONNABORTED))
+        continue;
+      // Out of descriptors, until some connection closes.
+      if ((errno == EMFILE) || (errno == ENFILE)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        continue;
+      }
+      fprintf(stderr, "accept failed: %s\n", strerror(errno));
+      break;
+    }
+    std::thread(Serve, fd).detach();
+  }
+
+  // The connection threads and the engines go away with the process.
+  ::close(listen_fd);
+  ::unlink(socket_path.c_str());
+  return 0;
+}
@@ -0,0 +1,795 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "regex_match.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace {
+  // Repetitions are unrolled, this keeps something like (a{100}){100} out.
+  const size_t kMaxProgram = 20 * 1000;
+  // The largest count of a {n,m}.
+  const int kMaxRepeat = 1000;
+  // An unbounded repetition.
+  const int kInfinite = -1;
+  // Past this many alternatives, or this many bytes in one of them, a part
+  // of the pattern is no longer tracked as the strings it can match, only by
+  // the trigrams it needs.
+  const size_t kMaxExact = 16;
+  const size_t kMaxExactBytes = 256;
+
+  enum Assertion {
+    kBeginLine,
+    kEndLine,
+    kWordBoundary,
+    kNotWordBoundary
+  };
+
+  bool IsWordByte(unsigned char c) {
+    return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) ||
+           ((c >= '0') && (c <= '9')) || (c == '_');
+  }
+
+  unsigned char Fold(unsigned char c) {
+    return ((c >= 'A') && (c <= 'Z')) ? static_cast<unsigned char>(c + ('a' - 'A')) : c;
+  }
+}
+
+// The parsed pattern.
+struct RegexQuery::Node {
+  enum Kind {
+    kBytes,
+    kEmpty,
+    kConcat,
+    kAlternate,
+    kRepeat,
+    kAssert
+  };
+
+  Kind kind;
+  ByteSet bytes;
+  // kRepeat: [min, max] times |subs[0]|.
+  int min;
+  int max;
+  Assertion assertion;
+  std::vector<Node> subs;
+
+  explicit Node(Kind i_kind) : kind(i_kind), min(0), max(0), assertion(kBeginLine) {
+    memset(bytes.bits, 0, sizeof(bytes.bits));
+  }
+
+  void Add(unsigned char c) { bytes.bits[c >> 5] |= 1u << (c & 31); }
+  void AddRange(unsigned char lo, unsigned char hi) {
+    for (unsigned int c = lo; c <= hi; ++c) {
+      Add(static_cast<unsigned char>(c));
+    }
+  }
+};
+
+// Recursive descent over the pattern, one byte at a time.
+class RegexQuery::Parser {
+public:
+  Parser(const std::string& pattern, bool ignore_case)
+      : pos_(pattern.data()), end_(pattern.data() + pattern.size()),
+        ignore_case_(ignore_case) {}
+
+  bool Parse(Node* root, std::string* error) {
+    if (!Alternate(root) || (pos_ != end_)) {
+      *error = error_.empty() ? "unmatched )" : error_;
+      return false;
+    }
+    return true;
+  }
+
+private:
+  bool Fail(const char* why) {
+    if (error_.empty())
+      error_ = why;
+    return false;
+  }
+
+  bool Alternate(Node* out) {
+    Node first(Node::kConcat);
+    if (!Concat(&first))
+      return false;
+    if ((pos_ == end_) || (*pos_ != '|')) {
+      *out = first;
+      return true;
+    }
+    *out = Node(Node::kAlternate);
+    out->subs.push_back(first);
+    while ((pos_ != end_) && (*pos_ == '|')) {
+      ++pos_;
+      Node next(Node::kConcat);
+      if (!Concat(&next))
+        return false;
+      out->subs.push_back(next);
+    }
+    return true;
+  }
+
+  bool Concat(Node* out) {
+    while ((pos_ != end_) && (*pos_ != '|') && (*pos_ != ')')) {
+      Node atom(Node::kEmpty);
+      if (!Atom(&atom) || !Repeats(&atom))
+        return false;
+      out->subs.push_back(atom);
+    }
+    return true;
+  }
+
+  // Reads a count of a {n,m}, false if there is none. Past kMaxRepeat the
+  // digits are still read but the value stays above it.
+  bool Number(int* value) {
+    const char* start = pos_;
+    int number = 0;
+    while ((pos_ != end_) && (*pos_ >= '0') && (*pos_ <= '9')) {
+      if (number <= kMaxRepeat)
+        number = number * 10 + (*pos_ - '0');
+      ++pos_;
+    }
+    *value = number;
+    return pos_ != start;
+  }
+
+  // Parses {n}, {n,} or {n,m} after the '{'. Leaves |pos_| alone and returns
+  // false if it is not one, the '{' is then a plain character.
+  bool Braces(int* min, int* max) {
+    const char* start = pos_;
+    if (!Number(min)) {
+      pos_ = start;
+      return false;
+    }
+    *max = *min;
+    if ((pos_ != end_) && (*pos_ == ',')) {
+      ++pos_;
+      if (!Number(max))
+        *max = kInfinite;
+    }
+    if ((pos_ == end_) || (*pos_ != '}')) {
+      pos_ = start;
+      return false;
+    }
+    ++pos_;
+    return true;
+  }
+
+  bool Repeats(Node* atom) {
+    while (pos_ != end_) {
+      int min, max;
+      char c = *pos_;
+      if (c == '*') {
+        min = 0;
+        max = kInfinite;
+        ++pos_;
+      } else if (c == '+') {
+        min = 1;
+        max = kInfinite;
+        ++pos_;
+      } else if (c == '?') {
+        min = 0;
+        max = 1;
+        ++pos_;
+      } else if (c == '{') {
+        ++pos_;
+        if (!Braces(&min, &max)) {
+          --pos_;
+          return true;
+        }
+        if ((min > kMaxRepeat) || (max > kMaxRepeat))
+          return Fail("repetition count too big");
+        if ((max != kInfinite) && (max < min))
+          return Fail("bad repetition range");
+      } else {
+        return true;
+      }
+      if ((atom->kind == Node::kAssert) || (atom->kind == Node::kEmpty))
+        return Fail("missing argument to repetition operator");
+      // Lazy or not, it matches the same lines.
+      if ((pos_ != end_) && (*pos_ == '?'))
+        ++pos_;
+      Node repeat(Node::kRepeat);
+      repeat.min = min;
+      repeat.max = max;
+      repeat.subs.push_back(*atom);
+      *atom = repeat;
+    }
+    return true;
+  }
+
+  void Literal(unsigned char c, Node* out) {
+    out->Add(c);
+    if (ignore_case_ && IsWordByte(c)) {
+      out->Add(Fold(c));
+      if ((c >= 'a') && (c <= 'z'))
+        out->Add(static_cast<unsigned char>(c - ('a' - 'A')));
+    }
+  }
+
+  // The \d \w \s classes and their complements into |out|. Returns false if
+  // |c| is not one.
+  bool ClassEscape(char c, Node* out) {
+    Node set(Node::kBytes);
+    switch (c) {
+      case 'd': case 'D':
+        set.AddRange('0', '9');
+        break;
+      case 'w': case 'W':
+        set.AddRange('a', 'z');
+        set.AddRange('A', 'Z');
+        set.AddRange('0', '9');
+        set.Add('_');
+        break;
+      case 's': case 'S':
+        set.Add(' ');
+        set.AddRange('\t', '\r');
+        break;
+      default:
+        return false;
+    }
+    bool negate = (c >= 'A') && (c <= 'Z');
+    for (size_t ix = 0; ix != 8; ++ix) {
+      out->bytes.bits[ix] |= negate ? ~set.bytes.bits[ix] : set.bytes.bits[ix];
+    }
+    return true;
+  }
+
+  // The byte an escape like \t or \. stands for.
+  bool EscapedByte(unsigned char* c) {
+    if (pos_ == end_)
+      return Fail("trailing backslash");
+    char e = *pos_++;
+    switch (e) {
+      case 't': *c = '\t'; return true;
+      case 'n': *c = '\n'; return true;
+      case 'r': *c = '\r'; return true;
+      case 'f': *c = '\f'; return true;
+      case 'v': *c = '\v'; return true;
+      case '0': *c = 0; return true;
+    }
+    if (((e >= 'a') && (e <= 'z')) || ((e >= 'A') && (e <= 'Z')) || ((e >= '0') && (e <= '9')))
+      return Fail("unknown escape");
+    *c = static_cast<unsigned char>(e);
+    return true;
+  }
+
+  bool Class(Node* out) {
+    *out = Node(Node::kBytes);
+    bool negate = (pos_ != end_) && (*pos_ == '^');
+    if (negate)
+      ++pos_;
+    bool first = true;
+    while (true) {
+      if (pos_ == end_)
+        return Fail("missing ]");
+      if ((*pos_ == ']') && !first)
+        break;
+      first = false;
+      unsigned char lo = static_cast<unsigned char>(*pos_++);
+      if (lo == '\\') {
+        if ((pos_ != end_) && ClassEscape(*pos_, out)) {
+          ++pos_;
+          continue;
+        }
+        if (!EscapedByte(&lo))
+          return false;
+      }
+      unsigned char hi = lo;
+      if ((end_ - pos_ >= 2) && (pos_[0] == '-') && (pos_[1] != ']')) {
+        ++pos_;
+        hi = static_cast<unsigned char>(*pos_++);
+        if ((hi == '\\') && !EscapedByte(&hi))
+          return false;
+        if (hi < lo)
+          return Fail("bad class range");
+      }
+      for (unsigned int c = lo; c <= hi; ++c) {
+        Literal(static_cast<unsigned char>(c), out);
+      }
+    }
+    ++pos_;
+    if (negate) {
+      for (size_t ix = 0; ix != 8; ++ix) {
+        out->bytes.bits[ix] = ~out->bytes.bits[ix];
+      }
+    }
+    return true;
+  }
+
+  bool Atom(Node* out) {
+    unsigned char c = static_cast<unsigned char>(*pos_++);
+    switch (c) {
+      case '(': {
+        if ((end_ - pos_ >= 2) && (pos_[0] == '?') && (pos_[1] == ':'))
+          pos_ += 2;
+        else if ((pos_ != end_) && (*pos_ == '?'))
+          return Fail("unsupported group");
+        if (!Alternate(out))
+          return false;
+        if ((pos_ == end_) || (*pos_ != ')'))
+          return Fail("missing )");
+        ++pos_;
+        return true;
+      }
+      case '[':
+        return Class(out);
+      case '.':
+        *out = Node(Node::kBytes);
+        out->AddRange(0, 0xFF);
+        out->bytes.bits['\n' >> 5] &= ~(1u << ('\n' & 31));
+        return true;
+      case '^':
+      case '$':
+        *out = Node(Node::kAssert);
+        out->assertion = (c == '^') ? kBeginLine : kEndLine;
+        return true;
+      case '*':
+      case '+':
+      case '?':
+        return Fail("missing argument to repetition operator");
+      case '\\':
+        if (pos_ != end_) {
+          if ((*pos_ == 'b') || (*pos_ == 'B')) {
+            *out = Node(Node::kAssert);
+            out->assertion = (*pos_ == 'b') ? kWordBoundary : kNotWordBoundary;
+            ++pos_;
+            return true;
+          }
+          *out = Node(Node::kBytes);
+          if (ClassEscape(*pos_, out)) {
+            ++pos_;
+            return true;
+          }
+        }
+        if (!EscapedByte(&c))
+          return false;
+        break;
+    }
+    *out = Node(Node::kBytes);
+    Literal(c, out);
+    if (c < 0xC0)
+      return true;
+
+    // The rest of a UTF-8 character goes with its first byte, so that a
+    // repetition after it takes all of it.
+    Node seq(Node::kConcat);
+    seq.subs.push_back(*out);
+    while ((pos_ != end_) && ((static_cast<unsigned char>(*pos_) & 0xC0) == 0x80)) {
+      Node next(Node::kBytes);
+      next.Add(static_cast<unsigned char>(*pos_++));
+      seq.subs.push_back(next);
+    }
+    *out = seq;
+    return true;
+  }
+
+  const char* pos_;
+  const char* end_;
+  bool ignore_case_;
+  std::string error_;
+};
+
+namespace {
+  // What a part of the pattern says about the lines it matches: either the
+  // few strings it can match, folded, or the trigrams any match has.
+  struct Info {
+    bool exact;
+    std::vector<std::string> strings;
+    TrigramQuery match;
+
+    Info() : exact(true), strings(1) {}
+
+    TrigramQuery Query() const {
+      if (!exact)
+        return match;
+      TrigramQuery query(TrigramQuery::kNone);
+      for (size_t ix = 0; ix != strings.size(); ++ix) {
+        query = TrigramQuery::Or(query, TrigramQuery::Literal(strings[ix]));
+      }
+      return query;
+    }
+
+    void SetMatch(const TrigramQuery& query) {
+      exact = false;
+      strings.clear();
+      match = query;
+    }
+  };
+
+  void Dedup(std::vector<std::string>* strings) {
+    std::sort(strings->begin(), strings->end());
+    strings->erase(std::unique(strings->begin(), strings->end()), strings->end());
+  }
+
+  size_t Longest(const std::vector<std::string>& strings) {
+    size_t longest = 0;
+    for (size_t ix = 0; ix != strings.size(); ++ix) {
+      longest = std::max(longest, strings[ix].size());
+    }
+    return longest;
+  }
+
+  // Whether |info| followed by |next| can still be kept as strings.
+  bool ConcatExact(const Info& info, const Info& next) {
+    return info.exact && next.exact &&
+           (info.strings.size() * next.strings.size() <= kMaxExact) &&
+           (Longest(info.strings) + Longest(next.strings) <= kMaxExactBytes);
+  }
+
+  // |info| followed by |next|.
+  void Concat(const Info& next, Info* info) {
+    if (ConcatExact(*info, next)) {
+      std::vector<std::string> product;
+      for (size_t ix = 0; ix != info->strings.size(); ++ix) {
+        for (size_t nx = 0; nx != next.strings.size(); ++nx) {
+          product.push_back(info->strings[ix] + next.strings[nx]);
+        }
+      }
+      Dedup(&product);
+      info->strings.swap(product);
+      return;
+    }
+    info->SetMatch(TrigramQuery::And(info->Query(), next.Query()));
+  }
+}
+
+namespace {
+  // Works out what the lines matching |node| have to contain. A template
+  // only because RegexQuery::Node is private to the class.
+  template <typename NodeT>
+  void AnalyzeNode(const NodeT& node, Info* info) {
+    *info = Info();
+    switch (node.kind) {
+      case NodeT::kEmpty:
+      case NodeT::kAssert:
+        return;
+      case NodeT::kBytes: {
+        info->strings.clear();
+        for (unsigned int c = 0; c != 256; ++c) {
+          if (!node.bytes.Has(static_cast<unsigned char>(c)))
+            continue;
+          std::string folded(1, static_cast<char>(Fold(static_cast<unsigned char>(c))));
+          info->strings.push_back(folded);
+          if (info->strings.size() > 2 * kMaxExact)
+            break;
+        }
+        Dedup(&info->strings);
+        if (info->strings.size() > kMaxExact)
+          info->SetMatch(TrigramQuery(TrigramQuery::kAll));
+        return;
+      }
+      case NodeT::kConcat: {
+        // Runs of exact parts are kept as strings, so that a literal after
+        // something like \s+ still counts with all of its trigrams.
+        TrigramQuery runs(TrigramQuery::kAll);
+        bool exact = true;
+        for (size_t ix = 0; ix != node.subs.size(); ++ix) {
+          Info sub;
+          AnalyzeNode(node.subs[ix], &sub);
+          if (ConcatExact(*info, sub)) {
+            Concat(sub, info);
+            continue;
+          }
+          exact = false;
+          runs = TrigramQuery::And(runs, info->Query());
+          *info = Info();
+          if (sub.exact)
+            *info = sub;
+          else
+            runs = TrigramQuery::And(runs, sub.Query());
+        }
+        if (!exact)
+          info->SetMatch(TrigramQuery::And(runs, info->Query()));
+        return;
+      }
+      case NodeT::kAlternate: {
+        info->strings.clear();
+        TrigramQuery any(TrigramQuery::kNone);
+        for (size_t ix = 0; ix != node.subs.size(); ++ix) {
+          Info sub;
+          AnalyzeNode(node.subs[ix], &sub);
+          any = TrigramQuery::Or(any, sub.Query());
+          if (info->exact && sub.exact) {
+            info->strings.insert(info->strings.end(), sub.strings.begin(), sub.strings.end());
+            Dedup(&info->strings);
+            if (info->strings.size() > kMaxExact)
+              info->exact = false;
+          } else {
+            info->exact = false;
+          }
+        }
+        if (!info->exact)
+          info->SetMatch(any);
+        return;
+      }
+      case NodeT::kRepeat: {
+        Info sub;
+        AnalyzeNode(node.subs[0], &sub);
+        if (node.min == 0) {
+          if ((node.max == 1) && sub.exact) {
+            info->strings = sub.strings;
+            info->strings.push_back(std::string());
+            Dedup(&info->strings);
+          } else {
+            info->SetMatch(TrigramQuery(TrigramQuery::kAll));
+          }
+          return;
+        }
+        // At least one of them, the rest are left out. Once the copies are no
+        // longer strings, more of them only repeat the same trigrams.
+        if (node.min == node.max) {
+          for (int ix = 0; (ix != node.min) && info->exact; ++ix) {
+            Concat(sub, info);
+          }
+        } else {
+          info->SetMatch(sub.Query());
+        }
+        return;
+      }
+    }
+  }
+}
+
+bool RegexQuery::Compile(const std::string& pattern, unsigned int flags, std::string* error) {
+  flags_ = flags;
+  literal_.clear();
+  program_.clear();
+  sets_.clear();
+
+  if (flags & kLiteral) {
+    for (size_t ix = 0; ix != pattern.size(); ++ix) {
+      unsigned char c = static_cast<unsigned char>(pattern[ix]);
+      literal_.append(1, static_cast<char>((flags & kIgnoreCase) ? Fold(c) : c));
+    }
+    std::string folded;
+    for (size_t ix = 0; ix != pattern.size(); ++ix) {
+      folded.append(1, static_cast<char>(Fold(static_cast<unsigned char>(pattern[ix]))));
+    }
+    trigrams_ = TrigramQuery::Literal(folded);
+    return true;
+  }
+
+  Node root(Node::kEmpty);
+  Parser parser(pattern, (flags & kIgnoreCase) != 0);
+  if (!parser.Parse(&root, error))
+    return false;
+
+  // The size of the program bounds the work of the analysis, so it goes
+  // first.
+  Emit(root);
+  Inst match = { Inst::kMatch, 0 };
+  program_.push_back(match);
+  if (program_.size() > kMaxProgram) {
+    *error = "pattern too big";
+    return false;
+  }
+
+  Info info;
+  AnalyzeNode(root, &info);
+  trigrams_ = info.Query();
+  return true;
+}
+
+void RegexQuery::Emit(const Node& node) {
+  if (program_.size() > kMaxProgram)
+    return;
+  switch (node.kind) {
+    case Node::kEmpty:
+      return;
+    case Node::kBytes: {
+      Inst inst = { Inst::kByteSet, static_cast<uint32_t>(sets_.size()) };
+      sets_.push_back(node.bytes);
+      program_.push_back(inst);
+      return;
+    }
+    case Node::kAssert: {
+      Inst inst = { Inst::kAssert, static_cast<uint32_t>(node.assertion) };
+      program_.push_back(inst);
+      return;
+    }
+    case Node::kConcat:
+      for (size_t ix = 0; ix != node.subs.size(); ++ix) {
+        Emit(node.subs[ix]);
+      }
+      return;
+    case Node::kAlternate: {
+      // split L1; L1: a; jump end; split L2; L2: b; jump end; ...; last
+      std::vector<size_t> jumps;
+      for (size_t ix = 0; ix != node.subs.size(); ++ix) {
+        size_t split = program_.size();
+        bool last = (ix + 1 == node.subs.size());
+        if (!last) {
+          Inst inst = { Inst::kSplit, 0 };
+          program_.push_back(inst);
+        }
+        Emit(node.subs[ix]);
+        if (!last) {
+          jumps.push_back(program_.size());
+          Inst inst = { Inst::kJump, 0 };
+          program_.push_back(inst);
+          program_[split].arg = static_cast<uint32_t>(program_.size());
+        }
+      }
+      for (size_t ix = 0; ix != jumps.size(); ++ix) {
+        program_[jumps[ix]].arg = static_cast<uint32_t>(program_.size());
+      }
+      return;
+    }
+    case Node::kRepeat: {
+      const Node& sub = node.subs[0];
+      for (int ix = 0; ix != node.min; ++ix) {
+        Emit(sub);
+        if (program_.size() > kMaxProgram)
+          return;
+      }
+      if (node.max == kInfinite) {
+        // loop: split end; sub; jump loop; end:
+        size_t loop = program_.size();
+        Inst split = { Inst::kSplit, 0 };
+        program_.push_back(split);
+        Emit(sub);
+        Inst jump = { Inst::kJump, static_cast<uint32_t>(loop) };
+        program_.push_back(jump);
+        program_[loop].arg = static_cast<uint32_t>(program_.size());
+        return;
+      }
+      std::vector<size_t> exits;
+      for (int ix = node.min; ix != node.max; ++ix) {
+        exits.push_back(program_.size());
+        Inst split = { Inst::kSplit, 0 };
+        program_.push_back(split);
+        Emit(sub);
+        if (program_.size() > kMaxProgram)
+          return;
+      }
+      for (size_t ix = 0; ix != exits.size(); ++ix) {
+        program_[exits[ix]].arg = static_cast<uint32_t>(program_.size());
+      }
+      return;
+    }
+  }
+}
+
+// The scratch space of Run(), kept from line to line.
+struct RegexQuery::Threads {
+  std::vector<uint32_t> waiting;
+  std::vector<uint32_t> carried;
+  std::vector<uint32_t> stack;
+  // The step at which each instruction was last added, so it is added once.
+  std::vector<size_t> seen;
+  size_t step;
+
+  explicit Threads(size_t count) : seen(count, 0), step(0) {}
+};
+
+bool RegexQuery::MatchLine(const char* beg, const char* end) const {
+  if (flags_ & kLiteral)
+    return FindLiteral(beg, end) != NULL;
+  Threads threads(program_.size());
+  return Run(beg, end, &threads);
+}
+
+// Runs the program over the line as a set of threads that all advance one
+// byte at a time, like a Thompson NFA, so the time is linear in the length
+// of the line whatever the pattern. A new thread starts at every position.
+bool RegexQuery::Run(const char* beg, const char* end, Threads* threads) const {
+  std::vector<uint32_t>& waiting = threads->waiting;
+  std::vector<uint32_t>& carried = threads->carried;
+  std::vector<uint32_t>& stack = threads->stack;
+  std::vector<size_t>& seen = threads->seen;
+  waiting.clear();
+  carried.clear();
+
+  const unsigned char* line = reinterpret_cast<const unsigned char*>(beg);
+  const size_t len = end - beg;
+  for (size_t pos = 0; ; ++pos) {
+    // Follows the jumps, splits and assertions from the threads that took
+    // the last byte and from a new one, and keeps the instructions that wait
+    // for a byte.
+    const size_t step = ++threads->step;
+    carried.push_back(0);
+    for (size_t ix = 0; ix != carried.size(); ++ix) {
+      stack.push_back(carried[ix]);
+      while (!stack.empty()) {
+        uint32_t pc = stack.back();
+        stack.pop_back();
+        if (seen[pc] == step)
+          continue;
+        seen[pc] = step;
+        const Inst& inst = program_[pc];
+        switch (inst.op) {
+          case Inst::kMatch:
+            stack.clear();
+            return true;
+          case Inst::kByteSet:
+            waiting.push_back(pc);
+            break;
+          case Inst::kJump:
+            stack.push_back(inst.arg);
+            break;
+          case Inst::kSplit:
+            stack.push_back(inst.arg);
+            stack.push_back(pc + 1);
+            break;
+          case Inst::kAssert: {
+            bool holds = false;
+            bool word_before = (pos != 0) && IsWordByte(line[pos - 1]);
+            bool word_after = (pos != len) && IsWordByte(line[pos]);
+            switch (inst.arg) {
+              case kBeginLine: holds = (pos == 0); break;
+              case kEndLine: holds = (pos == len); break;
+              case kWordBoundary: holds = (word_before != word_after); break;
+              case kNotWordBoundary: holds = (word_before == word_after); break;
+            }
+            if (holds)
+              stack.push_back(pc + 1);
+            break;
+          }
+        }
+      }
+    }
+    carried.clear();
+    if (pos == len)
+      return false;
+
+    unsigned char c = line[pos];
+    for (size_t ix = 0; ix != waiting.size(); ++ix) {
+      if (sets_[program_[waiting[ix]].arg].Has(c))
+        carried.push_back(waiting[ix] + 1);
+    }
+    waiting.clear();
+  }
+}
+
+const char* RegexQuery::FindLiteral(const char* beg, const char* end) const {
+  const size_t len = literal_.size();
+  if (len == 0)
+    return beg;
+  if (static_cast<size_t>(end - beg) < len)
+    return NULL;
+  const char* last = end - len;
+  if (!(flags_ & kIgnoreCase)) {
+    const char first = literal_[0];
+    for (const char* pc = beg; pc <= last; ++pc) {
+      pc = static_cast<const char*>(memchr(pc, first, last - pc + 1));
+      if (!pc)
+        return NULL;
+      if (0 == memcmp(pc + 1, literal_.data() + 1, len - 1))
+        return pc;
+    }
+    return NULL;
+  }
+  for (const char* pc = beg; pc <= last; ++pc) {
+    size_t ix = 0;
+    while ((ix != len) && (Fold(static_cast<unsigned char>(pc[ix])) ==
+                           static_cast<unsigned char>(literal_[ix]))) {
+      ++ix;
+    }
+    if (ix == len)
+      return pc;
+  }
+  return NULL;
+}
+
+void RegexQuery::FindLines(const char* beg, const char* end, size_t max,
+                           std::vector<LineMatch>* out) const {
+  Threads threads(program_.size());
+  size_t found = 0;
+  size_t line = 1;
+  for (const char* pc = beg; (pc < end) && (found != max); ++line) {
+    const char* eol = static_cast<const char*>(memchr(pc, '\n', end - pc));
+    if (!eol)
+      eol = end;
+    const char* line_end = ((eol != pc) && (eol[-1] == '\r')) ? eol - 1 : eol;
+    bool match = (flags_ & kLiteral) ? (FindLiteral(pc, line_end) != NULL)
+                                     : Run(pc, line_end, &threads);
+    if (match) {
+      LineMatch match = { line, pc, line_end };
+      out->push_back(match);
+      ++found;
+    }
+    pc = eol + 1;
+  }
+}
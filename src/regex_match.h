@@ -0,0 +1,87 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "content_trigrams.h"
+
+// A text query over the contents of files, matched one line at a time: a
+// regular expression or, with kLiteral, a plain string. Matching is on the
+// bytes of the file, so a UTF-8 character in the pattern matches as the
+// sequence of its bytes, but '.' and classes take single bytes.
+//
+// The syntax is the common subset of egrep and ECMAScript: . [] [^] ^ $ | ()
+// (?:) * + ? {n} {n,} {n,m}, the classes \d \w \s \D \W \S, the assertions
+// \b \B and escapes like \t \. \\. A '?' after a repetition is accepted and
+// makes no difference, there is nothing to capture. Backreferences and
+// lookarounds are not there. Counts go up to 1000.
+//
+// Compiling also works out which trigrams a matching line must have, the
+// TrigramQuery that narrows the files before any of them is read.
+class RegexQuery {
+public:
+  enum Flags {
+    kLiteral = 1,
+    // ASCII letters match either case.
+    kIgnoreCase = 2
+  };
+
+  struct LineMatch {
+    // From 1.
+    size_t line;
+    // The line, without its line break.
+    const char* beg;
+    const char* end;
+  };
+
+  RegexQuery() : flags_(0) {}
+
+  // Returns false, with the reason in |error|, if |pattern| does not parse
+  // or is too big.
+  bool Compile(const std::string& pattern, unsigned int flags, std::string* error);
+
+  const TrigramQuery& trigrams() const { return trigrams_; }
+
+  // Appends to |out| the lines of [beg, end) that match, up to |max| of them.
+  void FindLines(const char* beg, const char* end, size_t max,
+                 std::vector<LineMatch>* out) const;
+
+  // Whether some part of the line [beg, end) matches.
+  bool MatchLine(const char* beg, const char* end) const;
+
+private:
+  struct Inst {
+    enum Op {
+      kByteSet,   // Takes a byte in |sets_[arg]|.
+      kSplit,     // Goes on at the next instruction and at |arg|.
+      kJump,      // Goes on at |arg|.
+      kAssert,    // Goes on if the Assertion |arg| holds.
+      kMatch
+    };
+    Op op;
+    uint32_t arg;
+  };
+  struct ByteSet {
+    uint32_t bits[8];
+    bool Has(unsigned char c) const { return (bits[c >> 5] >> (c & 31)) & 1; }
+  };
+  struct Node;
+  class Parser;
+  struct Threads;
+
+  void Emit(const Node& node);
+  bool Run(const char* beg, const char* end, Threads* threads) const;
+  const char* FindLiteral(const char* beg, const char* end) const;
+
+  unsigned int flags_;
+  // kLiteral only, folded with kIgnoreCase.
+  std::string literal_;
+  std::vector<Inst> program_;
+  std::vector<ByteSet> sets_;
+  TrigramQuery trigrams_;
+};
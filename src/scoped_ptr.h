@@ -2,6 +2,9 @@
 // Copyright (c) 2011 Carlos Pizano-Uribe
 // Please see the README file for attribution and license details.
 
+#include <assert.h>
+#include <stddef.h>
+
 template <class C>
 class scoped_ptr {
  public:
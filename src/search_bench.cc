@@ -0,0 +1,752 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+//
+// End to end benchmark of the engine over a synthetic tree. It lays out a
+// made-up repo on disk, the same one for the same parameters and seed, then
+// times Index(), notes the peak resident memory, and times the queries of
+// each CodeSearch::Options mode the way the dialog sends them: one Search()
+// per key typed once there are three characters. With --content it also
+// times the content index build and SearchContent() and SearchText().
+//
+// The results go out as JSON, by default to stdout, so that runs on two
+// commits can be diffed. The progress goes to stderr.
+//
+// usage: search_bench --root <dir> [--files 40000] [--depth 8] [--fanout 6]
+//            [--files-per-dir 20] [--zipf 1.0] [--ext-mix cc:35,h:35,...]
+//            [--size-mean 0] [--seed 1] [--runs 3] [--queries 50]
+//            [--engine posix] [--content] [--out results.json]
+//
+// The tree is only written if |root| does not have it already, a 5M file
+// tree takes a while. Runs with other parameters need another root. What
+// the tree was made with is kept next to it, in <root>.kodefind_bench.txt.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include "target_version_win.h"
+#include <psapi.h>
+#else
+#include <errno.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "code_search.h"
+#include "mapped_file.h"
+#include "utf8.h"
+
+namespace {
+#if defined(_WIN32)
+  const wchar_t kSeparator = L'\\';
+#else
+  const wchar_t kSeparator = L'/';
+#endif
+
+  // Next to a generated tree, the parameters it was generated with. Outside
+  // of it, so that the engine indexes the files the tree reports and no more.
+  const wchar_t kMarkerSuffix[] = L".kodefind_bench.txt";
+  // Where older versions kept it, inside the tree.
+  const wchar_t kOldMarkerName[] = L"kodefind_bench.txt";
+
+  // The dialog waits for this many characters before searching.
+  const size_t kMinQueryLen = 3;
+  // Words in the made-up vocabulary, on top of kWords.
+  const size_t kVocabulary = 4000;
+
+  const char* const kWords[] = {
+    "base", "net", "url", "request", "thread", "pool", "render", "view",
+    "host", "widget", "util", "string", "file", "path", "test", "unittest",
+    "browser", "tab", "win", "posix", "mac", "impl", "proxy", "message",
+    "loop", "task", "runner", "sync", "cache", "gpu", "audio", "layout"
+  };
+  const char* const kSyllables[] = {
+    "ab", "ac", "al", "an", "ar", "ba", "be", "ca", "ce", "co", "da", "de",
+    "di", "el", "en", "er", "fa", "fi", "ga", "ge", "ha", "in", "io", "ka",
+    "la", "le", "li", "lo", "ma", "me", "mi", "mo", "na", "ne", "no", "or",
+    "pa", "pe", "po", "ra", "re", "ri", "ro", "sa", "se", "si", "so", "ta",
+    "te", "ti", "to", "un", "va", "ve", "xi", "za"
+  };
+  const char kDefaultExtMix[] =
+      "cc:35,h:35,c:4,cpp:4,mm:2,idl:1,gyp:1,py:6,txt:4,json:4,md:2,java:2";
+
+  struct Params {
+    std::string root;
+    size_t files;
+    size_t depth;
+    size_t fanout;
+    size_t files_per_dir;
+    double zipf;
+    std::string ext_mix;
+    size_t size_mean;
+    unsigned int seed;
+    size_t runs;
+    size_t queries;
+    std::string engine;
+    bool content;
+    std::string out;
+
+    Params()
+        : files(40000), depth(8), fanout(6), files_per_dir(20), zipf(1.0),
+          ext_mix(kDefaultExtMix), size_mean(0), seed(1), runs(3), queries(50),
+          content(false) {}
+
+    // What decides the tree. Two trees with the same one are the same.
+    std::string TreeKey() const {
+      char buf[256];
+      snprintf(buf, sizeof(buf), "files=%zu depth=%zu fanout=%zu files_per_dir=%zu zipf=%g "
+               "size_mean=%zu seed=%u ext_mix=", files, depth, fanout, files_per_dir, zipf,
+               size_mean, seed);
+      return buf + ext_mix;
+    }
+  };
+
+  // The same sequence on every platform, unlike rand().
+  class Random {
+  public:
+    explicit Random(unsigned int seed) : state_(seed * 2654435761u + 1) {}
+    unsigned int Next() {
+      state_ ^= state_ << 13;
+      state_ ^= state_ >> 7;
+      state_ ^= state_ << 17;
+      return static_cast<unsigned int>(state_ >> 32);
+    }
+    // In [0, n).
+    size_t Below(size_t n) { return static_cast<size_t>(Next() % n); }
+    // In [0, 1).
+    double Unit() { return Next() / 4294967296.0; }
+
+  private:
+    unsigned long long state_;
+  };
+
+  // Words picked by rank with a Zipf distribution, a few very common and a
+  // long tail, like the words in the names of a real tree.
+  class Vocabulary {
+  public:
+    Vocabulary(double zipf, Random* random) {
+      for (size_t ix = 0; ix != sizeof(kWords) / sizeof(kWords[0]); ++ix) {
+        words_.push_back(kWords[ix]);
+      }
+      const size_t syllables = sizeof(kSyllables) / sizeof(kSyllables[0]);
+      while (words_.size() != kVocabulary) {
+        std::string word;
+        for (size_t sx = 2 + random->Below(3); sx; --sx) {
+          word.append(kSyllables[random->Below(syllables)]);
+        }
+        words_.push_back(word);
+      }
+      double sum = 0;
+      for (size_t rank = 0; rank != words_.size(); ++rank) {
+        sum += 1.0 / pow(static_cast<double>(rank + 1), zipf);
+        cdf_.push_back(sum);
+      }
+      for (size_t rank = 0; rank != cdf_.size(); ++rank) {
+        cdf_[rank] /= sum;
+      }
+    }
+
+    const std::string& Pick(Random* random) const {
+      size_t rank = std::lower_bound(cdf_.begin(), cdf_.end(), random->Unit()) - cdf_.begin();
+      return words_[std::min(rank, words_.size() - 1)];
+    }
+
+    // One to four words joined by underscores.
+    std::string Name(Random* random) const {
+      std::string name;
+      for (size_t wx = 1 + random->Below(4); wx; --wx) {
+        if (!name.empty())
+          name.append(1, '_');
+        name.append(Pick(random));
+      }
+      return name;
+    }
+
+  private:
+    std::vector<std::string> words_;
+    std::vector<double> cdf_;
+  };
+
+  struct Extension {
+    std::string ext;
+    unsigned int weight;
+  };
+
+  bool ParseExtMix(const std::string& mix, std::vector<Extension>* exts) {
+    size_t pos = 0;
+    while (pos < mix.size()) {
+      size_t comma = mix.find(',', pos);
+      if (comma == std::string::npos)
+        comma = mix.size();
+      size_t colon = mix.find(':', pos);
+      if ((colon == std::string::npos) || (colon > comma) || (colon == pos))
+        return false;
+      Extension ext;
+      ext.ext = "." + mix.substr(pos, colon - pos);
+      ext.weight = static_cast<unsigned int>(strtoul(mix.c_str() + colon + 1, NULL, 10));
+      if (!ext.weight)
+        return false;
+      exts->push_back(ext);
+      pos = comma + 1;
+    }
+    return !exts->empty();
+  }
+
+  const std::string& PickExtension(const std::vector<Extension>& exts, Random* random) {
+    unsigned int total = 0;
+    for (size_t ix = 0; ix != exts.size(); ++ix) {
+      total += exts[ix].weight;
+    }
+    unsigned int pick = static_cast<unsigned int>(random->Below(total));
+    for (size_t ix = 0; ix != exts.size(); ++ix) {
+      if (pick < exts[ix].weight)
+        return exts[ix].ext;
+      pick -= exts[ix].weight;
+    }
+    return exts.back().ext;
+  }
+
+  bool MakeDir(const std::wstring& path) {
+#if defined(_WIN32)
+    return ::CreateDirectoryW(path.c_str(), NULL) || (::GetLastError() == ERROR_ALREADY_EXISTS);
+#else
+    std::string native = WideToUtf8(path.c_str(), path.size());
+    return (::mkdir(native.c_str(), 0755) == 0) || (errno == EEXIST);
+#endif
+  }
+
+  void RemoveFile(const std::wstring& path) {
+#if defined(_WIN32)
+    ::DeleteFileW(path.c_str());
+#else
+    ::unlink(WideToUtf8(path.c_str(), path.size()).c_str());
+#endif
+  }
+
+  std::wstring Wide(const std::string& str) {
+    return Utf8ToWide(str.c_str(), str.size());
+  }
+
+  std::wstring MarkerPath(std::wstring root) {
+    while ((root.size() > 1) && (root[root.size() - 1] == kSeparator))
+      root.erase(root.size() - 1);
+    return root + kMarkerSuffix;
+  }
+
+  bool ReadMarker(const std::wstring& root, std::string* key) {
+    MappedFile marker;
+    if (!marker.Open(MarkerPath(root).c_str()))
+      return false;
+    key->assign(marker.data(), marker.size());
+    return true;
+  }
+
+  // Contents that tokenize like source code, |size| bytes give or take a
+  // line.
+  void MakeContents(const Vocabulary& vocabulary, size_t size, Random* random,
+                    std::string* contents) {
+    contents->clear();
+    while (contents->size() < size) {
+      contents->append("  ");
+      contents->append(vocabulary.Name(random));
+      contents->append(" = ");
+      contents->append(vocabulary.Pick(random));
+      contents->append("(");
+      contents->append(vocabulary.Name(random));
+      contents->append(");\n");
+    }
+  }
+
+  struct Tree {
+    size_t files;
+    size_t dirs;
+    unsigned long long bytes;
+  };
+
+  // Lays the tree out breadth first: every directory gets |fanout|
+  // subdirectories, none deeper than |depth|, until there is one for every
+  // |files_per_dir| files. The files then land in directories picked at
+  // random. Returns false if the tree can't be written.
+  bool Generate(const Params& params, const std::wstring& root, Tree* tree) {
+    Random random(params.seed);
+    Vocabulary vocabulary(params.zipf, &random);
+    std::vector<Extension> exts;
+    ParseExtMix(params.ext_mix, &exts);
+
+    std::vector<std::wstring> dirs(1, root);
+    std::vector<size_t> depths(1, 0);
+    const size_t want_dirs = std::max<size_t>(1, params.files / std::max<size_t>(1, params.files_per_dir));
+    for (size_t dx = 0; (dx != dirs.size()) && (dirs.size() < want_dirs); ++dx) {
+      if (depths[dx] == params.depth)
+        continue;
+      for (size_t cx = 0; (cx != params.fanout) && (dirs.size() < want_dirs); ++cx) {
+        char suffix[16];
+        snprintf(suffix, sizeof(suffix), "%zu", cx);
+        dirs.push_back(dirs[dx] + kSeparator + Wide(vocabulary.Pick(&random) + suffix));
+        depths.push_back(depths[dx] + 1);
+      }
+    }
+    for (size_t dx = 0; dx != dirs.size(); ++dx) {
+      if (!MakeDir(dirs[dx]))
+        return false;
+    }
+
+    std::vector<size_t> counts(dirs.size());
+    for (size_t fx = 0; fx != params.files; ++fx) {
+      ++counts[random.Below(dirs.size())];
+    }
+
+    tree->files = 0;
+    tree->dirs = dirs.size();
+    tree->bytes = 0;
+    std::string contents;
+    for (size_t dx = 0; dx != dirs.size(); ++dx) {
+      for (size_t fx = 0; fx != counts[dx]; ++fx) {
+        // The index keeps names in a directory apart.
+        char suffix[16];
+        snprintf(suffix, sizeof(suffix), "%zu", fx);
+        std::string name = vocabulary.Name(&random) + suffix + PickExtension(exts, &random);
+        size_t size = 0;
+        if (params.size_mean) {
+          // Log-normal, most files small and a few large.
+          double normal = 0;
+          for (int ix = 0; ix != 12; ++ix) {
+            normal += random.Unit();
+          }
+          size = static_cast<size_t>(params.size_mean * exp(normal - 6.0 - 0.5));
+        }
+        MakeContents(vocabulary, size, &random, &contents);
+        FILE* file = OpenFileForWrite((dirs[dx] + kSeparator + Wide(name)).c_str());
+        if (!file)
+          return false;
+        bool ok = contents.empty() ||
+                  (fwrite(contents.data(), 1, contents.size(), file) == contents.size());
+        ok = (fclose(file) == 0) && ok;
+        if (!ok)
+          return false;
+        ++tree->files;
+        tree->bytes += contents.size();
+      }
+      if ((dx % 1000) == 999)
+        fprintf(stderr, "\rwriting the tree: %zu files", tree->files);
+    }
+    fprintf(stderr, "\rwriting the tree: %zu files\n", tree->files);
+
+    // Last, so that an interrupted run writes it all again.
+    std::string key = params.TreeKey();
+    char line[64];
+    snprintf(line, sizeof(line), "\n%zu %zu %llu", tree->files, tree->dirs, tree->bytes);
+    key.append(line);
+    FILE* marker = OpenFileForWrite(MarkerPath(root).c_str());
+    if (!marker)
+      return false;
+    bool ok = fwrite(key.data(), 1, key.size(), marker) == key.size();
+    return (fclose(marker) == 0) && ok;
+  }
+
+  // Makes sure |root| has the tree of |params|.
+  bool PrepareTree(const Params& params, const std::wstring& root, Tree* tree) {
+    std::string marker;
+    if (ReadMarker(root, &marker)) {
+      size_t newline = marker.find('\n');
+      if ((newline != std::string::npos) && (marker.compare(0, newline, params.TreeKey()) == 0) &&
+          (sscanf(marker.c_str() + newline + 1, "%zu %zu %llu",
+                  &tree->files, &tree->dirs, &tree->bytes) == 3)) {
+        fprintf(stderr, "reusing the tree in %s\n", params.root.c_str());
+        return true;
+      }
+      fprintf(stderr, "%s has a tree made with other parameters\n", params.root.c_str());
+      return false;
+    }
+    if (!MakeDir(root))
+      return false;
+    RemoveFile(root + kSeparator + kOldMarkerName);
+    return Generate(params, root, tree);
+  }
+
+  double Millis(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  // Lets the peak below be about what comes next, where the system can.
+  void ResetPeakMemory() {
+#if defined(__linux__)
+    FILE* clear = fopen("/proc/self/clear_refs", "w");
+    if (clear) {
+      fputs("5", clear);
+      fclose(clear);
+    }
+#endif
+  }
+
+  // The most memory the process has had resident, in KB.
+  size_t PeakMemoryKB() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS pmc = { sizeof(pmc) };
+    if (!::GetProcessMemoryInfo(::GetCurrentProcess(), &pmc, sizeof(pmc)))
+      return 0;
+    return pmc.PeakWorkingSetSize / 1024;
+#else
+#if defined(__linux__)
+    // Unlike ru_maxrss, VmHWM goes down with ResetPeakMemory().
+    FILE* status = fopen("/proc/self/status", "r");
+    if (status) {
+      char line[256];
+      size_t kb = 0;
+      while (fgets(line, sizeof(line), status)) {
+        if (sscanf(line, "VmHWM: %zu kB", &kb) == 1)
+          break;
+      }
+      fclose(status);
+      if (kb)
+        return kb;
+    }
+#endif
+    struct rusage usage;
+    if (::getrusage(RUSAGE_SELF, &usage) != 0)
+      return 0;
+#if defined(__APPLE__)
+    return static_cast<size_t>(usage.ru_maxrss) / 1024;
+#else
+    return static_cast<size_t>(usage.ru_maxrss);
+#endif
+#endif
+  }
+
+  class Client : public CodeSearch::Client {
+  public:
+    Client() : content_done_(false) {}
+
+    virtual bool OnIndexProgress(CodeSearch* engine, size_t files, size_t dirs) override {
+      return true;
+    }
+    // Every file can be done a tick before the index is packed, only the
+    // last call says it is complete.
+    virtual bool OnContentProgress(CodeSearch* engine,
+                                   const CodeSearch::ContentProgress& progress) override {
+      if (progress.finished)
+        content_done_ = true;
+      return true;
+    }
+    virtual bool OnError(int error_code) override {
+      return false;
+    }
+
+    void WaitForContent() {
+      while (!content_done_) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+
+  private:
+    std::atomic<bool> content_done_;
+  };
+
+  struct Latencies {
+    std::vector<double> ms;
+    unsigned long long results;
+    Latencies() : results(0) {}
+  };
+
+  double Percentile(std::vector<double> sorted, double pc) {
+    if (sorted.empty())
+      return 0;
+    size_t rank = static_cast<size_t>(ceil(pc / 100.0 * sorted.size()));
+    return sorted[std::min(sorted.size() - 1, rank ? rank - 1 : 0)];
+  }
+
+  // Writes the JSON by hand, the shape is small and fixed.
+  class JsonWriter {
+  public:
+    explicit JsonWriter(FILE* out) : out_(out), first_(true), depth_(0) {}
+
+    void Open(const char* key) { Key(key); fputs("{", out_); first_ = true; ++depth_; }
+    void Close() { --depth_; fprintf(out_, "\n%*s}", depth_ * 2, ""); first_ = false; }
+    void Number(const char* key, double value) { Key(key); fprintf(out_, "%.3f", value); }
+    void Count(const char* key, unsigned long long value) { Key(key); fprintf(out_, "%llu", value); }
+    void String(const char* key, const std::string& value) {
+      Key(key);
+      fputc('"', out_);
+      for (size_t ix = 0; ix != value.size(); ++ix) {
+        unsigned char c = static_cast<unsigned char>(value[ix]);
+        if ((c == '"') || (c == '\\'))
+          fprintf(out_, "\\%c", c);
+        else if (c < 0x20)
+          fprintf(out_, "\\u%04x", c);
+        else
+          fputc(c, out_);
+      }
+      fputc('"', out_);
+    }
+    void Latency(const char* key, const Latencies& lat) {
+      Open(key);
+      std::vector<double> sorted(lat.ms);
+      std::sort(sorted.begin(), sorted.end());
+      Count("samples", sorted.size());
+      Number("p50_ms", Percentile(sorted, 50));
+      Number("p90_ms", Percentile(sorted, 90));
+      Number("p99_ms", Percentile(sorted, 99));
+      Number("max_ms", sorted.empty() ? 0 : sorted.back());
+      Number("mean_results", sorted.empty() ? 0 : static_cast<double>(lat.results) / sorted.size());
+      Close();
+    }
+
+  private:
+    void Key(const char* key) {
+      if (depth_)
+        fprintf(out_, "%s\n%*s", first_ ? "" : ",", depth_ * 2, "");
+      if (key)
+        fprintf(out_, "\"%s\": ", key);
+      first_ = false;
+    }
+
+    FILE* out_;
+    bool first_;
+    int depth_;
+  };
+
+  // What the queries look for: the names in the tree come from the same
+  // vocabulary, so they hit about as often as real ones.
+  std::vector<std::string> MakeQueries(const Params& params) {
+    Random random(params.seed);
+    Vocabulary vocabulary(params.zipf, &random);
+    Random picks(params.seed + 1);
+    std::vector<std::string> queries;
+    while (queries.size() != params.queries) {
+      std::string query = vocabulary.Pick(&picks);
+      if (picks.Below(2))
+        query += "_" + vocabulary.Pick(&picks);
+      if (query.size() >= kMinQueryLen)
+        queries.push_back(query);
+    }
+    return queries;
+  }
+
+  // As the dialog does it: one query per key typed. Each call drains the
+  // results with Continue() too, the time to the first batch is |first|.
+  void TimeSearches(CodeSearch* engine, CodeSearch::Options options,
+                    const std::vector<std::string>& queries, Latencies* first,
+                    Latencies* all) {
+    volatile long generation = 0;
+    CodeSearch::Control control = { &generation, 0, 0 };
+    for (size_t qx = 0; qx != queries.size(); ++qx) {
+      for (size_t len = kMinQueryLen; len <= queries[qx].size(); ++len) {
+        std::wstring query = Utf8ToWide(queries[qx].c_str(), len);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        CodeSearch::Status status;
+        size_t results = engine->Search(query.c_str(), options, control, &status).size();
+        first->ms.push_back(Millis(start));
+        first->results += results;
+        while (status == CodeSearch::More) {
+          results += engine->Continue(control, &status).size();
+        }
+        all->ms.push_back(Millis(start));
+        all->results += results;
+      }
+    }
+  }
+
+  bool ParseArgs(int argc, char* argv[], Params* params) {
+    for (int ix = 1; ix < argc; ++ix) {
+      std::string arg = argv[ix];
+      if (arg == "--content") {
+        params->content = true;
+        continue;
+      }
+      if (ix + 1 == argc)
+        return false;
+      const char* value = argv[++ix];
+      if (arg == "--root")
+        params->root = value;
+      else if (arg == "--files")
+        params->files = strtoul(value, NULL, 10);
+      else if (arg == "--depth")
+        params->depth = strtoul(value, NULL, 10);
+      else if (arg == "--fanout")
+        params->fanout = strtoul(value, NULL, 10);
+      else if (arg == "--files-per-dir")
+        params->files_per_dir = strtoul(value, NULL, 10);
+      else if (arg == "--zipf")
+        params->zipf = strtod(value, NULL);
+      else if (arg == "--ext-mix")
+        params->ext_mix = value;
+      else if (arg == "--size-mean")
+        params->size_mean = strtoul(value, NULL, 10);
+      else if (arg == "--seed")
+        params->seed = static_cast<unsigned int>(strtoul(value, NULL, 10));
+      else if (arg == "--runs")
+        params->runs = strtoul(value, NULL, 10);
+      else if (arg == "--queries")
+        params->queries = strtoul(value, NULL, 10);
+      else if (arg == "--engine")
+        params->engine = value;
+      else if (arg == "--out")
+        params->out = value;
+      else
+        return false;
+    }
+    std::vector<Extension> exts;
+    return !params->root.empty() && params->fanout && params->runs &&
+           ParseExtMix(params->ext_mix, &exts);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  Params params;
+  if (!ParseArgs(argc, argv, &params)) {
+    fprintf(stderr, "usage: search_bench --root <dir> [--files n] [--depth n] [--fanout n]\n"
+                    "    [--files-per-dir n] [--zipf s] [--ext-mix ext:weight,...]\n"
+                    "    [--size-mean bytes] [--seed n] [--runs n] [--queries n]\n"
+                    "    [--engine name] [--content] [--out file]\n");
+    return 1;
+  }
+
+  const std::wstring root = Wide(params.root);
+  Tree tree;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  if (!PrepareTree(params, root, &tree)) {
+    fprintf(stderr, "can't write the tree in %s\n", params.root.c_str());
+    return 1;
+  }
+  double generate_ms = Millis(start);
+  const char* engine_name = params.engine.empty() ? NULL : params.engine.c_str();
+
+  // The last engine stays for the queries.
+  std::vector<double> index_ms;
+  size_t before_kb = 0;
+  size_t peak_kb = 0;
+  CodeSearch* engine = NULL;
+  Client client;
+  for (size_t run = 0; run != params.runs; ++run) {
+    delete engine;
+    engine = CodeSearchFactory(engine_name);
+    if (!engine) {
+      fprintf(stderr, "no engine called %s\n", engine_name);
+      return 1;
+    }
+    ResetPeakMemory();
+    before_kb = PeakMemoryKB();
+    start = std::chrono::steady_clock::now();
+    int rv = engine->Index(root.c_str(), &client);
+    index_ms.push_back(Millis(start));
+    peak_kb = PeakMemoryKB();
+    if (rv != 0) {
+      fprintf(stderr, "Index() failed: %d\n", rv);
+      return 1;
+    }
+    fprintf(stderr, "Index() run %zu: %.1f ms\n", run + 1, index_ms.back());
+  }
+
+  const std::vector<std::string> queries = MakeQueries(params);
+  const CodeSearch::Options kModes[] = {
+    CodeSearch::Substring, CodeSearch::BeginsWith, CodeSearch::Fuzzy
+  };
+  const char* const kModeNames[] = { "substring", "begins_with", "fuzzy" };
+  Latencies first[3];
+  Latencies all[3];
+  for (size_t mx = 0; mx != 3; ++mx) {
+    TimeSearches(engine, kModes[mx], queries, &first[mx], &all[mx]);
+    fprintf(stderr, "%s: %zu queries\n", kModeNames[mx], first[mx].ms.size());
+  }
+
+  double content_ms = 0;
+  size_t content_peak_kb = 0;
+  Latencies tokens;
+  Latencies texts;
+  if (params.content) {
+    ResetPeakMemory();
+    start = std::chrono::steady_clock::now();
+    engine->IndexContent(&client);
+    client.WaitForContent();
+    content_ms = Millis(start);
+    content_peak_kb = PeakMemoryKB();
+    fprintf(stderr, "IndexContent(): %.1f ms\n", content_ms);
+
+    for (size_t qx = 0; qx != queries.size(); ++qx) {
+      std::wstring query = Wide(queries[qx]);
+      bool partial;
+      start = std::chrono::steady_clock::now();
+      tokens.results += engine->SearchContent(query.c_str(), &partial).size();
+      tokens.ms.push_back(Millis(start));
+
+      std::vector<CodeSearch::TextHit> hits;
+      start = std::chrono::steady_clock::now();
+      engine->SearchText(query.c_str(), CodeSearch::TextLiteral, 1000, &hits, &partial, NULL);
+      texts.ms.push_back(Millis(start));
+      texts.results += hits.size();
+    }
+  }
+  delete engine;
+
+  FILE* out = params.out.empty() ? stdout : fopen(params.out.c_str(), "w");
+  if (!out) {
+    fprintf(stderr, "can't write %s\n", params.out.c_str());
+    return 1;
+  }
+  JsonWriter json(out);
+  json.Open(NULL);
+  json.String("benchmark", "search_bench");
+  json.Count("format", 1);
+  json.Open("params");
+  json.Count("files", params.files);
+  json.Count("depth", params.depth);
+  json.Count("fanout", params.fanout);
+  json.Count("files_per_dir", params.files_per_dir);
+  json.Number("zipf", params.zipf);
+  json.String("ext_mix", params.ext_mix);
+  json.Count("size_mean", params.size_mean);
+  json.Count("seed", params.seed);
+  json.Count("runs", params.runs);
+  json.Count("queries", params.queries);
+  json.String("engine", params.engine.empty() ? "default" : params.engine);
+  json.Close();
+  json.Open("tree");
+  json.Count("files", tree.files);
+  json.Count("dirs", tree.dirs);
+  json.Count("bytes", tree.bytes);
+  json.Number("generate_ms", generate_ms);
+  json.Close();
+
+  std::vector<double> sorted(index_ms);
+  std::sort(sorted.begin(), sorted.end());
+  json.Open("index");
+  json.Number("min_ms", sorted.front());
+  json.Number("median_ms", sorted[sorted.size() / 2]);
+  json.Number("max_ms", sorted.back());
+  json.Count("rss_before_kb", before_kb);
+  json.Count("peak_rss_kb", peak_kb);
+  json.Close();
+
+  json.Open("search");
+  for (size_t mx = 0; mx != 3; ++mx) {
+    json.Open(kModeNames[mx]);
+    json.Latency("first_batch", first[mx]);
+    json.Latency("all_batches", all[mx]);
+    json.Close();
+  }
+  json.Close();
+
+  if (params.content) {
+    json.Open("content");
+    json.Number("index_ms", content_ms);
+    json.Count("peak_rss_kb", content_peak_kb);
+    json.Latency("search_content", tokens);
+    json.Latency("search_text", texts);
+    json.Close();
+  }
+  json.Close();
+  fputs("\n", out);
+  if (out != stdout)
+    fclose(out);
+  return 0;
+}
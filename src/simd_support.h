@@ -0,0 +1,64 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stdint.h>
+
+// What the vector kernels share. KF_X86_SIMD is defined where SSE2 can be
+// taken for granted; AVX2 code goes in functions marked KF_TARGET_AVX2 and
+// only runs after CpuHasAvx2() said so.
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define KF_X86_SIMD 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and clang only emit AVX2 code inside functions that ask for it, that way
+// the rest of the program still runs on any x64 cpu.
+#if defined(__GNUC__)
+#define KF_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define KF_TARGET_AVX2
+#endif
+
+#if defined(KF_X86_SIMD)
+inline unsigned LowestBit(unsigned mask) {
+#if defined(_MSC_VER)
+  unsigned long ix;
+  _BitScanForward(&ix, mask);
+  return ix;
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
+inline unsigned LowestBit64(uint64_t mask) {
+#if defined(_MSC_VER)
+  unsigned long ix;
+  _BitScanForward64(&ix, mask);
+  return ix;
+#else
+  return __builtin_ctzll(mask);
+#endif
+}
+
+inline bool CpuHasAvx2() {
+#if defined(_MSC_VER)
+  int regs[4];
+  __cpuid(regs, 0);
+  if (regs[0] < 7)
+    return false;
+  __cpuid(regs, 1);
+  // The OS must save the ymm registers on context switches.
+  if (!(regs[2] & (1 << 27)) || ((_xgetbv(0) & 6) != 6))
+    return false;
+  __cpuidex(regs, 7, 0);
+  return (regs[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+#endif  // KF_X86_SIMD
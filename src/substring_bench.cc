@@ -0,0 +1,136 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+//
+// Microbenchmark for the substring kernel. It builds a FileTable of synthetic
+// names and compares, for a few queries, the old one std::string::find per
+// name against scanning the arena with the scalar and the vector kernels.
+//
+// usage: substring_bench [number of names]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "file_table.h"
+#include "substring_match.h"
+
+namespace {
+  const char* const kWords[] = {
+    "base", "net", "url", "request", "thread", "pool", "render", "view",
+    "host", "widget", "util", "string", "file", "path", "test", "unittest",
+    "browser", "tab", "win", "posix", "mac", "impl", "proxy", "message",
+    "loop", "task", "runner", "sync", "cache", "gpu", "audio", "layout"
+  };
+  const char* const kExtensions[] = {
+    ".cc", ".h", ".c", ".cpp", ".mm", ".gyp"
+  };
+  const char* const kQueries[] = {
+    "url", "_win", "thread_pool", "unittest.cc", "zq", "proxy_impl.h"
+  };
+
+  const size_t kDefaultNames = 1000 * 1000;
+  const int kRounds = 5;
+
+  typedef size_t (*FindFn)(const char*, size_t, const char*, size_t);
+
+  unsigned int g_seed = 1234;
+  unsigned int Random() {
+    g_seed = g_seed * 1103515245 + 12345;
+    return (g_seed >> 16) & 0x7FFF;
+  }
+
+  std::string MakeName() {
+    std::string name;
+    size_t words = 1 + Random() % 4;
+    for (size_t ix = 0; ix != words; ++ix) {
+      if (ix)
+        name.append(1, '_');
+      name.append(kWords[Random() % (sizeof(kWords) / sizeof(kWords[0]))]);
+    }
+    name.append(kExtensions[Random() % (sizeof(kExtensions) / sizeof(kExtensions[0]))]);
+    return name;
+  }
+
+  double Seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  void FindBaseline(const std::vector<std::string>& names, const char* query,
+                    std::vector<size_t>* hits) {
+    for (size_t ix = 0; ix != names.size(); ++ix) {
+      if (names[ix].find(query) != std::string::npos)
+        hits->push_back(ix);
+    }
+  }
+
+  // The same walk that V1CodeSearch::SearchImpl does.
+  void FindInArena(const FileTable& files, FindFn find, const char* query, size_t len,
+                   std::vector<size_t>* hits) {
+    const char* arena = files.arena();
+    size_t cursor = 0;
+    while (cursor != files.size()) {
+      size_t from = files.name_offset(cursor);
+      size_t pos = find(arena + from, files.arena_size() - from, query, len);
+      if (pos == kSubstringNotFound)
+        break;
+      cursor = files.FileAt(from + pos, cursor);
+      hits->push_back(cursor);
+      ++cursor;
+    }
+  }
+}
+
+int main(int argc, char* argv[]) {
+  size_t count = (argc > 1) ? strtoul(argv[1], NULL, 10) : kDefaultNames;
+
+  std::vector<std::string> names;
+  FileTable files;
+  names.reserve(count);
+  files.Reserve(count, count * 20);
+  for (size_t ix = 0; ix != count; ++ix) {
+    names.push_back(MakeName());
+    files.Add(names.back().c_str(), names.back().size(), 0, 0);
+  }
+
+  printf("%zu names, kernel: %s\n", count, SubstringKernelName());
+  printf("%-14s %8s %14s %14s %14s\n", "query", "matches", "find Mn/s", "scalar Mn/s", "kernel Mn/s");
+
+  int errors = 0;
+  for (size_t qx = 0; qx != sizeof(kQueries) / sizeof(kQueries[0]); ++qx) {
+    const char* query = kQueries[qx];
+    const size_t len = strlen(query);
+    std::vector<size_t> base_hits, scalar_hits, kernel_hits;
+
+    double best[3] = { 1e9, 1e9, 1e9 };
+    for (int round = 0; round != kRounds; ++round) {
+      base_hits.clear();
+      scalar_hits.clear();
+      kernel_hits.clear();
+
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      FindBaseline(names, query, &base_hits);
+      best[0] = std::min(best[0], Seconds(start));
+
+      start = std::chrono::steady_clock::now();
+      FindInArena(files, FindSubstringScalar, query, len, &scalar_hits);
+      best[1] = std::min(best[1], Seconds(start));
+
+      start = std::chrono::steady_clock::now();
+      FindInArena(files, FindSubstring, query, len, &kernel_hits);
+      best[2] = std::min(best[2], Seconds(start));
+    }
+
+    if ((base_hits != scalar_hits) || (base_hits != kernel_hits)) {
+      printf("%s: results differ from std::string::find\n", query);
+      ++errors;
+    }
+    printf("%-14s %8zu %14.1f %14.1f %14.1f\n", query, base_hits.size(),
+           count / best[0] / 1e6, count / best[1] / 1e6, count / best[2] / 1e6);
+  }
+
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,121 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "substring_match.h"
+
+#include <string.h>
+
+#include "simd_support.h"
+
+namespace {
+  typedef size_t (*FindFn)(const char*, size_t, const char*, size_t);
+
+  struct Kernel {
+    FindFn find;
+    const char* name;
+  };
+
+  // The first and last bytes are known to match.
+  inline bool MiddleMatches(const char* at, const char* needle, size_t len) {
+    return (len <= 2) || (0 == memcmp(at + 1, needle + 1, len - 2));
+  }
+
+  inline size_t FinishWithScalar(const char* hay, size_t hay_len, size_t ix,
+                                 const char* needle, size_t needle_len) {
+    size_t pos = FindSubstringScalar(hay + ix, hay_len - ix, needle, needle_len);
+    return (pos == kSubstringNotFound) ? pos : ix + pos;
+  }
+
+#if defined(KF_X86_SIMD)
+  size_t FindSse2(const char* hay, size_t hay_len, const char* needle, size_t needle_len) {
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+
+    size_t ix = 0;
+    for (; ix + needle_len - 1 + 16 <= hay_len; ix += 16) {
+      __m128i bf = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + ix));
+      __m128i bl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + ix + needle_len - 1));
+      __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(first, bf), _mm_cmpeq_epi8(last, bl));
+      unsigned mask = _mm_movemask_epi8(eq);
+      while (mask) {
+        size_t pos = ix + LowestBit(mask);
+        if (MiddleMatches(hay + pos, needle, needle_len))
+          return pos;
+        mask &= mask - 1;
+      }
+    }
+    return FinishWithScalar(hay, hay_len, ix, needle, needle_len);
+  }
+
+  KF_TARGET_AVX2
+  size_t FindAvx2(const char* hay, size_t hay_len, const char* needle, size_t needle_len) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[needle_len - 1]);
+
+    size_t ix = 0;
+    for (; ix + needle_len - 1 + 32 <= hay_len; ix += 32) {
+      __m256i bf = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hay + ix));
+      __m256i bl = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hay + ix + needle_len - 1));
+      __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi8(first, bf), _mm256_cmpeq_epi8(last, bl));
+      unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(eq));
+      while (mask) {
+        size_t pos = ix + LowestBit(mask);
+        if (MiddleMatches(hay + pos, needle, needle_len))
+          return pos;
+        mask &= mask - 1;
+      }
+    }
+    return FinishWithScalar(hay, hay_len, ix, needle, needle_len);
+  }
+#endif  // KF_X86_SIMD
+
+  Kernel PickKernel() {
+    Kernel kernel = { FindSubstringScalar, "scalar" };
+#if defined(KF_X86_SIMD)
+    if (CpuHasAvx2()) {
+      kernel.find = FindAvx2;
+      kernel.name = "avx2";
+    } else {
+      kernel.find = FindSse2;
+      kernel.name = "sse2";
+    }
+#endif
+    return kernel;
+  }
+
+  const Kernel& GetKernel() {
+    static const Kernel kernel = PickKernel();
+    return kernel;
+  }
+}
+
+size_t FindSubstringScalar(const char* hay, size_t hay_len, const char* needle, size_t needle_len) {
+  if (!needle_len)
+    return 0;
+  if (needle_len > hay_len)
+    return kSubstringNotFound;
+
+  const char* end = hay + hay_len - needle_len + 1;
+  const char* curr = hay;
+  while (curr < end) {
+    curr = static_cast<const char*>(memchr(curr, needle[0], end - curr));
+    if (!curr)
+      break;
+    if (0 == memcmp(curr + 1, needle + 1, needle_len - 1))
+      return curr - hay;
+    ++curr;
+  }
+  return kSubstringNotFound;
+}
+
+size_t FindSubstring(const char* hay, size_t hay_len, const char* needle, size_t needle_len) {
+  if (!needle_len)
+    return 0;
+  if (needle_len > hay_len)
+    return kSubstringNotFound;
+  return GetKernel().find(hay, hay_len, needle, needle_len);
+}
+
+const char* SubstringKernelName() {
+  return GetKernel().name;
+}
@@ -0,0 +1,21 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stddef.h>
+
+const size_t kSubstringNotFound = static_cast<size_t>(-1);
+
+// Returns the position of the first |needle| in |hay| or kSubstringNotFound.
+// Both are bytes, and a match of valid UTF-8 in UTF-8 always starts on a
+// character. It looks for the first and the last byte of the needle a full
+// vector at a time and only compares the rest of the needle at the positions
+// where both line up. Uses AVX2 if the cpu has it, otherwise SSE2 on x86 and a
+// plain loop anywhere else. An empty needle is found at 0.
+size_t FindSubstring(const char* hay, size_t hay_len, const char* needle, size_t needle_len);
+
+// The same with no vector code, used for the tail of the haystack.
+size_t FindSubstringScalar(const char* hay, size_t hay_len, const char* needle, size_t needle_len);
+
+// The name of the kernel that FindSubstring() picked: "avx2", "sse2" or "scalar".
+const char* SubstringKernelName();
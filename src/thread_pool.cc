@@ -1,28 +1,172 @@
 // Copyright (c) 2011 Carlos Pizano-Uribe
 // Please see the README file for attribution and license details.
-#include "target_version_win.h"
-#include "thread_pool.h" 
 
-ThreadPool::ThreadPool() : port_(NULL) {
-  port_ = ::CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 2);
+#include "thread_pool.h"
+
+#include <chrono>
+
+namespace {
+  // Marks a task of a group done however it ends, a throw included, so that
+  // Wait() always returns.
+  class DoneOnExit {
+  public:
+    explicit DoneOnExit(TaskGroup* group) : group_(group) {}
+    ~DoneOnExit() { group_->Done(); }
+
+  private:
+    TaskGroup* group_;
+  };
+}
+
+void TaskGroup::Add(size_t count) {
+  std::lock_guard<std::mutex> lock(lock_);
+  count_ += count;
+}
+
+void TaskGroup::Done() {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (--count_ == 0)
+    zero_cv_.notify_all();
+}
+
+void TaskGroup::Wait() {
+  std::unique_lock<std::mutex> lock(lock_);
+  while (count_ != 0) {
+    zero_cv_.wait(lock);
+  }
+}
+
+bool TaskGroup::WaitFor(unsigned int ms) {
+  std::unique_lock<std::mutex> lock(lock_);
+  // Through spurious wake ups, until the time is really up.
+  return zero_cv_.wait_for(lock, std::chrono::milliseconds(ms), [this]() { return count_ == 0; });
+}
+
+size_t TaskGroup::pending() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return count_;
+}
+
+ThreadPool::ThreadPool(size_t threads)
+    : queued_(0), next_victim_(0), started_(false), stopping_(false) {
+  if (!threads)
+    threads = std::thread::hardware_concurrency();
+  if (!threads)
+    threads = 1;
+  for (size_t ix = 0; ix != threads; ++ix) {
+    workers_.push_back(new Worker);
+  }
+  for (size_t ix = 0; ix != threads; ++ix) {
+    workers_[ix]->thread = std::thread(&ThreadPool::WorkerLoop, this, ix);
+  }
+  // The workers wait for every id to be known, CurrentWorker() reads them.
+  std::lock_guard<std::mutex> lock(idle_lock_);
+  for (size_t ix = 0; ix != threads; ++ix) {
+    workers_[ix]->id = workers_[ix]->thread.get_id();
+  }
+  started_ = true;
+  wake_cv_.notify_all();
 }
 
 ThreadPool::~ThreadPool() {
-  ::CloseHandle(port_);
+  {
+    std::lock_guard<std::mutex> lock(idle_lock_);
+    stopping_ = true;
+  }
+  wake_cv_.notify_all();
+  // The last ones out still steal from the others, no deque goes away
+  // before every thread is done.
+  for (size_t ix = 0; ix != workers_.size(); ++ix) {
+    workers_[ix]->thread.join();
+  }
+  for (size_t ix = 0; ix != workers_.size(); ++ix) {
+    delete workers_[ix];
+  }
+}
+
+size_t ThreadPool::CurrentWorker() const {
+  std::thread::id self = std::this_thread::get_id();
+  for (size_t ix = 0; ix != workers_.size(); ++ix) {
+    if (workers_[ix]->id == self)
+      return ix;
+  }
+  return static_cast<size_t>(-1);
 }
 
-void ThreadPool::EnterLoop( WorkerBase* worker) {
-  DWORD bytes;
-  ULONG_PTR key;
-  OVERLAPPED* ov;
-  
-  while(::GetQueuedCompletionStatus(port_, &bytes, &key, &ov, INFINITE)) {
-    if (!worker->DoWork(ov))
-      break;
+void ThreadPool::Post(Task task) {
+  size_t wix = CurrentWorker();
+  if (wix == static_cast<size_t>(-1))
+    wix = next_victim_++ % workers_.size();
+  // Counted before it is there: a thread that sees the count early looks
+  // again instead of sleeping through it.
+  ++queued_;
+  {
+    std::lock_guard<std::mutex> lock(workers_[wix]->lock);
+    workers_[wix]->tasks.push_back(std::move(task));
   }
+  // Taking the lock orders this with a thread that just found nothing to do
+  // and is about to sleep, so it can't miss the wake up.
+  std::lock_guard<std::mutex> lock(idle_lock_);
+  wake_cv_.notify_one();
+}
+
+void ThreadPool::Post(TaskGroup* group, Task task) {
+  group->Add(1);
+  Post([group, task]() {
+    DoneOnExit done(group);
+    task();
+  });
+}
 
+bool ThreadPool::NextTask(size_t wix, Task* task) {
+  Worker* self = workers_[wix];
+  {
+    std::lock_guard<std::mutex> lock(self->lock);
+    if (!self->tasks.empty()) {
+      *task = std::move(self->tasks.back());
+      self->tasks.pop_back();
+      --queued_;
+      return true;
+    }
+  }
+  for (size_t ix = 1; ix < workers_.size(); ++ix) {
+    Worker* victim = workers_[(wix + ix) % workers_.size()];
+    std::lock_guard<std::mutex> lock(victim->lock);
+    if (!victim->tasks.empty()) {
+      *task = std::move(victim->tasks.front());
+      victim->tasks.pop_front();
+      --queued_;
+      return true;
+    }
+  }
+  return false;
 }
 
-bool ThreadPool::PostJob(void* ctx) {
-  return ::PostQueuedCompletionStatus(port_, 0, 1ull, reinterpret_cast<OVERLAPPED*>(ctx)) == TRUE; 
+void ThreadPool::WorkerLoop(size_t wix) {
+  {
+    std::unique_lock<std::mutex> lock(idle_lock_);
+    while (!started_) {
+      wake_cv_.wait(lock);
+    }
+  }
+  Task task;
+  while (true) {
+    if (NextTask(wix, &task)) {
+      // A task that throws ends there, the thread goes on with the next.
+      try {
+        task();
+      } catch (...) {
+      }
+      task = Task();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(idle_lock_);
+    while (queued_ == 0) {
+      // A task still running elsewhere can post more, but that goes on its
+      // own thread's deque and that thread runs it.
+      if (stopping_)
+        return;
+      wake_cv_.wait(lock);
+    }
+  }
 }
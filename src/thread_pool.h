@@ -2,27 +2,103 @@
 // Copyright (c) 2011 Carlos Pizano-Uribe
 // Please see the README file for attribution and license details.
 
-class WorkerBase {
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counts the tasks of a job that are still to run, so whoever started the
+// job can wait for all of it. Tasks can add more tasks to the group before
+// they finish.
+class TaskGroup {
 public:
-  virtual bool DoWork(void* p) = 0;
-};
+  TaskGroup() : count_(0) {}
 
-template <typename Derived>
-class Worker : public WorkerBase {
-  //typedef typename Derived::Context Ctx;
-protected:
-  virtual bool DoWork(void* p) override {
-    return static_cast<Derived*>(this)->OnWork(reinterpret_cast<Derived::Context*>(p));
-  }
+  void Add(size_t count);
+  void Done();
+  // Returns once the count is down to zero.
+  void Wait();
+  // The same, giving up after |ms|. Returns true if the count is zero.
+  bool WaitFor(unsigned int ms);
+  size_t pending() const;
+
+private:
+  mutable std::mutex lock_;
+  std::condition_variable zero_cv_;
+  size_t count_;
+
+  TaskGroup(const TaskGroup&);
+  void operator=(const TaskGroup&);
 };
 
+// A fixed set of threads that run tasks. Each thread has its own deque: the
+// tasks a thread posts go on its own deque and it runs them newest first,
+// which keeps a recursive job like a directory walk depth first and its data
+// warm. A thread with nothing left steals the oldest task of another thread,
+// usually the biggest piece of untouched work. Tasks posted from outside the
+// pool are dealt round robin.
+//
+// The destructor runs every task already posted, including the ones those
+// post, and then joins the threads. The exception of a task posted with
+// Post() is dropped, use Submit() to get it.
 class ThreadPool {
 public:
-  ThreadPool();
+  typedef std::function<void()> Task;
+
+  // Zero |threads| means one per core.
+  explicit ThreadPool(size_t threads);
   ~ThreadPool();
-  void EnterLoop(WorkerBase* job);
-  bool PostJob(void* ctx);
+
+  size_t size() const { return workers_.size(); }
+
+  void Post(Task task);
+  // Counts |task| in |group| until it has run, or thrown.
+  void Post(TaskGroup* group, Task task);
+
+  // Runs |fn| on the pool and hands its result, or its exception, to the
+  // returned future.
+  template <typename F>
+  std::future<typename std::result_of<F()>::type> Submit(F fn) {
+    typedef typename std::result_of<F()>::type R;
+    std::shared_ptr<std::packaged_task<R()> > task(new std::packaged_task<R()>(fn));
+    std::future<R> result = task->get_future();
+    Post([task]() { (*task)(); });
+    return result;
+  }
+
+  // The index, below size(), of the pool thread calling, or -1 for threads
+  // that are not of this pool.
+  size_t CurrentWorker() const;
 
 private:
-  HANDLE port_;
-};
\ No newline at end of file
+  struct Worker {
+    std::mutex lock;
+    std::deque<Task> tasks;
+    std::thread thread;
+    std::thread::id id;
+  };
+
+  void WorkerLoop(size_t wix);
+  bool NextTask(size_t wix, Task* task);
+
+  std::vector<Worker*> workers_;
+  // Tasks in the deques, not yet taken.
+  std::atomic<size_t> queued_;
+  std::atomic<size_t> next_victim_;
+
+  // Idle threads sleep on |wake_cv_|.
+  std::mutex idle_lock_;
+  std::condition_variable wake_cv_;
+  bool started_;
+  bool stopping_;
+
+  ThreadPool(const ThreadPool&);
+  void operator=(const ThreadPool&);
+};
@@ -0,0 +1,201 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+//
+// Tests of ThreadPool and TaskGroup. No framework: every check that fails
+// says where, and the exit code says whether they all passed. A test that
+// would hang on a bug waits with a timeout instead and fails.
+//
+// usage: thread_pool_test
+
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+
+#include "thread_pool.h"
+
+namespace {
+  int g_checks = 0;
+  int g_failures = 0;
+
+  void Check(bool ok, const char* what, int line) {
+    ++g_checks;
+    if (!ok) {
+      fprintf(stderr, "thread_pool_test.cc(%d): failed: %s\n", line, what);
+      ++g_failures;
+    }
+  }
+
+#define CHECK(cond) Check((cond), #cond, __LINE__)
+
+  const unsigned int kTimeoutMs = 10000;
+
+  void SleepMs(int ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+  }
+
+  void TestRunsEveryTask() {
+    ThreadPool pool(4);
+    CHECK(pool.size() == 4);
+    TaskGroup group;
+    std::atomic<int> runs(0);
+    for (int ix = 0; ix != 1000; ++ix) {
+      pool.Post(&group, [&runs]() { ++runs; });
+    }
+    CHECK(group.WaitFor(kTimeoutMs));
+    CHECK(runs == 1000);
+    CHECK(group.pending() == 0);
+  }
+
+  // The parent posts its children on its own deque and then blocks, so only
+  // the other threads, stealing, can run them.
+  void TestStealing() {
+    ThreadPool pool(4);
+    TaskGroup outer;
+    std::mutex lock;
+    std::set<size_t> thieves;
+    size_t parent = static_cast<size_t>(-1);
+    bool children_done = false;
+    pool.Post(&outer, [&]() {
+      parent = pool.CurrentWorker();
+      TaskGroup children;
+      for (int ix = 0; ix != 64; ++ix) {
+        pool.Post(&children, [&]() {
+          SleepMs(1);
+          std::lock_guard<std::mutex> guard(lock);
+          thieves.insert(pool.CurrentWorker());
+        });
+      }
+      children_done = children.WaitFor(kTimeoutMs);
+    });
+    CHECK(outer.WaitFor(2 * kTimeoutMs));
+    CHECK(children_done);
+    CHECK(parent < pool.size());
+    CHECK(!thieves.empty());
+    CHECK(thieves.count(parent) == 0);
+    CHECK(thieves.count(static_cast<size_t>(-1)) == 0);
+  }
+
+  // A binary tree of tasks, each posting its children from its worker.
+  void PostTree(ThreadPool* pool, TaskGroup* group, std::atomic<int>* runs,
+                std::atomic<int>* off_pool, int depth) {
+    ++*runs;
+    if (pool->CurrentWorker() >= pool->size())
+      ++*off_pool;
+    if (depth == 0)
+      return;
+    for (int ix = 0; ix != 2; ++ix) {
+      pool->Post(group, [=]() { PostTree(pool, group, runs, off_pool, depth - 1); });
+    }
+  }
+
+  void TestNestedPost() {
+    ThreadPool pool(3);
+    TaskGroup group;
+    std::atomic<int> runs(0);
+    std::atomic<int> off_pool(0);
+    ThreadPool* p = &pool;
+    TaskGroup* g = &group;
+    std::atomic<int>* r = &runs;
+    std::atomic<int>* o = &off_pool;
+    pool.Post(&group, [=]() { PostTree(p, g, r, o, 10); });
+    CHECK(group.WaitFor(kTimeoutMs));
+    CHECK(runs == 2047);
+    CHECK(off_pool == 0);
+  }
+
+  void TestWait() {
+    ThreadPool pool(2);
+    TaskGroup empty;
+    CHECK(empty.WaitFor(0));
+    empty.Wait();
+
+    TaskGroup group;
+    std::atomic<bool> release(false);
+    pool.Post(&group, [&release]() {
+      while (!release)
+        SleepMs(1);
+    });
+    CHECK(!group.WaitFor(20));
+    CHECK(group.pending() == 1);
+    release = true;
+    group.Wait();
+    CHECK(group.pending() == 0);
+    CHECK(group.WaitFor(0));
+  }
+
+  void TestSubmit() {
+    ThreadPool pool(2);
+    CHECK(pool.CurrentWorker() == static_cast<size_t>(-1));
+    std::future<int> answer = pool.Submit([]() { return 42; });
+    CHECK(answer.get() == 42);
+
+    std::future<size_t> worker = pool.Submit([&pool]() { return pool.CurrentWorker(); });
+    CHECK(worker.get() < pool.size());
+
+    std::future<int> failed = pool.Submit([]() -> int { throw std::runtime_error("failed"); });
+    bool thrown = false;
+    try {
+      failed.get();
+    } catch (const std::runtime_error&) {
+      thrown = true;
+    }
+    CHECK(thrown);
+  }
+
+  // The destructor runs what is queued, and what that posts, before it joins.
+  void TestShutdownDrains() {
+    std::atomic<int> runs(0);
+    {
+      ThreadPool pool(2);
+      ThreadPool* p = &pool;
+      for (int ix = 0; ix != 100; ++ix) {
+        pool.Post([p, &runs]() {
+          SleepMs(1);
+          ++runs;
+          p->Post([&runs]() { ++runs; });
+        });
+      }
+    }
+    CHECK(runs == 200);
+  }
+
+  // With one thread, the tasks after the ones that throw can only run if
+  // the thread survived them.
+  void TestThrowingTasks() {
+    ThreadPool pool(1);
+    TaskGroup group;
+    std::atomic<int> runs(0);
+    for (int ix = 0; ix != 10; ++ix) {
+      pool.Post(&group, []() { throw std::runtime_error("task"); });
+      pool.Post(&group, [&runs]() { ++runs; });
+    }
+    CHECK(group.WaitFor(kTimeoutMs));
+    CHECK(group.pending() == 0);
+    CHECK(runs == 10);
+
+    pool.Post([]() { throw 1; });
+    CHECK(pool.Submit([]() { return 7; }).get() == 7);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  TestRunsEveryTask();
+  TestStealing();
+  TestNestedPost();
+  TestWait();
+  TestSubmit();
+  TestShutdownDrains();
+  TestThrowingTasks();
+  if (g_failures) {
+    fprintf(stderr, "%d of %d checks failed\n", g_failures, g_checks);
+    return 1;
+  }
+  printf("all %d checks passed\n", g_checks);
+  return 0;
+}
@@ -1,6 +1,12 @@
 #include "tokenizer.h"
 
-MemDataStream::MemDataStream(char* start, char* end)
+#include <string.h>
+
+#include <algorithm>
+
+#include "simd_support.h"
+
+MemDataStream::MemDataStream(const char* start, const char* end)
     : start_(start), end_(end), pos_(0ul) {
 }
 
@@ -8,9 +14,10 @@ MemDataStream::~MemDataStream() {
 }
 
 size_t MemDataStream::Read(Buffer& buffer) {
-  size_t left = end_ - &start_[pos_];
+  size_t left = (end_ - start_) - pos_;
   size_t read = std::min(buffer.size, left);
-  memcpy(buffer.pbuff, &start_[pos_], read);
+  memcpy(buffer.pbuff, start_ + pos_, read);
+  pos_ += read;
   return read;
 }
 
@@ -19,162 +26,358 @@ size_t MemDataStream::GetPos() {
 }
 
 size_t MemDataStream::SetPos(size_t pos) {
-  size_t last_pos = pos;
-  pos_ = pos;
+  size_t last_pos = pos_;
+  pos_ = std::min(pos, static_cast<size_t>(end_ - start_));
   return last_pos;
 }
 
-void VetoInsertTokens(const std::string token, std::list<std::string>& tlist) {
-  //
-  if ((token == "auto") ||
-      (token == "const") ||
-      (token == "double") ||
-      (token == "float") ||
-      (token == "int") ||
-      (token == "short") ||
-      (token == "struct") ||
-      (token == "unsigned") ||
-      (token == "for") ||
-      (token == "long") ||
-      (token == "signed") ||
-      (token == "switch") ||
-      (token == "void") ||
-      (token == "case") ||
-      (token == "default") ||
-      (token == "enum") ||
-      (token == "goto") ||
-      (token == "sizeof") ||
-      (token == "typedef") ||
-      (token == "volatile") ||
-      (token == "char") ||
-      (token == "do") ||
-      (token == "extern") ||
-      (token == "if") ||
-      (token == "return") ||
-      (token == "static") ||
-      (token == "union") ||
-      (token == "while") ||
-      (token == "dynamic_cast") ||
-      (token == "namespace") ||
-      (token == "reinterpret_cast") ||
-      (token == "bool") ||
-      (token == "explicit") ||
-      (token == "new") ||
-      (token == "static_cast") ||
-      (token == "operator") ||
-      (token == "template") ||
-      (token == "typename") ||
-      (token == "class") ||
-      (token == "friend") ||
-      (token == "private") ||
-      (token == "this") ||
-      (token == "using") ||
-      (token == "const_cast") ||
-      (token == "inline") ||
-      (token == "public") ||
-      (token == "virtual") ||
-      (token == "delete") ||
-      (token == "protected") ||
-      (token == "wchar_t") ||
-      (token == "is") ||
-      (token == "at") ||
-      (token == "of") ||
-      (token == "a") ||
-      (token == "c"))
-    return;
-
-  tlist.push_back(token);
-}
+namespace {
+  enum CharClass {
+    kSkip,        // NUL and non-ASCII, they neither start nor end a token.
+    kSeparator,
+    kTokenChar,   // Letters, digits and underscores.
+    kBinary       // The other control characters.
+  };
+
+  // Indexed by the unsigned value of the char, the rest are kSkip.
+  const uint8_t kCharClass[256] = {
+    0, 3, 3, 3, 3, 3, 3, 3, 3, 1, 1, 1, 1, 1, 3, 3,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1,
+    1, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 2,
+    1, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 3,
+  };
 
-bool Tokenize(const char* beg, const char* end, std::list<std::string>& tlist) {
-  const char* tok_start = NULL;
+  // Tokens that are everywhere and nobody searches for.
+  const char* const kKeywords[] = {
+    "auto", "const", "double", "float", "int", "short", "struct", "unsigned",
+    "for", "long", "signed", "switch", "void", "case", "default", "enum",
+    "goto", "sizeof", "typedef", "volatile", "char", "do", "extern", "if",
+    "return", "static", "union", "while", "dynamic_cast", "namespace",
+    "reinterpret_cast", "bool", "explicit", "new", "static_cast", "operator",
+    "template", "typename", "class", "friend", "private", "this", "using",
+    "const_cast", "inline", "public", "virtual", "delete", "protected",
+    "wchar_t", "is", "at", "of", "a", "c"
+  };
 
-	while (beg < end) {   
-    char c = *beg;
-    if (c > 0) {
-      // Some files are UTF-8 encoded. Here we ignore anything that is not latin.
-      if (iscntrl(c) && (isspace(c) == 0))
-        return false;
+  // A perfect hash of the keywords: no two land in the same slot, so a token
+  // is compared with at most one of them. The multipliers were found by
+  // trying them in turn; adding a keyword means finding new ones and laying
+  // the slots out again.
+  inline size_t KeywordHash(const char* token, size_t len) {
+    const unsigned char* uc = reinterpret_cast<const unsigned char*>(token);
+    return (uc[0] + uc[len - 1] * 24 + uc[len / 2] * 29 + len) & 0xFF;
+  }
+
+  // One plus the index in kKeywords of the keyword in each slot, or zero.
+  const uint8_t kKeywordSlots[256] = {
+     0,  0,  0,  0,  0,  0,  0, 43,  0, 25, 34,  0,  0,  0,  0,  0,
+    44,  0,  0,  0, 21,  0,  0,  0,  0, 32, 20,  0,  0,  0,  0,  0,
+     0,  0,  0,  0, 36, 42,  0,  0,  0,  0,  0,  0, 23, 39,  0,  0,
+    37,  0, 33,  0,  0,  0,  0,  0,  0,  0, 51,  0,  0, 40,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0, 15,  0, 49,  0, 31, 41,  0, 11,
+     0,  0,  0, 48,  0,  0,  0,  0,  0,  0,  0, 50,  0, 12,  0,  0,
+     0, 22,  0,  0,  0,  0,  0, 52,  0,  0, 38,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0, 54,  0,  0, 18,  0, 19,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0, 29,  8, 24,  0,  0,  0,  0, 10, 53,
+     0,  0,  0,  0,  0, 35,  0,  0,  0,  0,  7,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  9,  0,  0, 27,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  2, 13,
+     0, 47,  5,  0,  0,  0,  0,  0,  0,  0,  0,  0, 45,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0, 28,  0,  0,  0,  0,  4,  0,
+     0,  0, 16, 55,  0, 26, 14,  0,  0,  0,  0,  6,  0,  0,  0,  0,
+     0,  1,  0,  0,  0,  0, 30, 17,  0,  0, 46,  0,  3,  0,  0,  0,
+  };
+
+  // Whether a token can't go on past |c|.
+  inline bool EndsToken(char c) {
+    uint8_t cc = kCharClass[static_cast<unsigned char>(c)];
+    return (cc == kSeparator) || (cc == kBinary);
+  }
 
-      if (!tok_start) {
-        // No token yet.
-        if (isalnum(c))
-          tok_start = beg;
+  bool IsKeyword(const char* token, size_t len) {
+    unsigned int slot = kKeywordSlots[KeywordHash(token, len)];
+    if (!slot)
+      return false;
+    // Lengths first: a token can hold a NUL, which strncmp() would stop at
+    // before the keyword does and then read past its end.
+    const char* keyword = kKeywords[slot - 1];
+    return (strlen(keyword) == len) && (memcmp(keyword, token, len) == 0);
+  }
+
+  inline void AddToken(const char* token, size_t len, TokenList* tokens) {
+    if (!IsKeyword(token, len))
+      tokens->Add(token, len);
+  }
+
+  typedef bool (*TokenizeFn)(const char*, const char*, TokenList*);
+
+  struct Kernel {
+    TokenizeFn tokenize;
+    const char* name;
+  };
+
+  // A byte at a time. |*tok_start| is the token still open coming in and
+  // going out, or NULL.
+  inline bool ScanScalar(const char* beg, const char* end, const char** tok_start,
+                         TokenList* tokens) {
+    for (; beg != end; ++beg) {
+      switch (kCharClass[static_cast<unsigned char>(*beg)]) {
+        case kTokenChar:
+          if (!*tok_start)
+            *tok_start = beg;
+          break;
+        case kSeparator:
+          if (*tok_start) {
+            AddToken(*tok_start, beg - *tok_start, tokens);
+            *tok_start = NULL;
+          }
+          break;
+        case kBinary:
+          // Not a text file.
+          return false;
+        default:
+          break;
+      }
+    }
+    return true;
+  }
+
+  inline bool FinishWithScalar(const char* beg, const char* end, const char* tok_start,
+                               TokenList* tokens) {
+    if (!ScanScalar(beg, end, &tok_start, tokens))
+      return false;
+    if (tok_start)
+      AddToken(tok_start, end - tok_start, tokens);
+    return true;
+  }
+
+#if defined(KF_X86_SIMD)
+  // The vector kernels classify 64 bytes into two masks, bit n for byte n:
+  // the token characters and the bytes the masks can't deal with, which are
+  // kSkip and kBinary. Blocks without the latter, nearly all of them in
+  // source code, have their tokens at the bits where the token mask flips.
+  const size_t kBlock = 64;
+
+  inline void WalkMasks(const char* block, uint64_t token_mask, const char** tok_start,
+                        TokenList* tokens) {
+    uint64_t flips = token_mask ^ ((token_mask << 1) | (*tok_start ? 1 : 0));
+    while (flips) {
+      const char* at = block + LowestBit64(flips);
+      if (*tok_start) {
+        AddToken(*tok_start, at - *tok_start, tokens);
+        *tok_start = NULL;
+      } else {
+        *tok_start = at;
+      }
+      flips &= flips - 1;
+    }
+  }
+
+  // NUL, the control characters but the white space ones, DEL and every
+  // byte with the top bit set, which compares as negative.
+  inline __m128i SpecialBytes128(__m128i bytes) {
+    __m128i ctrl = _mm_cmpgt_epi8(_mm_set1_epi8(0x20), bytes);
+    __m128i space = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(0x08)),
+                                  _mm_cmpgt_epi8(_mm_set1_epi8(0x0E), bytes));
+    return _mm_or_si128(_mm_andnot_si128(space, ctrl), _mm_cmpeq_epi8(bytes, _mm_set1_epi8(0x7F)));
+  }
+
+  // SSE2 has no byte shuffle, ranges it is. Or-ing 0x20 folds the upper
+  // case letters onto the lower case ones and nothing else onto them.
+  inline __m128i TokenBytes128(__m128i bytes) {
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), bytes));
+    __m128i lower = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                  _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), lower));
+    __m128i under = _mm_cmpeq_epi8(bytes, _mm_set1_epi8('_'));
+    return _mm_or_si128(_mm_or_si128(digit, alpha), under);
+  }
+
+  bool TokenizeSse2(const char* beg, const char* end, TokenList* tokens) {
+    const char* tok_start = NULL;
+    for (; static_cast<size_t>(end - beg) >= kBlock; beg += kBlock) {
+      uint64_t token_mask = 0;
+      uint64_t special = 0;
+      for (size_t ix = 0; ix != kBlock; ix += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(beg + ix));
+        token_mask |= static_cast<uint64_t>(_mm_movemask_epi8(TokenBytes128(bytes))) << ix;
+        special |= static_cast<uint64_t>(_mm_movemask_epi8(SpecialBytes128(bytes))) << ix;
+      }
+      if (special) {
+        if (!ScanScalar(beg, beg + kBlock, &tok_start, tokens))
+          return false;
       } else {
-        // Middle of a token.
-        if (!isalnum(c)) {
-          VetoInsertTokens(std::string(tok_start, beg), tlist);
-          //tlist.push_back(std::string(tok_start, beg));
-          tok_start = NULL;
-        }
+        WalkMasks(beg, token_mask, &tok_start, tokens);
       }
     }
+    return FinishWithScalar(beg, end, tok_start, tokens);
+  }
 
-    ++beg;
+  KF_TARGET_AVX2 inline __m256i SpecialBytes256(__m256i bytes) {
+    __m256i ctrl = _mm256_cmpgt_epi8(_mm256_set1_epi8(0x20), bytes);
+    __m256i space = _mm256_and_si256(_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8(0x08)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8(0x0E), bytes));
+    return _mm256_or_si256(_mm256_andnot_si256(space, ctrl),
+                           _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(0x7F)));
   }
 
-  if (tok_start) {
-    VetoInsertTokens(std::string(tok_start, beg - 1), tlist);
-    //tlist.push_back(std::string(tok_start, beg - 1));
+  // Looks up the low and the high nibble of each byte in two 16 entry tables
+  // and ands the results, a token character is one with a bit left:
+  //   bit 0  digits           high 3, low 0-9
+  //   bit 1  A-O and a-o      high 4 and 6, low 1-F
+  //   bit 2  P-Z and p-z      high 5 and 7, low 0-A
+  //   bit 3  _                high 5, low F
+  // The high nibble of bytes with the top bit set is 8-F, all zeros.
+  KF_TARGET_AVX2 inline __m256i TokenBytes256(__m256i bytes) {
+    const __m256i low_table = _mm256_setr_epi8(
+        5, 7, 7, 7, 7, 7, 7, 7, 7, 7, 6, 2, 2, 2, 2, 10,
+        5, 7, 7, 7, 7, 7, 7, 7, 7, 7, 6, 2, 2, 2, 2, 10);
+    const __m256i high_table = _mm256_setr_epi8(
+        0, 0, 0, 1, 2, 12, 2, 4, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 1, 2, 12, 2, 4, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i low = _mm256_shuffle_epi8(low_table, _mm256_and_si256(bytes, nibble));
+    __m256i high = _mm256_shuffle_epi8(high_table,
+                                       _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble));
+    __m256i none = _mm256_cmpeq_epi8(_mm256_and_si256(low, high), _mm256_setzero_si256());
+    return _mm256_xor_si256(none, _mm256_set1_epi8(-1));
   }
 
+  KF_TARGET_AVX2
+  bool TokenizeAvx2(const char* beg, const char* end, TokenList* tokens) {
+    const char* tok_start = NULL;
+    for (; static_cast<size_t>(end - beg) >= kBlock; beg += kBlock) {
+      __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(beg));
+      __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(beg + 32));
+      uint64_t special =
+          static_cast<uint32_t>(_mm256_movemask_epi8(SpecialBytes256(lo))) |
+          (static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(SpecialBytes256(hi)))) << 32);
+      if (special) {
+        if (!ScanScalar(beg, beg + kBlock, &tok_start, tokens))
+          return false;
+        continue;
+      }
+      uint64_t token_mask =
+          static_cast<uint32_t>(_mm256_movemask_epi8(TokenBytes256(lo))) |
+          (static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(TokenBytes256(hi)))) << 32);
+      WalkMasks(beg, token_mask, &tok_start, tokens);
+    }
+    return FinishWithScalar(beg, end, tok_start, tokens);
+  }
+#endif  // KF_X86_SIMD
+
+  Kernel PickKernel() {
+    Kernel kernel = { TokenizeScalar, "scalar" };
+#if defined(KF_X86_SIMD)
+    if (CpuHasAvx2()) {
+      kernel.tokenize = TokenizeAvx2;
+      kernel.name = "avx2";
+    } else {
+      kernel.tokenize = TokenizeSse2;
+      kernel.name = "sse2";
+    }
+#endif
+    return kernel;
+  }
+
+  const Kernel& GetKernel() {
+    static const Kernel kernel = PickKernel();
+    return kernel;
+  }
+}
+
+void TokenList::Add(const char* token, size_t len) {
+  chars_.insert(chars_.end(), token, token + len);
+  ends_.push_back(static_cast<uint32_t>(chars_.size()));
+}
+
+bool Tokenize(const char* beg, const char* end, TokenList* tokens) {
+  return GetKernel().tokenize(beg, end, tokens);
+}
+
+bool TokenizeScalar(const char* beg, const char* end, TokenList* tokens) {
+  return FinishWithScalar(beg, end, NULL, tokens);
+}
+
+const char* TokenizerKernelName() {
+  return GetKernel().name;
+}
+
+StreamTokenizer::StreamTokenizer()
+    : stream_(NULL), carry_(0), skipping_(false), text_(true) {
+}
+
+void StreamTokenizer::Reset(DataStream* stream) {
+  stream_ = stream;
+  carry_ = 0;
+  skipping_ = false;
+  text_ = true;
+  if (chunk_.size() < kTokenizeChunk)
+    chunk_.resize(kTokenizeChunk);
+}
+
+bool StreamTokenizer::Next(TokenList* tokens) {
+  if (!stream_)
+    return false;
+  // The front |carry_| bytes of the chunk are the end of the last one, a
+  // token that might go on in this one.
+  char* buf = &chunk_[0];
+  const size_t size = chunk_.size();
+  Buffer buffer(buf + carry_, size - carry_);
+  size_t read = stream_->Read(buffer);
+  size_t filled = carry_ + read;
+  size_t start = 0;
+  if (skipping_) {
+    while ((start != filled) && !EndsToken(buf[start]))
+      ++start;
+    skipping_ = (start == filled);
+  }
+
+  if (!read) {
+    // The end of the stream ends the last token.
+    if (!skipping_)
+      text_ = GetKernel().tokenize(buf + start, buf + filled, tokens);
+    stream_ = NULL;
+    return false;
+  }
+
+  // Only what comes before the last separator is sure to be whole.
+  size_t cut = filled;
+  while ((cut != start) && !EndsToken(buf[cut - 1]))
+    --cut;
+  if (!GetKernel().tokenize(buf + start, buf + cut, tokens)) {
+    text_ = false;
+    stream_ = NULL;
+    return false;
+  }
+
+  if ((cut == start) && (filled == size)) {
+    // No room left to find where the token ends. It is dropped whole,
+    // nobody searches for such a thing, unless the chunk was all bytes that
+    // are not in tokens.
+    for (size_t ix = start; ix != filled; ++ix) {
+      if (kCharClass[static_cast<unsigned char>(buf[ix])] == kTokenChar) {
+        skipping_ = true;
+        break;
+      }
+    }
+    carry_ = 0;
+  } else {
+    carry_ = filled - cut;
+    memmove(buf, buf + cut, carry_);
+  }
   return true;
 }
 
-bool Tokenize(DataStream& stream, std::list<std::string>& tlist) {
-	char backing[16] = {0};
-	Buffer buffer(backing, sizeof(backing));
-	size_t retrieved = 0;
-	bool exit = false;
-	std::string token;
-	
-	do {
-		retrieved = stream.Read(buffer);
-		if (retrieved < buffer.size) {
-			buffer.size = retrieved;
-			exit = true;
-		}
-
-		for(size_t ix =0; ix != buffer.size; ++ix) {
-			char c = buffer.cbuff[ix];
-
-			if (isalnum(c) || (c == '_') || (c == '.')) {
-				token.append(1, c);
-			} else {
-				if (isspace(c)) {
-					if (token.empty())
-						continue;
-					tlist.push_back(token);
-					token.clear();
-
-				} else if (isprint(c)) {
-					switch (c) {
-						case ';':             // C token.
-						case ',':             // C token.
-						case '{':             // C token.
-						case '}':             // C token.
-						case '(':             // C token.
-						case ')':             // C token.
-						case '*':             // C token.
-						case '<':             // ApiSpec token.
-						case '>':             // ApiSpec token.
-						case '=':             // ApiSpec token.
-						case '"':             // ApiSpec token.
-							if (!token.empty()) {
-								tlist.push_back(token);
-								token.clear();
-							}
-							tlist.push_back(std::string(1, c));
-							break;
-						default:
-							return false;							
-					}
-				} else {
-					continue;
-				}
-			}
-		}
-
-	} while(!exit);
-	return true;
+bool Tokenize(DataStream& stream, TokenList* tokens) {
+  StreamTokenizer tokenizer;
+  tokenizer.Reset(&stream);
+  while (tokenizer.Next(tokens)) {
+  }
+  return tokenizer.text();
 }
@@ -0,0 +1,186 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+//
+// Microbenchmark for the content tokenizer. It reads a corpus of source files
+// into memory and compares the throughput of the old tokenizer, one
+// std::string per token checked against the keywords one by one and pushed on
+// a std::list, with TokenizeScalar() and Tokenize() into a reused TokenList,
+// and with the StreamTokenizer reading each file through a MemDataStream.
+//
+// usage: find <source tree> -name "*.cc" -o -name "*.h" | tokenizer_bench
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <list>
+#include <string>
+#include <vector>
+
+#include "tokenizer.h"
+
+namespace {
+  const int kRounds = 5;
+
+  typedef bool (*TokenizeFn)(const char*, const char*, TokenList*);
+
+  // The tokenizer as it was, kept to measure against.
+  void VetoInsertTokens(const std::string token, std::list<std::string>& tlist) {
+    static const char* const kVeto[] = {
+      "auto", "const", "double", "float", "int", "short", "struct", "unsigned",
+      "for", "long", "signed", "switch", "void", "case", "default", "enum",
+      "goto", "sizeof", "typedef", "volatile", "char", "do", "extern", "if",
+      "return", "static", "union", "while", "dynamic_cast", "namespace",
+      "reinterpret_cast", "bool", "explicit", "new", "static_cast", "operator",
+      "template", "typename", "class", "friend", "private", "this", "using",
+      "const_cast", "inline", "public", "virtual", "delete", "protected",
+      "wchar_t", "is", "at", "of", "a", "c"
+    };
+    for (size_t ix = 0; ix != sizeof(kVeto) / sizeof(kVeto[0]); ++ix) {
+      if (token == kVeto[ix])
+        return;
+    }
+    tlist.push_back(token);
+  }
+
+  bool TokenizeBaseline(const char* beg, const char* end, std::list<std::string>& tlist) {
+    const char* tok_start = NULL;
+    while (beg < end) {
+      char c = *beg;
+      if (c > 0) {
+        if (iscntrl(c) && (isspace(c) == 0))
+          return false;
+        bool token_char = isalnum(c) || (c == '_');
+        if (!tok_start) {
+          if (token_char)
+            tok_start = beg;
+        } else if (!token_char) {
+          VetoInsertTokens(std::string(tok_start, beg), tlist);
+          tok_start = NULL;
+        }
+      }
+      ++beg;
+    }
+    if (tok_start)
+      VetoInsertTokens(std::string(tok_start, beg), tlist);
+    return true;
+  }
+
+  bool ReadFile(const char* path, std::string* contents) {
+    FILE* file = fopen(path, "rb");
+    if (!file)
+      return false;
+    char buf[64 * 1024];
+    size_t read;
+    while ((read = fread(buf, 1, sizeof(buf), file)) != 0) {
+      contents->append(buf, read);
+    }
+    fclose(file);
+    return true;
+  }
+
+  bool Same(const std::list<std::string>& expected, const TokenList& tokens) {
+    if (expected.size() != tokens.size())
+      return false;
+    size_t ix = 0;
+    for (std::list<std::string>::const_iterator it = expected.begin(); it != expected.end(); ++it, ++ix) {
+      if (it->compare(0, std::string::npos, tokens.token(ix), tokens.token_len(ix)) != 0)
+        return false;
+    }
+    return true;
+  }
+
+  // Returns how many files tokenize differently from the baseline.
+  int Compare(const std::vector<std::string>& corpus, TokenizeFn tokenize, size_t* tokens_found) {
+    int errors = 0;
+    std::list<std::string> tlist;
+    TokenList tokens;
+    for (size_t ix = 0; ix != corpus.size(); ++ix) {
+      tlist.clear();
+      tokens.clear();
+      const char* beg = corpus[ix].data();
+      bool ok_base = TokenizeBaseline(beg, beg + corpus[ix].size(), tlist);
+      bool ok = tokenize(beg, beg + corpus[ix].size(), &tokens);
+      if ((ok_base != ok) || !Same(tlist, tokens))
+        ++errors;
+      *tokens_found += tokens.size();
+    }
+    return errors;
+  }
+
+  // Tokenize() through the chunks of a stream.
+  bool TokenizeStream(const char* beg, const char* end, TokenList* tokens) {
+    static StreamTokenizer tokenizer;
+    MemDataStream stream(beg, end);
+    tokenizer.Reset(&stream);
+    while (tokenizer.Next(tokens)) {
+    }
+    return tokenizer.text();
+  }
+
+  double Seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+}
+
+int main(int argc, char* argv[]) {
+  std::vector<std::string> corpus;
+  size_t bytes = 0;
+  char line[4096];
+  while (fgets(line, sizeof(line), stdin)) {
+    line[strcspn(line, "\r\n")] = 0;
+    std::string contents;
+    if (!line[0] || !ReadFile(line, &contents) || contents.empty())
+      continue;
+    bytes += contents.size();
+    corpus.push_back(contents);
+  }
+  if (corpus.empty()) {
+    printf("no files, pipe a list of source files in\n");
+    return 1;
+  }
+
+  const TokenizeFn kTokenizers[] = { TokenizeScalar, Tokenize, TokenizeStream };
+  const size_t kCount = sizeof(kTokenizers) / sizeof(kTokenizers[0]);
+  double best[kCount + 1] = { 1e9, 1e9, 1e9, 1e9 };
+  std::list<std::string> tlist;
+  TokenList tokens;
+  for (int round = 0; round != kRounds; ++round) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t ix = 0; ix != corpus.size(); ++ix) {
+      tlist.clear();
+      const char* beg = corpus[ix].data();
+      TokenizeBaseline(beg, beg + corpus[ix].size(), tlist);
+    }
+    best[0] = std::min(best[0], Seconds(start));
+
+    for (size_t tx = 0; tx != kCount; ++tx) {
+      start = std::chrono::steady_clock::now();
+      for (size_t ix = 0; ix != corpus.size(); ++ix) {
+        tokens.clear();
+        const char* beg = corpus[ix].data();
+        kTokenizers[tx](beg, beg + corpus[ix].size(), &tokens);
+      }
+      best[tx + 1] = std::min(best[tx + 1], Seconds(start));
+    }
+  }
+
+  // Outside of the timing, all have to agree file by file.
+  size_t tokens_found = 0;
+  int errors = 0;
+  for (size_t tx = 0; tx != kCount; ++tx) {
+    tokens_found = 0;
+    errors += Compare(corpus, kTokenizers[tx], &tokens_found);
+  }
+
+  printf("%zu files, %.1f MB, %zu tokens, kernel: %s\n", corpus.size(), bytes / 1e6,
+         tokens_found, TokenizerKernelName());
+  printf("%-12s %10s %10s %10s %10s\n", "", "baseline", "scalar", "kernel", "stream");
+  printf("%-12s %10.1f %10.1f %10.1f %10.1f\n", "MB/s", bytes / best[0] / 1e6,
+         bytes / best[1] / 1e6, bytes / best[2] / 1e6, bytes / best[3] / 1e6);
+  if (errors)
+    printf("%d files tokenize differently\n", errors);
+  return errors ? 1 : 0;
+}
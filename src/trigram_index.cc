@@ -0,0 +1,147 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "trigram_index.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "file_table.h"
+#include "index_snapshot.h"
+
+namespace {
+  struct PostingRange {
+    const uint32_t* begin;
+    const uint32_t* end;
+
+    bool operator<(const PostingRange& rhs) const {
+      return (end - begin) < (rhs.end - rhs.begin);
+    }
+  };
+}
+
+size_t TrigramIndex::Find(uint32_t key) const {
+  const uint32_t* it = std::lower_bound(keys_.begin(), keys_.end(), key);
+  if ((it == keys_.end()) || (*it != key))
+    return static_cast<size_t>(-1);
+  return it - keys_.begin();
+}
+
+void TrigramIndex::TextKeys(const char* txt, size_t len, std::vector<uint32_t>* keys) {
+  keys->clear();
+  for (size_t ix = 0; ix + 3 <= len; ++ix) {
+    keys->push_back(Key(txt + ix));
+  }
+  std::sort(keys->begin(), keys->end());
+  keys->erase(std::unique(keys->begin(), keys->end()), keys->end());
+}
+
+void TrigramIndex::Build(const FileTable& files) {
+  keys_.clear();
+  starts_.clear();
+  postings_.clear();
+
+  // First pass counts the files of each trigram so the postings can be laid
+  // out back to back. The second pass fills them in file order, which leaves
+  // every list sorted.
+  std::unordered_map<uint32_t, uint32_t> slots;
+  std::vector<uint32_t> name_keys;
+  size_t total = 0;
+  for (size_t ix = 0; ix != files.size(); ++ix) {
+    TextKeys(files.name(ix), files.name_len(ix), &name_keys);
+    for (size_t kx = 0; kx != name_keys.size(); ++kx) {
+      ++slots[name_keys[kx]];
+    }
+    total += name_keys.size();
+  }
+
+  keys_.reserve(slots.size());
+  for (std::unordered_map<uint32_t, uint32_t>::const_iterator it = slots.begin();
+       it != slots.end(); ++it) {
+    keys_.push_back(it->first);
+  }
+  std::sort(keys_.mutable_data(), keys_.mutable_data() + keys_.size());
+
+  starts_.resize(keys_.size() + 1);
+  uint32_t* starts = starts_.mutable_data();
+  uint32_t sum = 0;
+  for (size_t kx = 0; kx != keys_.size(); ++kx) {
+    uint32_t& slot = slots[keys_[kx]];
+    starts[kx] = sum;
+    sum += slot;
+    // From now on |slot| is where the next file of this key goes.
+    slot = starts[kx];
+  }
+  starts[keys_.size()] = sum;
+
+  postings_.resize(total);
+  uint32_t* postings = postings_.mutable_data();
+  for (size_t ix = 0; ix != files.size(); ++ix) {
+    TextKeys(files.name(ix), files.name_len(ix), &name_keys);
+    for (size_t kx = 0; kx != name_keys.size(); ++kx) {
+      postings[slots[name_keys[kx]]++] = static_cast<uint32_t>(ix);
+    }
+  }
+}
+
+void TrigramIndex::Candidates(const char* txt, size_t len, std::vector<uint32_t>* out) const {
+  out->clear();
+
+  std::vector<uint32_t> query_keys;
+  TextKeys(txt, len, &query_keys);
+
+  std::vector<PostingRange> lists;
+  for (size_t kx = 0; kx != query_keys.size(); ++kx) {
+    size_t pos = Find(query_keys[kx]);
+    if (pos == static_cast<size_t>(-1))
+      return;
+    PostingRange range = { postings_.begin() + starts_[pos], postings_.begin() + starts_[pos + 1] };
+    lists.push_back(range);
+  }
+  if (lists.empty())
+    return;
+
+  // Start from the shortest list and drop the files missing from the others,
+  // so the work is bounded by the rarest trigram and not by the tree size.
+  std::sort(lists.begin(), lists.end());
+  out->assign(lists[0].begin, lists[0].end);
+  for (size_t lx = 1; (lx != lists.size()) && !out->empty(); ++lx) {
+    const uint32_t* it = lists[lx].begin;
+    const uint32_t* end = lists[lx].end;
+    size_t kept = 0;
+    for (size_t cx = 0; cx != out->size(); ++cx) {
+      uint32_t file = (*out)[cx];
+      it = std::lower_bound(it, end, file);
+      if (it == end)
+        break;
+      if (*it == file)
+        (*out)[kept++] = file;
+    }
+    out->resize(kept);
+  }
+}
+
+void TrigramIndex::Write(SnapshotWriter* out) const {
+  out->Add(keys_);
+  out->Add(starts_);
+  out->Add(postings_);
+}
+
+// Candidates() reads the lists between the starts of each key and hands out
+// the postings as file indexes, so both are checked once here.
+bool TrigramIndex::Map(SnapshotReader* in, size_t files) {
+  if (!in->Next(&keys_) || !in->Next(&starts_) || !in->Next(&postings_))
+    return false;
+  if ((starts_.size() != keys_.size() + 1) || (starts_[0] != 0) ||
+      (starts_[keys_.size()] != postings_.size()))
+    return false;
+  for (size_t kx = 0; kx != keys_.size(); ++kx) {
+    if (starts_[kx] > starts_[kx + 1])
+      return false;
+  }
+  for (size_t px = 0; px != postings_.size(); ++px) {
+    if (postings_[px] >= files)
+      return false;
+  }
+  return true;
+}
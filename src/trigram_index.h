@@ -0,0 +1,59 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "pod_array.h"
+
+class FileTable;
+class SnapshotReader;
+class SnapshotWriter;
+
+// Maps every three byte sequence found in a UTF-8 file name to the sorted list
+// of files whose name contains it. The postings of all trigrams live in one
+// array; |starts_| has where the list of each key begins.
+class TrigramIndex {
+public:
+  TrigramIndex() {}
+
+  void Build(const FileTable& files);
+
+  // Returns in |out| the files, in index order, whose names contain every
+  // trigram of |txt|. They still have to be checked for the full string.
+  // |len| is in bytes and must be 3 or more.
+  void Candidates(const char* txt, size_t len, std::vector<uint32_t>* out) const;
+
+  size_t memory_size() const {
+    return keys_.memory_size() + starts_.memory_size() + postings_.memory_size();
+  }
+
+  void Write(SnapshotWriter* out) const;
+  // |files| is how many files the index was built over.
+  bool Map(SnapshotReader* in, size_t files);
+
+private:
+  static uint32_t Key(const char* txt) {
+    return (static_cast<uint32_t>(static_cast<unsigned char>(txt[0])) << 16) |
+           (static_cast<uint32_t>(static_cast<unsigned char>(txt[1])) << 8) |
+           static_cast<uint32_t>(static_cast<unsigned char>(txt[2]));
+  }
+
+  // Returns the distinct trigrams of |txt| in |keys|, sorted.
+  static void TextKeys(const char* txt, size_t len, std::vector<uint32_t>* keys);
+
+  // Returns the position of |key| in |keys_| or -1.
+  size_t Find(uint32_t key) const;
+
+  // Sorted and unique.
+  PodArray<uint32_t> keys_;
+  // keys_.size() + 1 entries.
+  PodArray<uint32_t> starts_;
+  PodArray<uint32_t> postings_;
+
+  TrigramIndex(const TrigramIndex&);
+  void operator=(const TrigramIndex&);
+};
@@ -0,0 +1,107 @@
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include "utf8.h"
+
+namespace {
+  const unsigned int kReplacementChar = 0xFFFD;
+  // The smallest code point that needs each number of extra bytes.
+  const unsigned int kMinCodePoint[4] = { 0, 0x80, 0x800, 0x10000 };
+
+  // Never more characters than bytes: four bytes make at most a surrogate
+  // pair and a malformed byte one U+FFFD.
+  void PutCodePoint(unsigned int cp, wchar_t** out) {
+    if ((sizeof(wchar_t) == 2) && (cp > 0xFFFF)) {
+      cp -= 0x10000;
+      *(*out)++ = static_cast<wchar_t>(0xD800 + (cp >> 10));
+      *(*out)++ = static_cast<wchar_t>(0xDC00 + (cp & 0x3FF));
+    } else {
+      *(*out)++ = static_cast<wchar_t>(cp);
+    }
+  }
+
+  void AppendUtf8(unsigned int cp, std::string& out) {
+    if (cp < 0x80) {
+      out.append(1, static_cast<char>(cp));
+    } else if (cp < 0x800) {
+      out.append(1, static_cast<char>(0xC0 | (cp >> 6)));
+      out.append(1, static_cast<char>(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+      out.append(1, static_cast<char>(0xE0 | (cp >> 12)));
+      out.append(1, static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+      out.append(1, static_cast<char>(0x80 | (cp & 0x3F)));
+    } else {
+      out.append(1, static_cast<char>(0xF0 | (cp >> 18)));
+      out.append(1, static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+      out.append(1, static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+      out.append(1, static_cast<char>(0x80 | (cp & 0x3F)));
+    }
+  }
+}
+
+std::wstring Utf8ToWide(const char* str, size_t len) {
+  std::wstring out(len, L'\0');
+  if (len)
+    out.resize(Utf8ToWide(str, len, &out[0]));
+  return out;
+}
+
+size_t Utf8ToWide(const char* str, size_t len, wchar_t* out) {
+  const unsigned char* s = reinterpret_cast<const unsigned char*>(str);
+  wchar_t* const start = out;
+  size_t ix = 0;
+  while (ix < len) {
+    unsigned int c = s[ix];
+    if (c < 0x80) {
+      // The common case by far.
+      *out++ = static_cast<wchar_t>(c);
+      ++ix;
+      continue;
+    }
+    size_t extra = (c >= 0xF0) ? 3 : (c >= 0xE0) ? 2 : (c >= 0xC0) ? 1 : 0;
+    if (!extra || (c > 0xF4) || (ix + extra >= len)) {
+      PutCodePoint(kReplacementChar, &out);
+      ++ix;
+      continue;
+    }
+    unsigned int cp = c & (0x3F >> extra);
+    size_t jx = 1;
+    for (; jx <= extra; ++jx) {
+      unsigned int cc = s[ix + jx];
+      if ((cc & 0xC0) != 0x80)
+        break;
+      cp = (cp << 6) | (cc & 0x3F);
+    }
+    // Overlong forms and values past the last code point are malformed too.
+    // Encoded surrogates are not, they are how WTF-8 keeps unpaired ones.
+    if ((jx <= extra) || (cp < kMinCodePoint[extra]) || (cp > 0x10FFFF)) {
+      PutCodePoint(kReplacementChar, &out);
+      ++ix;
+      continue;
+    }
+    PutCodePoint(cp, &out);
+    ix += extra + 1;
+  }
+  return out - start;
+}
+
+std::string WideToUtf8(const wchar_t* str, size_t len) {
+  std::string out;
+  out.reserve(len);
+  for (size_t ix = 0; ix != len; ++ix) {
+    unsigned int cp = static_cast<unsigned int>(str[ix]);
+    if ((sizeof(wchar_t) == 2) && (cp >= 0xD800) && (cp < 0xDC00) && (ix + 1 != len)) {
+      unsigned int lo = static_cast<unsigned int>(str[ix + 1]);
+      if ((lo >= 0xDC00) && (lo < 0xE000)) {
+        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+        ++ix;
+      }
+    }
+    // An unpaired surrogate, which Windows allows in names, keeps its three
+    // byte form so that the name converts back to the same wide string.
+    if (cp > 0x10FFFF)
+      cp = kReplacementChar;
+    AppendUtf8(cp, out);
+  }
+  return out;
+}
@@ -0,0 +1,17 @@
+#pragma once
+// Copyright (c) 2011 Carlos Pizano-Uribe
+// Please see the README file for attribution and license details.
+
+#include <stddef.h>
+#include <string>
+
+// Conversions between the wide strings of the CodeSearch API and the UTF-8
+// that the engine keeps its names in and the POSIX file system hands out.
+// Malformed input, overlong forms and values past U+10FFFF included, becomes
+// U+FFFD a byte at a time. Unpaired surrogates are not malformed, they go
+// through as WTF-8, so any Windows name round trips.
+std::wstring Utf8ToWide(const char* str, size_t len);
+// The same into |out|, which needs room for |len| characters. Returns how
+// many it wrote, never more than |len|.
+size_t Utf8ToWide(const char* str, size_t len, wchar_t* out);
+std::string WideToUtf8(const wchar_t* str, size_t len);